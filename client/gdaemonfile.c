@@ -756,7 +756,7 @@ g_daemon_file_enumerate_children (GFile      *file,
                                              path,
                                              obj_path,
                                              attributes ? attributes : "",
-                                             flags,
+                                             flags | G_VFS_DAEMON_ENUMERATE_FLAG_COMPACT_INFO,
                                              uri,
                                              cancellable,
                                              &local_error);
@@ -1048,6 +1048,8 @@ typedef struct {
   GSimpleAsyncResult *result;
   GCancellable *cancellable;
   gulong cancelled_tag;
+  gchar *path;
+  guint32 pid;
 } AsyncCallFileReadWrite;
 
 static void
@@ -1057,37 +1059,61 @@ async_call_file_read_write_free (AsyncCallFileReadWrite *data)
   g_clear_object (&data->result);
   g_clear_object (&data->cancellable);
   g_free (data->etag);
+  g_free (data->path);
   g_free (data);
 }
 
+/* Returns the stream channel fd and sets direct_fd to the file itself
+   and shm_fd to the shared memory area if the daemon passed them, or -1 */
+static int
+get_stream_fds (GUnixFDList *fd_list,
+                guint fd_id,
+                gint direct_fd_id,
+                int *direct_fd,
+                gint shm_fd_id,
+                int *shm_fd)
+{
+  int fd;
+
+  *direct_fd = -1;
+  if (shm_fd)
+    *shm_fd = -1;
+  if (fd_list == NULL ||
+      g_unix_fd_list_get_length (fd_list) != 1 + (direct_fd_id != -1) + (shm_fd_id != -1))
+    return -1;
+
+  fd = g_unix_fd_list_get (fd_list, fd_id, NULL);
+  if (fd != -1 && direct_fd_id != -1)
+    *direct_fd = g_unix_fd_list_get (fd_list, direct_fd_id, NULL);
+  if (fd != -1 && shm_fd_id != -1)
+    *shm_fd = g_unix_fd_list_get (fd_list, shm_fd_id, NULL);
+
+  return fd;
+}
+
+static void read_async_cb (GVfsDBusMount *proxy,
+                           GAsyncResult *res,
+                           gpointer user_data);
+
 static void
-read_async_cb (GVfsDBusMount *proxy,
-               GAsyncResult *res,
-               gpointer user_data)
+read_async_complete (AsyncCallFileReadWrite *data,
+                     GUnixFDList *fd_list,
+                     GVariant *fd_id_val,
+                     gboolean can_seek,
+                     gint direct_fd_id,
+                     gint shm_fd_id)
 {
-  AsyncCallFileReadWrite *data = user_data;
-  GError *error = NULL;
   GSimpleAsyncResult *orig_result;
-  gboolean can_seek;
-  GUnixFDList *fd_list;
-  int fd;
-  GVariant *fd_id_val;
-  guint fd_id;
   GFileInputStream *stream;
+  guint fd_id;
+  int fd, direct_fd, shm_fd;
 
   orig_result = data->result;
-  
-  if (! gvfs_dbus_mount_call_open_for_read_finish (proxy, &fd_id_val, &can_seek, &fd_list, res, &error))
-    {
-      _g_simple_async_result_take_error_stripped (orig_result, error);
-      goto out;
-    }
 
   fd_id = g_variant_get_handle (fd_id_val);
   g_variant_unref (fd_id_val);
 
-  if (fd_list == NULL || g_unix_fd_list_get_length (fd_list) != 1 ||
-      (fd = g_unix_fd_list_get (fd_list, fd_id, NULL)) == -1)
+  if ((fd = get_stream_fds (fd_list, fd_id, direct_fd_id, &direct_fd, shm_fd_id, &shm_fd)) == -1)
     {
       g_simple_async_result_set_error (orig_result,
                                        G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -1095,10 +1121,77 @@ read_async_cb (GVfsDBusMount *proxy,
     }
   else
     {
-      stream = g_daemon_file_input_stream_new (fd, can_seek);
+      stream = g_daemon_file_input_stream_new (fd, direct_fd, shm_fd, can_seek);
       g_simple_async_result_set_op_res_gpointer (orig_result, stream, g_object_unref);
       g_object_unref (fd_list);
     }
+}
+
+static void
+read_direct_async_cb (GVfsDBusMount *proxy,
+                      GAsyncResult *res,
+                      gpointer user_data)
+{
+  AsyncCallFileReadWrite *data = user_data;
+  GError *error = NULL;
+  GSimpleAsyncResult *orig_result;
+  gboolean can_seek;
+  GUnixFDList *fd_list;
+  GVariant *fd_id_val;
+  gint direct_fd_id, shm_fd_id;
+
+  orig_result = data->result;
+
+  if (! gvfs_dbus_mount_call_open_for_read_direct_finish (proxy, &fd_id_val, &can_seek, &direct_fd_id, &shm_fd_id, &fd_list, res, &error))
+    {
+      /* Older daemon, let it send the data over the channel */
+      if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+        {
+          g_error_free (error);
+          gvfs_dbus_mount_call_open_for_read (proxy,
+                                              data->path,
+                                              data->pid,
+                                              NULL,
+                                              data->cancellable,
+                                              (GAsyncReadyCallback) read_async_cb,
+                                              data);
+          return;
+        }
+
+      _g_simple_async_result_take_error_stripped (orig_result, error);
+      goto out;
+    }
+
+  read_async_complete (data, fd_list, fd_id_val, can_seek, direct_fd_id, shm_fd_id);
+
+out:
+  _g_simple_async_result_complete_with_cancellable (orig_result, data->cancellable);
+  _g_dbus_async_unsubscribe_cancellable (data->cancellable, data->cancelled_tag);
+  data->result = NULL;
+  g_object_unref (orig_result);   /* trigger async_proxy_create_free() */
+}
+
+static void
+read_async_cb (GVfsDBusMount *proxy,
+               GAsyncResult *res,
+               gpointer user_data)
+{
+  AsyncCallFileReadWrite *data = user_data;
+  GError *error = NULL;
+  GSimpleAsyncResult *orig_result;
+  gboolean can_seek;
+  GUnixFDList *fd_list;
+  GVariant *fd_id_val;
+
+  orig_result = data->result;
+  
+  if (! gvfs_dbus_mount_call_open_for_read_finish (proxy, &fd_id_val, &can_seek, &fd_list, res, &error))
+    {
+      _g_simple_async_result_take_error_stripped (orig_result, error);
+      goto out;
+    }
+
+  read_async_complete (data, fd_list, fd_id_val, can_seek, -1, -1);
 
 out:
   _g_simple_async_result_complete_with_cancellable (orig_result, data->cancellable);
@@ -1118,19 +1211,19 @@ file_read_async_get_proxy_cb (GVfsDBusMount *proxy,
                                gpointer callback_data)
 {
   AsyncCallFileReadWrite *data = callback_data;
-  guint32 pid;
 
-  pid = get_pid_for_file (data->file);
+  data->pid = get_pid_for_file (data->file);
+  data->path = g_strdup (path);
   
   data->result = g_object_ref (result);
   
-  gvfs_dbus_mount_call_open_for_read (proxy,
-                                     path,
-                                     pid,
-                                     NULL,
-                                     cancellable,
-                                     (GAsyncReadyCallback) read_async_cb,
-                                     data);
+  gvfs_dbus_mount_call_open_for_read_direct (proxy,
+                                            path,
+                                            data->pid,
+                                            NULL,
+                                            cancellable,
+                                            (GAsyncReadyCallback) read_direct_async_cb,
+                                            data);
   data->cancelled_tag = _g_dbus_async_subscribe_cancellable (connection, cancellable);
 }
 
@@ -1181,8 +1274,9 @@ g_daemon_file_read (GFile *file,
   gboolean res;
   gboolean can_seek;
   GUnixFDList *fd_list;
-  int fd;
+  int fd, direct_fd, shm_fd;
   GVariant *fd_id_val = NULL;
+  gint direct_fd_id, shm_fd_id;
   guint32 pid;
   GError *local_error = NULL;
 
@@ -1192,15 +1286,34 @@ g_daemon_file_read (GFile *file,
   if (proxy == NULL)
     return NULL;
 
-  res = gvfs_dbus_mount_call_open_for_read_sync (proxy,
-                                                 path,
-                                                 pid,
-                                                 NULL,
-                                                 &fd_id_val,
-                                                 &can_seek,
-                                                 &fd_list,
-                                                 cancellable,
-                                                 &local_error);
+  res = gvfs_dbus_mount_call_open_for_read_direct_sync (proxy,
+                                                        path,
+                                                        pid,
+                                                        NULL,
+                                                        &fd_id_val,
+                                                        &can_seek,
+                                                        &direct_fd_id,
+                                                        &shm_fd_id,
+                                                        &fd_list,
+                                                        cancellable,
+                                                        &local_error);
+
+  /* Older daemon, let it send the data over the channel */
+  if (! res && g_error_matches (local_error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+    {
+      g_clear_error (&local_error);
+      direct_fd_id = -1;
+      shm_fd_id = -1;
+      res = gvfs_dbus_mount_call_open_for_read_sync (proxy,
+                                                     path,
+                                                     pid,
+                                                     NULL,
+                                                     &fd_id_val,
+                                                     &can_seek,
+                                                     &fd_list,
+                                                     cancellable,
+                                                     &local_error);
+    }
 
   if (! res)
     {
@@ -1215,9 +1328,8 @@ g_daemon_file_read (GFile *file,
   if (! res)
     return NULL;
 
-  if (fd_list == NULL || fd_id_val == NULL ||
-      g_unix_fd_list_get_length (fd_list) != 1 ||
-      (fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_id_val), NULL)) == -1)
+  if (fd_id_val == NULL ||
+      (fd = get_stream_fds (fd_list, g_variant_get_handle (fd_id_val), direct_fd_id, &direct_fd, shm_fd_id, &shm_fd)) == -1)
     {
       g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
 			   _("Didn't get stream file descriptor"));
@@ -1227,7 +1339,7 @@ g_daemon_file_read (GFile *file,
   g_variant_unref (fd_id_val);
   g_object_unref (fd_list);
   
-  return g_daemon_file_input_stream_new (fd, can_seek);
+  return g_daemon_file_input_stream_new (fd, direct_fd, shm_fd, can_seek);
 }
 
 static GFileOutputStream *
@@ -1244,8 +1356,9 @@ file_open_write (GFile *file,
   gboolean res;
   gboolean can_seek;
   GUnixFDList *fd_list;
-  int fd;
+  int fd, direct_fd;
   GVariant *fd_id_val = NULL;
+  gint direct_fd_id;
   guint32 pid;
   guint64 initial_offset;
   GError *local_error = NULL;
@@ -1259,20 +1372,42 @@ file_open_write (GFile *file,
   if (proxy == NULL)
     return NULL;
 
-  res = gvfs_dbus_mount_call_open_for_write_sync (proxy,
-                                                  path,
-                                                  mode,
-                                                  etag,
-                                                  make_backup,
-                                                  flags,
-                                                  pid,
-                                                  NULL,
-                                                  &fd_id_val,
-                                                  &can_seek,
-                                                  &initial_offset,
-                                                  &fd_list,
-                                                  cancellable,
-                                                  &local_error);
+  res = gvfs_dbus_mount_call_open_for_write_direct_sync (proxy,
+                                                         path,
+                                                         mode,
+                                                         etag,
+                                                         make_backup,
+                                                         flags,
+                                                         pid,
+                                                         NULL,
+                                                         &fd_id_val,
+                                                         &can_seek,
+                                                         &initial_offset,
+                                                         &direct_fd_id,
+                                                         &fd_list,
+                                                         cancellable,
+                                                         &local_error);
+
+  /* Older daemon, let it receive the data over the channel */
+  if (! res && g_error_matches (local_error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+    {
+      g_clear_error (&local_error);
+      direct_fd_id = -1;
+      res = gvfs_dbus_mount_call_open_for_write_sync (proxy,
+                                                      path,
+                                                      mode,
+                                                      etag,
+                                                      make_backup,
+                                                      flags,
+                                                      pid,
+                                                      NULL,
+                                                      &fd_id_val,
+                                                      &can_seek,
+                                                      &initial_offset,
+                                                      &fd_list,
+                                                      cancellable,
+                                                      &local_error);
+    }
 
   if (! res)
     {
@@ -1287,9 +1422,8 @@ file_open_write (GFile *file,
   if (! res)
     return NULL;
   
-  if (fd_list == NULL || fd_id_val == NULL ||
-      g_unix_fd_list_get_length (fd_list) != 1 ||
-      (fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_id_val), NULL)) == -1)
+  if (fd_id_val == NULL ||
+      (fd = get_stream_fds (fd_list, g_variant_get_handle (fd_id_val), direct_fd_id, &direct_fd, -1, NULL)) == -1)
     {
       g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                            _("Didn't get stream file descriptor"));
@@ -1299,7 +1433,7 @@ file_open_write (GFile *file,
   g_variant_unref (fd_id_val);
   g_object_unref (fd_list);
   
-  return g_daemon_file_output_stream_new (fd, can_seek, initial_offset);
+  return g_daemon_file_output_stream_new (fd, direct_fd, can_seek, initial_offset);
 }
 
 static GFileOutputStream *
@@ -3135,6 +3269,38 @@ g_daemon_file_monitor_file (GFile* file,
 }
 
 
+static void
+file_open_write_async_complete (AsyncCallFileReadWrite *data,
+                                GUnixFDList *fd_list,
+                                GVariant *fd_id_val,
+                                gboolean can_seek,
+                                guint64 initial_offset,
+                                gint direct_fd_id)
+{
+  GSimpleAsyncResult *orig_result;
+  GFileOutputStream *output_stream;
+  guint fd_id;
+  int fd, direct_fd;
+
+  orig_result = data->result;
+
+  fd_id = g_variant_get_handle (fd_id_val);
+  g_variant_unref (fd_id_val);
+
+  if ((fd = get_stream_fds (fd_list, fd_id, direct_fd_id, &direct_fd, -1, NULL)) == -1)
+    {
+      g_simple_async_result_set_error (orig_result,
+                                       G_IO_ERROR, G_IO_ERROR_FAILED,
+                                       _("Couldn't get stream file descriptor"));
+    }
+  else
+    {
+      output_stream = g_daemon_file_output_stream_new (fd, direct_fd, can_seek, initial_offset);
+      g_simple_async_result_set_op_res_gpointer (orig_result, output_stream, g_object_unref);
+      g_object_unref (fd_list);
+    }
+}
+
 static void
 file_open_write_async_cb (GVfsDBusMount *proxy,
                           GAsyncResult *res,
@@ -3145,11 +3311,8 @@ file_open_write_async_cb (GVfsDBusMount *proxy,
   GSimpleAsyncResult *orig_result;
   gboolean can_seek;
   GUnixFDList *fd_list;
-  int fd;
   GVariant *fd_id_val;
-  guint fd_id;
   guint64 initial_offset;
-  GFileOutputStream *output_stream;
 
   orig_result = data->result;
   
@@ -3159,23 +3322,57 @@ file_open_write_async_cb (GVfsDBusMount *proxy,
       goto out;
     }
 
-  fd_id = g_variant_get_handle (fd_id_val);
-  g_variant_unref (fd_id_val);
+  file_open_write_async_complete (data, fd_list, fd_id_val, can_seek, initial_offset, -1);
 
-  if (fd_list == NULL || g_unix_fd_list_get_length (fd_list) != 1 ||
-      (fd = g_unix_fd_list_get (fd_list, fd_id, NULL)) == -1)
-    {
-      g_simple_async_result_set_error (orig_result,
-                                       G_IO_ERROR, G_IO_ERROR_FAILED,
-                                       _("Couldn't get stream file descriptor"));
-    }
-  else
+out:
+  _g_simple_async_result_complete_with_cancellable (orig_result, data->cancellable);
+  _g_dbus_async_unsubscribe_cancellable (data->cancellable, data->cancelled_tag);
+  data->result = NULL;
+  g_object_unref (orig_result);   /* trigger async_proxy_create_free() */
+}
+
+static void
+file_open_write_direct_async_cb (GVfsDBusMount *proxy,
+                                 GAsyncResult *res,
+                                 gpointer user_data)
+{
+  AsyncCallFileReadWrite *data = user_data;
+  GError *error = NULL;
+  GSimpleAsyncResult *orig_result;
+  gboolean can_seek;
+  GUnixFDList *fd_list;
+  GVariant *fd_id_val;
+  guint64 initial_offset;
+  gint direct_fd_id;
+
+  orig_result = data->result;
+  
+  if (! gvfs_dbus_mount_call_open_for_write_direct_finish (proxy, &fd_id_val, &can_seek, &initial_offset, &direct_fd_id, &fd_list, res, &error))
     {
-      output_stream = g_daemon_file_output_stream_new (fd, can_seek, initial_offset);
-      g_simple_async_result_set_op_res_gpointer (orig_result, output_stream, g_object_unref);
-      g_object_unref (fd_list);
+      /* Older daemon, let it receive the data over the channel */
+      if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+        {
+          g_error_free (error);
+          gvfs_dbus_mount_call_open_for_write (proxy,
+                                               data->path,
+                                               data->mode,
+                                               data->etag,
+                                               data->make_backup,
+                                               data->flags,
+                                               data->pid,
+                                               NULL,
+                                               data->cancellable,
+                                               (GAsyncReadyCallback) file_open_write_async_cb,
+                                               data);
+          return;
+        }
+
+      _g_simple_async_result_take_error_stripped (orig_result, error);
+      goto out;
     }
 
+  file_open_write_async_complete (data, fd_list, fd_id_val, can_seek, initial_offset, direct_fd_id);
+
 out:
   _g_simple_async_result_complete_with_cancellable (orig_result, data->cancellable);
   _g_dbus_async_unsubscribe_cancellable (data->cancellable, data->cancelled_tag);
@@ -3194,23 +3391,23 @@ file_open_write_async_get_proxy_cb (GVfsDBusMount *proxy,
                                     gpointer callback_data)
 {
   AsyncCallFileReadWrite *data = callback_data;
-  guint32 pid;
 
-  pid = get_pid_for_file (data->file);
+  data->pid = get_pid_for_file (data->file);
+  data->path = g_strdup (path);
   
   data->result = g_object_ref (result);
   
-  gvfs_dbus_mount_call_open_for_write (proxy,
-                                       path,
-                                       data->mode,
-                                       data->etag,
-                                       data->make_backup,
-                                       data->flags,
-                                       pid,
-                                       NULL,
-                                       cancellable,
-                                       (GAsyncReadyCallback) file_open_write_async_cb,
-                                       data);
+  gvfs_dbus_mount_call_open_for_write_direct (proxy,
+                                              path,
+                                              data->mode,
+                                              data->etag,
+                                              data->make_backup,
+                                              data->flags,
+                                              data->pid,
+                                              NULL,
+                                              cancellable,
+                                              (GAsyncReadyCallback) file_open_write_direct_async_cb,
+                                              data);
   data->cancelled_tag = _g_dbus_async_subscribe_cancellable (connection, cancellable);
 }
 
@@ -3375,7 +3572,7 @@ enumerate_children_async_get_proxy_cb (GVfsDBusMount *proxy,
                                   path,
                                   obj_path,
                                   data->attributes ? data->attributes : "",
-                                  data->flags,
+                                  data->flags | G_VFS_DAEMON_ENUMERATE_FLAG_COMPACT_INFO,
                                   uri,
                                   cancellable,
                                   (GAsyncReadyCallback) enumerate_children_async_cb,
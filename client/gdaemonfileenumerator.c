@@ -36,6 +36,11 @@
 
 #define OBJ_PATH_PREFIX "/org/gtk/vfs/client/enumerator/"
 
+/* Number of infos we buffer before we stop acknowledging GotInfo
+   calls, which makes the daemon wait for us. Raised to the number of
+   files asked for by next_files_async(). */
+#define MAX_BUFFERED_INFOS 256
+
 /* atomic */
 static volatile gint path_counter = 1;
 
@@ -50,7 +55,14 @@ struct _GDaemonFileEnumerator
 
   /* protected by infos lock */
   GList *infos;
+  int n_infos;
   gboolean done;
+  GQueue held_invocations;
+  /* Once closed, infos are dropped and acknowledged right away */
+  gboolean closed;
+
+  /* Attribute names of GotInfoCompact, in index order */
+  GPtrArray *attributes;
 
   /* For async ops, also protected by infos lock */
   int async_requested_files;
@@ -113,6 +125,11 @@ g_daemon_file_enumerator_finalize (GObject *object)
   g_free (path);
 
   free_info_list (daemon->infos);
+  g_ptr_array_unref (daemon->attributes);
+
+  /* Let the daemon finish */
+  while (!g_queue_is_empty (&daemon->held_invocations))
+    g_dbus_method_invocation_return_value (g_queue_pop_head (&daemon->held_invocations), NULL);
 
   g_file_attribute_matcher_unref (daemon->matcher);
   if (daemon->metadata_tree)
@@ -158,6 +175,26 @@ next_files_sync_check (GDaemonFileEnumerator *enumerator)
   g_mutex_unlock (&enumerator->next_files_mutex);
 }
 
+/* Called with infos lock held */
+static gboolean
+buffer_full (GDaemonFileEnumerator *enumerator)
+{
+  if (enumerator->closed)
+    return FALSE;
+
+  return enumerator->n_infos >= MAX (MAX_BUFFERED_INFOS,
+                                     enumerator->async_requested_files);
+}
+
+/* Called with infos lock held, after infos were taken off the buffer */
+static void
+release_held_invocations (GDaemonFileEnumerator *enumerator)
+{
+  while (!g_queue_is_empty (&enumerator->held_invocations) &&
+         !buffer_full (enumerator))
+    g_dbus_method_invocation_return_value (g_queue_pop_head (&enumerator->held_invocations), NULL);
+}
+
 static gboolean
 handle_done (GVfsDBusEnumerator *object,
              GDBusMethodInvocation *invocation,
@@ -177,6 +214,34 @@ handle_done (GVfsDBusEnumerator *object,
   return TRUE;
 }
 
+static void
+add_infos (GDaemonFileEnumerator *enumerator,
+           GDBusMethodInvocation *invocation,
+           GList *infos,
+           int n_infos)
+{
+  G_LOCK (infos);
+  if (enumerator->closed)
+    {
+      free_info_list (infos);
+      infos = NULL;
+      n_infos = 0;
+    }
+  enumerator->infos = g_list_concat (enumerator->infos, infos);
+  enumerator->n_infos += n_infos;
+  if (enumerator->async_requested_files > 0 &&
+      enumerator->n_infos >= enumerator->async_requested_files)
+    trigger_async_done (enumerator, TRUE);
+  next_files_sync_check (enumerator);
+
+  /* Don't ack until there is room for more, the daemon waits for us */
+  if (buffer_full (enumerator))
+    g_queue_push_tail (&enumerator->held_invocations, invocation);
+  else
+    g_dbus_method_invocation_return_value (invocation, NULL);
+  G_UNLOCK (infos);
+}
+
 static gboolean
 handle_got_info (GVfsDBusEnumerator *object,
                  GDBusMethodInvocation *invocation,
@@ -188,8 +253,10 @@ handle_got_info (GVfsDBusEnumerator *object,
   GFileInfo *info;
   GVariantIter iter;
   GVariant *child;
+  int n_infos;
 
   infos = NULL;
+  n_infos = 0;
     
   g_variant_iter_init (&iter, arg_infos);
   while ((child = g_variant_iter_next_value (&iter)))
@@ -199,22 +266,53 @@ handle_got_info (GVfsDBusEnumerator *object,
         g_assert (G_IS_FILE_INFO (info));
 
       if (info)
-        infos = g_list_prepend (infos, info);
+        {
+          infos = g_list_prepend (infos, info);
+          n_infos++;
+        }
 
       g_variant_unref (child);
     }
   
-  infos = g_list_reverse (infos);
+  add_infos (enumerator, invocation, g_list_reverse (infos), n_infos);
   
-  G_LOCK (infos);
-  enumerator->infos = g_list_concat (enumerator->infos, infos);
-  if (enumerator->async_requested_files > 0 &&
-      g_list_length (enumerator->infos) >= enumerator->async_requested_files)
-    trigger_async_done (enumerator, TRUE);
-  next_files_sync_check (enumerator);
-  G_UNLOCK (infos);
+  return TRUE;
+}
 
-  gvfs_dbus_enumerator_complete_got_info (object, invocation);
+static gboolean
+handle_got_info_compact (GVfsDBusEnumerator *object,
+                         GDBusMethodInvocation *invocation,
+                         const gchar *const *arg_new_attributes,
+                         GVariant *arg_infos,
+                         gpointer user_data)
+{
+  GDaemonFileEnumerator *enumerator = G_DAEMON_FILE_ENUMERATOR (user_data);
+  GList *infos;
+  GFileInfo *info;
+  GVariantIter iter;
+  GVariant *child;
+  int i, n_infos;
+
+  for (i = 0; arg_new_attributes[i] != NULL; i++)
+    g_ptr_array_add (enumerator->attributes, g_strdup (arg_new_attributes[i]));
+
+  infos = NULL;
+  n_infos = 0;
+    
+  g_variant_iter_init (&iter, arg_infos);
+  while ((child = g_variant_iter_next_value (&iter)))
+    {
+      info = _g_dbus_get_file_info_compact (child, enumerator->attributes, NULL);
+      if (info)
+        {
+          infos = g_list_prepend (infos, info);
+          n_infos++;
+        }
+
+      g_variant_unref (child);
+    }
+  
+  add_infos (enumerator, invocation, g_list_reverse (infos), n_infos);
   
   return TRUE;
 }
@@ -234,6 +332,7 @@ register_vfs_filter_cb (GDBusConnection *connection,
   skeleton = gvfs_dbus_enumerator_skeleton_new ();
   g_signal_connect (skeleton, "handle-done", G_CALLBACK (handle_done), callback_data);
   g_signal_connect (skeleton, "handle-got-info", G_CALLBACK (handle_got_info), callback_data);
+  g_signal_connect (skeleton, "handle-got-info-compact", G_CALLBACK (handle_got_info_compact), callback_data);
 
   error = NULL;
   if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (skeleton),
@@ -256,6 +355,7 @@ static void
 g_daemon_file_enumerator_init (GDaemonFileEnumerator *daemon)
 {
   daemon->id = g_atomic_int_add (&path_counter, 1);
+  daemon->attributes = g_ptr_array_new_with_free_func (g_free);
 
   g_mutex_init (&daemon->next_files_mutex);
 }
@@ -407,6 +507,7 @@ trigger_async_done (GDaemonFileEnumerator *daemon, gboolean ok)
 	  rest->prev = NULL;
 	}
       daemon->infos = rest;
+      daemon->n_infos = MAX (daemon->n_infos - daemon->async_requested_files, 0);
 
       g_list_foreach (l, (GFunc)add_metadata, daemon);
 
@@ -424,6 +525,7 @@ trigger_async_done (GDaemonFileEnumerator *daemon, gboolean ok)
   daemon->timeout_tag = 0;
   
   daemon->async_requested_files = 0;
+  release_held_invocations (daemon);
   
   g_object_unref (daemon->async_res);
   daemon->async_res = NULL;
@@ -509,6 +611,8 @@ g_daemon_file_enumerator_next_file (GFileEnumerator *enumerator,
           add_metadata (G_FILE_INFO (info), daemon);
         }
       daemon->infos = g_list_delete_link (daemon->infos, daemon->infos);
+      daemon->n_infos--;
+      release_held_invocations (daemon);
     }
   G_UNLOCK (infos);
 
@@ -578,10 +682,13 @@ g_daemon_file_enumerator_next_files_async (GFileEnumerator     *enumerator,
 
   /* Maybe we already have enough info to fulfill the requeust already */
   if (daemon->done ||
-      g_list_length (daemon->infos) >= daemon->async_requested_files)
+      daemon->n_infos >= daemon->async_requested_files)
     trigger_async_done (daemon, TRUE);
   else
     {
+      /* Asking for more files than we buffer makes room */
+      release_held_invocations (daemon);
+
       daemon->timeout_tag = g_timeout_add (G_VFS_DBUS_TIMEOUT_MSECS,
 					   async_timeout, daemon);
       if (cancellable)
@@ -617,12 +724,25 @@ g_daemon_file_enumerator_next_files_finish (GFileEnumerator  *enumerator,
   return g_list_copy (l);
 }
 
+/* Stop holding the daemon back, nobody is going to read what it sends */
+static void
+mark_closed (GDaemonFileEnumerator *daemon)
+{
+  G_LOCK (infos);
+  daemon->closed = TRUE;
+  free_info_list (daemon->infos);
+  daemon->infos = NULL;
+  daemon->n_infos = 0;
+  release_held_invocations (daemon);
+  G_UNLOCK (infos);
+}
+
 static gboolean
 g_daemon_file_enumerator_close (GFileEnumerator *enumerator,
 				GCancellable     *cancellable,
 				GError          **error)
 {
-  /*GDaemonFileEnumerator *daemon = G_DAEMON_FILE_ENUMERATOR (enumerator); */
+  mark_closed (G_DAEMON_FILE_ENUMERATOR (enumerator));
 
   return TRUE;
 }
@@ -639,6 +759,8 @@ g_daemon_file_enumerator_close_async (GFileEnumerator      *enumerator,
 {
   GSimpleAsyncResult *res;
 
+  mark_closed (G_DAEMON_FILE_ENUMERATOR (enumerator));
+
   res = g_simple_async_result_new (G_OBJECT (enumerator), callback, user_data,
 				   g_daemon_file_enumerator_close_async);
   simple_async_result_set_cancellable (res, cancellable);
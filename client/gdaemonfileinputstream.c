@@ -52,6 +52,7 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -59,6 +60,7 @@
 #include <gio/gio.h>
 #include <gio/gunixinputstream.h>
 #include <gio/gunixoutputstream.h>
+#include <gio/gfiledescriptorbased.h>
 #include "gdaemonfileinputstream.h"
 #include "gvfsdaemondbus.h"
 #include <gvfsdaemonprotocol.h>
@@ -66,6 +68,9 @@
 
 #define MAX_READ_SIZE (4*1024*1024)
 
+#define SHM_MAP_SIZE (G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE + \
+		      G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_SIZE)
+
 typedef enum {
   INPUT_STATE_IN_REPLY_HEADER,
   INPUT_STATE_IN_BLOCK
@@ -205,6 +210,15 @@ struct _GDaemonFileInputStream {
   GOutputStream *command_stream;
   GInputStream *data_stream;
   guint can_seek : 1;
+
+  /* Set if the daemon handed us the file itself, the data is then
+     read directly from it and the channel is only used for the rest */
+  int direct_fd;
+  GInputStream *direct_stream;
+
+  /* Shared memory area for DATA_SHM replies, if any */
+  char *shm;
+  guint32 shm_pos;
   
   int seek_generation;
   guint32 seq_nr;
@@ -285,6 +299,41 @@ static GFileInfo *g_daemon_file_input_stream_query_info_finish (GFileInputStream
 G_DEFINE_TYPE (GDaemonFileInputStream, g_daemon_file_input_stream,
 	       G_TYPE_FILE_INPUT_STREAM)
 
+/* Streams on a local file the daemon handed over also give out its
+   descriptor, so callers can use it directly. They are a subtype, as
+   users of GFileDescriptorBased don't expect to get -1 */
+typedef GDaemonFileInputStream      GDaemonFileDirectInputStream;
+typedef GDaemonFileInputStreamClass GDaemonFileDirectInputStreamClass;
+
+static void g_daemon_file_direct_input_stream_fd_based_iface_init (GFileDescriptorBasedIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (GDaemonFileDirectInputStream, g_daemon_file_direct_input_stream,
+			 G_TYPE_DAEMON_FILE_INPUT_STREAM,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_FILE_DESCRIPTOR_BASED,
+						g_daemon_file_direct_input_stream_fd_based_iface_init))
+
+static int
+g_daemon_file_direct_input_stream_get_fd (GFileDescriptorBased *fd_based)
+{
+  return G_DAEMON_FILE_INPUT_STREAM (fd_based)->direct_fd;
+}
+
+static void
+g_daemon_file_direct_input_stream_fd_based_iface_init (GFileDescriptorBasedIface *iface)
+{
+  iface->get_fd = g_daemon_file_direct_input_stream_get_fd;
+}
+
+static void
+g_daemon_file_direct_input_stream_class_init (GDaemonFileDirectInputStreamClass *klass)
+{
+}
+
+static void
+g_daemon_file_direct_input_stream_init (GDaemonFileDirectInputStream *stream)
+{
+}
+
 static void
 pre_read_free (PreRead *pre)
 {
@@ -314,6 +363,10 @@ g_daemon_file_input_stream_finalize (GObject *object)
     g_object_unref (file->command_stream);
   if (file->data_stream)
     g_object_unref (file->data_stream);
+  if (file->direct_stream)
+    g_object_unref (file->direct_stream);
+  if (file->shm)
+    munmap (file->shm, SHM_MAP_SIZE);
 
   while (file->pre_reads)
     {
@@ -372,15 +425,40 @@ g_daemon_file_input_stream_init (GDaemonFileInputStream *info)
 
 GFileInputStream *
 g_daemon_file_input_stream_new (int fd,
+				int direct_fd,
+				int shm_fd,
 				gboolean can_seek)
 {
   GDaemonFileInputStream *stream;
+  GVfsDaemonSocketProtocolShmHeader *header;
+  char *shm;
 
-  stream = g_object_new (G_TYPE_DAEMON_FILE_INPUT_STREAM, NULL);
+  stream = g_object_new (direct_fd != -1 ?
+			 g_daemon_file_direct_input_stream_get_type () :
+			 G_TYPE_DAEMON_FILE_INPUT_STREAM,
+			 NULL);
 
   stream->command_stream = g_unix_output_stream_new (fd, FALSE);
   stream->data_stream = g_unix_input_stream_new (fd, TRUE);
   stream->can_seek = can_seek;
+
+  stream->direct_fd = direct_fd;
+  if (direct_fd != -1)
+    stream->direct_stream = g_unix_input_stream_new (direct_fd, TRUE);
+
+  if (shm_fd != -1)
+    {
+      shm = mmap (NULL, SHM_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+      close (shm_fd);
+
+      /* Unless we tell the daemon it keeps sending all the data inline */
+      if (shm != MAP_FAILED)
+	{
+	  stream->shm = shm;
+	  header = (GVfsDaemonSocketProtocolShmHeader *)shm;
+	  g_atomic_int_set (&header->client_mapped, 1);
+	}
+    }
   
   return G_FILE_INPUT_STREAM (stream);
 }
@@ -427,6 +505,54 @@ append_request (GDaemonFileInputStream *stream, guint32 command,
 		       (char *)&cmd, G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SIZE);
 }
 
+/* Takes the next block out of the shared memory ring. If it is from the
+ * current seek generation up to buffer_size bytes are copied to buffer,
+ * and the rest is kept as a pre-read. Returns the number of bytes copied
+ * to buffer.
+ */
+static gsize
+take_shm_block (GDaemonFileInputStream *file,
+		GVfsDaemonSocketProtocolReply *reply,
+		char *buffer,
+		gsize buffer_size)
+{
+  GVfsDaemonSocketProtocolShmHeader *header;
+  PreRead *pre;
+  guint32 start;
+  char *data;
+  gsize len;
+
+  g_assert (file->shm != NULL);
+
+  len = 0;
+  start = _g_vfs_daemon_shm_block_start (file->shm_pos, reply->arg1);
+  data = file->shm + G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE +
+    start % G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_SIZE;
+
+  if (reply->arg2 == file->seek_generation)
+    {
+      len = MIN (buffer_size, reply->arg1);
+      if (len > 0)
+	memcpy (buffer, data, len);
+
+      if (len < reply->arg1)
+	{
+	  pre = g_new (PreRead, 1);
+	  pre->data = g_memdup (data + len, reply->arg1 - len);
+	  pre->len = reply->arg1 - len;
+	  pre->seek_generation = reply->arg2;
+	  file->pre_reads = g_list_append (file->pre_reads, pre);
+	}
+    }
+
+  /* Let the daemon reuse the space */
+  file->shm_pos = start + reply->arg1;
+  header = (GVfsDaemonSocketProtocolShmHeader *)file->shm;
+  g_atomic_int_set (&header->consumed, (gint) file->shm_pos);
+
+  return len;
+}
+
 static gsize
 get_reply_header_missing_bytes (GString *buffer)
 {
@@ -775,6 +901,19 @@ iterate_read_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op
 		op->state = READ_STATE_HANDLE_INPUT_BLOCK;
 		break;
 	      }
+	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_DATA_SHM)
+	      {
+		g_string_truncate (file->input_buffer, 0);
+		if (reply.arg2 == file->seek_generation)
+		  {
+		    op->ret_val = take_shm_block (file, &reply, op->buffer, op->buffer_size);
+		    op->ret_error = NULL;
+		    return STATE_OP_DONE;
+		  }
+		take_shm_block (file, &reply, NULL, 0);
+		op->state = READ_STATE_HANDLE_HEADER;
+		break;
+	      }
 	    /* Ignore other reply types */
 	  }
 
@@ -832,6 +971,17 @@ g_daemon_file_input_stream_read (GInputStream *stream,
 
   file = G_DAEMON_FILE_INPUT_STREAM (stream);
 
+  if (file->direct_stream)
+    {
+      gssize res;
+
+      res = g_input_stream_read (file->direct_stream, buffer, count,
+				 cancellable, error);
+      if (res > 0)
+	file->current_offset += res;
+      return res;
+    }
+
   if (g_cancellable_set_error_if_cancelled (cancellable, error))
     return -1;
   
@@ -1035,6 +1185,14 @@ iterate_close_state_machine (GDaemonFileInputStream *file, IOOperationData *io_o
 		op->state = CLOSE_STATE_HANDLE_INPUT_BLOCK;
 		break;
 	      }
+	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_DATA_SHM)
+	      {
+		/* Kept for the next read if still wanted */
+		g_string_truncate (file->input_buffer, 0);
+		take_shm_block (file, &reply, NULL, 0);
+		op->state = CLOSE_STATE_HANDLE_HEADER;
+		break;
+	      }
 	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_CLOSED &&
 		     reply.seq_nr == op->seq_nr)
 	      {
@@ -1074,6 +1232,9 @@ g_daemon_file_input_stream_close (GInputStream *stream,
 
   file = G_DAEMON_FILE_INPUT_STREAM (stream);
 
+  if (file->direct_stream)
+    g_input_stream_close (file->direct_stream, cancellable, NULL);
+
   /* We need to do a full roundtrip to guarantee that the writes have
      reached the disk. */
 
@@ -1110,6 +1271,10 @@ g_daemon_file_input_stream_tell (GFileInputStream *stream)
   GDaemonFileInputStream *file;
 
   file = G_DAEMON_FILE_INPUT_STREAM (stream);
+
+  /* Whoever has the descriptor may have moved it */
+  if (file->direct_stream)
+    return lseek (file->direct_fd, 0, SEEK_CUR);
   
   return file->current_offset;
 }
@@ -1302,6 +1467,14 @@ iterate_seek_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op
 		op->state = SEEK_STATE_HANDLE_INPUT_BLOCK;
 		break;
 	      }
+	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_DATA_SHM)
+	      {
+		/* Kept for the next read if still wanted */
+		g_string_truncate (file->input_buffer, 0);
+		take_shm_block (file, &reply, NULL, 0);
+		op->state = SEEK_STATE_HANDLE_HEADER;
+		break;
+	      }
 	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SEEK_POS &&
 		     reply.seq_nr == op->seq_nr)
 	      {
@@ -1330,6 +1503,23 @@ iterate_seek_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op
     }
 }
 
+static int
+seek_type_to_lseek (GSeekType type)
+{
+  switch (type)
+    {
+    default:
+    case G_SEEK_CUR:
+      return SEEK_CUR;
+      
+    case G_SEEK_SET:
+      return SEEK_SET;
+      
+    case G_SEEK_END:
+      return SEEK_END;
+    }
+}
+
 static gboolean
 g_daemon_file_input_stream_seek (GFileInputStream *stream,
 				 goffset offset,
@@ -1351,7 +1541,33 @@ g_daemon_file_input_stream_seek (GFileInputStream *stream,
   
   if (g_cancellable_set_error_if_cancelled (cancellable, error))
     return FALSE;
-  
+
+  /* Seeking to where we already are would only throw away the
+     read-ahead data and restart the read size ramp in the daemon */
+  if (file->direct_stream == NULL &&
+      ((type == G_SEEK_CUR && offset == 0) ||
+       (type == G_SEEK_SET && offset == file->current_offset)))
+    return TRUE;
+
+  if (file->direct_stream)
+    {
+      off_t pos;
+
+      pos = lseek (file->direct_fd, offset, seek_type_to_lseek (type));
+      if (pos == (off_t)-1)
+	{
+	  int errsv = errno;
+
+	  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+		       _("Error seeking in file: %s"),
+		       g_strerror (errsv));
+	  return FALSE;
+	}
+
+      file->current_offset = pos;
+      return TRUE;
+    }
+
   memset (&op, 0, sizeof (op));
   op.state = SEEK_STATE_INIT;
   op.offset = offset;
@@ -1582,6 +1798,14 @@ iterate_query_state_machine (GDaemonFileInputStream *file,
 		op->state = QUERY_STATE_HANDLE_INPUT_BLOCK;
 		break;
 	      }
+	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_DATA_SHM)
+	      {
+		/* Kept for the next read if still wanted */
+		g_string_truncate (file->input_buffer, 0);
+		take_shm_block (file, &reply, NULL, 0);
+		op->state = QUERY_STATE_HANDLE_HEADER;
+		break;
+	      }
 	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_INFO &&
 		reply.seq_nr == op->seq_nr)
 	      {
@@ -1891,6 +2115,30 @@ async_read_done (GInputStream *stream,
   g_free (op);
 }
 
+static void
+direct_read_async_cb (GObject *source_object,
+		      GAsyncResult *res,
+		      gpointer user_data)
+{
+  GSimpleAsyncResult *simple = user_data;
+  GDaemonFileInputStream *file;
+  GError *error = NULL;
+  gssize count_read;
+
+  file = G_DAEMON_FILE_INPUT_STREAM (g_async_result_get_source_object (G_ASYNC_RESULT (simple)));
+
+  count_read = g_input_stream_read_finish (G_INPUT_STREAM (source_object), res, &error);
+  g_simple_async_result_set_op_res_gssize (simple, count_read);
+  if (count_read == -1)
+    g_simple_async_result_take_error (simple, error);
+  else
+    file->current_offset += count_read;
+
+  g_simple_async_result_complete (simple);
+  g_object_unref (simple);
+  g_object_unref (file);
+}
+
 static void
 g_daemon_file_input_stream_read_async  (GInputStream        *stream,
 					void               *buffer,
@@ -1904,6 +2152,19 @@ g_daemon_file_input_stream_read_async  (GInputStream        *stream,
   ReadOperation *op;
 
   file = G_DAEMON_FILE_INPUT_STREAM (stream);
+
+  if (file->direct_stream)
+    {
+      GSimpleAsyncResult *simple;
+
+      simple = g_simple_async_result_new (G_OBJECT (stream),
+					  callback, user_data,
+					  g_daemon_file_input_stream_read_async);
+      g_input_stream_read_async (file->direct_stream, buffer, count,
+				 io_priority, cancellable,
+				 direct_read_async_cb, simple);
+      return;
+    }
   
   /* Limit for sanity and to avoid 32bit overflow */
   if (count > MAX_READ_SIZE)
@@ -2027,6 +2288,9 @@ g_daemon_file_input_stream_close_async (GInputStream       *stream,
   CloseOperation *op;
 
   file = G_DAEMON_FILE_INPUT_STREAM (stream);
+
+  if (file->direct_stream)
+    g_input_stream_close (file->direct_stream, NULL, NULL);
   
   op = g_new0 (CloseOperation, 1);
   op->state = CLOSE_STATE_INIT;
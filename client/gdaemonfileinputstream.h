@@ -45,6 +45,8 @@ struct _GDaemonFileInputStreamClass
 GType g_daemon_file_input_stream_get_type (void) G_GNUC_CONST;
 
 GFileInputStream *g_daemon_file_input_stream_new (int fd,
+						  int direct_fd,
+						  int shm_fd,
 						  gboolean can_seek);
 
 G_END_DECLS
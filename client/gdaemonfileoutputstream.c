@@ -37,6 +37,7 @@
 #include <gio/gio.h>
 #include <gio/gunixinputstream.h>
 #include <gio/gunixoutputstream.h>
+#include <gio/gfiledescriptorbased.h>
 #include "gdaemonfileoutputstream.h"
 #include "gvfsdaemondbus.h"
 #include <gvfsdaemonprotocol.h>
@@ -158,6 +159,11 @@ struct _GDaemonFileOutputStream {
   GOutputStream *command_stream;
   GInputStream *data_stream;
   guint can_seek : 1;
+
+  /* Set if the daemon handed us the file itself, the data is then
+     written directly to it and the channel is only used for the rest */
+  int direct_fd;
+  GOutputStream *direct_stream;
   
   guint32 seq_nr;
   goffset current_offset;
@@ -224,6 +230,41 @@ static GFileInfo *g_daemon_file_output_stream_query_info_finish (GFileOutputStre
 G_DEFINE_TYPE (GDaemonFileOutputStream, g_daemon_file_output_stream,
 	       G_TYPE_FILE_OUTPUT_STREAM)
 
+/* Streams on a local file the daemon handed over also give out its
+   descriptor, so callers can use it directly. They are a subtype, as
+   users of GFileDescriptorBased don't expect to get -1 */
+typedef GDaemonFileOutputStream      GDaemonFileDirectOutputStream;
+typedef GDaemonFileOutputStreamClass GDaemonFileDirectOutputStreamClass;
+
+static void g_daemon_file_direct_output_stream_fd_based_iface_init (GFileDescriptorBasedIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (GDaemonFileDirectOutputStream, g_daemon_file_direct_output_stream,
+			 G_TYPE_DAEMON_FILE_OUTPUT_STREAM,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_FILE_DESCRIPTOR_BASED,
+						g_daemon_file_direct_output_stream_fd_based_iface_init))
+
+static int
+g_daemon_file_direct_output_stream_get_fd (GFileDescriptorBased *fd_based)
+{
+  return G_DAEMON_FILE_OUTPUT_STREAM (fd_based)->direct_fd;
+}
+
+static void
+g_daemon_file_direct_output_stream_fd_based_iface_init (GFileDescriptorBasedIface *iface)
+{
+  iface->get_fd = g_daemon_file_direct_output_stream_get_fd;
+}
+
+static void
+g_daemon_file_direct_output_stream_class_init (GDaemonFileDirectOutputStreamClass *klass)
+{
+}
+
+static void
+g_daemon_file_direct_output_stream_init (GDaemonFileDirectOutputStream *stream)
+{
+}
+
 static void
 g_string_remove_in_front (GString *string,
 			  gsize bytes)
@@ -246,6 +287,8 @@ g_daemon_file_output_stream_finalize (GObject *object)
     g_object_unref (file->command_stream);
   if (file->data_stream)
     g_object_unref (file->data_stream);
+  if (file->direct_stream)
+    g_object_unref (file->direct_stream);
 
   g_string_free (file->input_buffer, TRUE);
   g_string_free (file->output_buffer, TRUE);
@@ -292,17 +335,25 @@ g_daemon_file_output_stream_init (GDaemonFileOutputStream *info)
 
 GFileOutputStream *
 g_daemon_file_output_stream_new (int fd,
+				 int direct_fd,
 				 gboolean can_seek,
 				 goffset initial_offset)
 {
   GDaemonFileOutputStream *stream;
 
-  stream = g_object_new (G_TYPE_DAEMON_FILE_OUTPUT_STREAM, NULL);
+  stream = g_object_new (direct_fd != -1 ?
+			 g_daemon_file_direct_output_stream_get_type () :
+			 G_TYPE_DAEMON_FILE_OUTPUT_STREAM,
+			 NULL);
 
   stream->command_stream = g_unix_output_stream_new (fd, FALSE);
   stream->data_stream = g_unix_input_stream_new (fd, TRUE);
   stream->can_seek = can_seek;
   stream->current_offset = initial_offset;
+
+  stream->direct_fd = direct_fd;
+  if (direct_fd != -1)
+    stream->direct_stream = g_unix_output_stream_new (direct_fd, TRUE);
   
   return G_FILE_OUTPUT_STREAM (stream);
 }
@@ -639,6 +690,17 @@ g_daemon_file_output_stream_write (GOutputStream *stream,
 
   file = G_DAEMON_FILE_OUTPUT_STREAM (stream);
 
+  if (file->direct_stream)
+    {
+      gssize res;
+
+      res = g_output_stream_write (file->direct_stream, buffer, count,
+				   cancellable, error);
+      if (res > 0)
+	file->current_offset += res;
+      return res;
+    }
+
   if (g_cancellable_set_error_if_cancelled (cancellable, error))
     return -1;
   
@@ -799,6 +861,15 @@ g_daemon_file_output_stream_close (GOutputStream *stream,
 
   file = G_DAEMON_FILE_OUTPUT_STREAM (stream);
 
+  /* The file must be complete before the daemon closes its handle */
+  if (file->direct_stream &&
+      !g_output_stream_close (file->direct_stream, cancellable, error))
+    {
+      g_output_stream_close (file->command_stream, cancellable, NULL);
+      g_input_stream_close (file->data_stream, cancellable, NULL);
+      return FALSE;
+    }
+
   /* We need to do a full roundtrip to guarantee that the writes have
      reached the disk. */
 
@@ -835,6 +906,10 @@ g_daemon_file_output_stream_tell (GFileOutputStream *stream)
   GDaemonFileOutputStream *file;
 
   file = G_DAEMON_FILE_OUTPUT_STREAM (stream);
+
+  /* Whoever has the descriptor may have moved it */
+  if (file->direct_stream)
+    return lseek (file->direct_fd, 0, SEEK_CUR);
   
   return file->current_offset;
 }
@@ -981,6 +1056,23 @@ iterate_seek_state_machine (GDaemonFileOutputStream *file, IOOperationData *io_o
     }
 }
 
+static int
+seek_type_to_lseek (GSeekType type)
+{
+  switch (type)
+    {
+    default:
+    case G_SEEK_CUR:
+      return SEEK_CUR;
+      
+    case G_SEEK_SET:
+      return SEEK_SET;
+      
+    case G_SEEK_END:
+      return SEEK_END;
+    }
+}
+
 static gboolean
 g_daemon_file_output_stream_seek (GFileOutputStream *stream,
 				 goffset offset,
@@ -1002,6 +1094,25 @@ g_daemon_file_output_stream_seek (GFileOutputStream *stream,
   
   if (g_cancellable_set_error_if_cancelled (cancellable, error))
     return FALSE;
+
+  if (file->direct_stream)
+    {
+      off_t pos;
+
+      pos = lseek (file->direct_fd, offset, seek_type_to_lseek (type));
+      if (pos == (off_t)-1)
+	{
+	  int errsv = errno;
+
+	  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+		       _("Error seeking in file: %s"),
+		       g_strerror (errsv));
+	  return FALSE;
+	}
+
+      file->current_offset = pos;
+      return TRUE;
+    }
   
   memset (&op, 0, sizeof (op));
   op.state = SEEK_STATE_INIT;
@@ -1443,6 +1554,30 @@ async_write_done (GOutputStream *stream,
   g_free (op);
 }
 
+static void
+direct_write_async_cb (GObject *source_object,
+		       GAsyncResult *res,
+		       gpointer user_data)
+{
+  GSimpleAsyncResult *simple = user_data;
+  GDaemonFileOutputStream *file;
+  GError *error = NULL;
+  gssize count_written;
+
+  file = G_DAEMON_FILE_OUTPUT_STREAM (g_async_result_get_source_object (G_ASYNC_RESULT (simple)));
+
+  count_written = g_output_stream_write_finish (G_OUTPUT_STREAM (source_object), res, &error);
+  g_simple_async_result_set_op_res_gssize (simple, count_written);
+  if (count_written == -1)
+    g_simple_async_result_take_error (simple, error);
+  else
+    file->current_offset += count_written;
+
+  g_simple_async_result_complete (simple);
+  g_object_unref (simple);
+  g_object_unref (file);
+}
+
 static void
 g_daemon_file_output_stream_write_async  (GOutputStream      *stream,
 					  const void         *buffer,
@@ -1456,6 +1591,19 @@ g_daemon_file_output_stream_write_async  (GOutputStream      *stream,
   WriteOperation *op;
 
   file = G_DAEMON_FILE_OUTPUT_STREAM (stream);
+
+  if (file->direct_stream)
+    {
+      GSimpleAsyncResult *simple;
+
+      simple = g_simple_async_result_new (G_OBJECT (stream),
+					  callback, data,
+					  g_daemon_file_output_stream_write_async);
+      g_output_stream_write_async (file->direct_stream, buffer, count,
+				   io_priority, cancellable,
+				   direct_write_async_cb, simple);
+      return;
+    }
   
   /* Limit for sanity and to avoid 32bit overflow */
   if (count > MAX_WRITE_SIZE)
@@ -1556,6 +1704,10 @@ g_daemon_file_output_stream_close_async (GOutputStream     *stream,
   CloseOperation *op;
 
   file = G_DAEMON_FILE_OUTPUT_STREAM (stream);
+
+  /* Writes to the file are not buffered, so closing it can't block */
+  if (file->direct_stream)
+    g_output_stream_close (file->direct_stream, NULL, NULL);
   
   op = g_new0 (CloseOperation, 1);
   op->state = CLOSE_STATE_INIT;
@@ -36,7 +36,9 @@
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <glib/gprintf.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
+#include <gio/gfiledescriptorbased.h>
 
 /* stuff from common/ */
 #include <gvfsdaemonprotocol.h>
@@ -47,6 +49,33 @@
 
 #define DEBUG_ENABLED 0
 
+/* Cached stats are trusted for this long, both by us and by the kernel */
+#define ATTR_CACHE_TIMEOUT      2
+#define ATTR_CACHE_MAX_ENTRIES  16384
+#define MAX_DIR_MONITORS        64
+
+#define STAT_ATTRIBUTES                         \
+  G_FILE_ATTRIBUTE_STANDARD_TYPE ","            \
+  G_FILE_ATTRIBUTE_STANDARD_NAME ","            \
+  G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK ","      \
+  G_FILE_ATTRIBUTE_STANDARD_SIZE ","            \
+  G_FILE_ATTRIBUTE_UNIX_MODE ","                \
+  G_FILE_ATTRIBUTE_TIME_CHANGED ","             \
+  G_FILE_ATTRIBUTE_TIME_MODIFIED ","            \
+  G_FILE_ATTRIBUTE_TIME_ACCESS ","              \
+  G_FILE_ATTRIBUTE_UNIX_BLOCK_SIZE ","          \
+  G_FILE_ATTRIBUTE_UNIX_BLOCKS ","              \
+  "access::*"
+
+/* Block size for moving data between the remote file and the staging file */
+#define STAGING_COPY_SIZE       (256 * 1024)
+
+/* Sequential writes are collected up to this size before they are sent */
+#define WRITE_BUFFER_SIZE       (1024 * 1024)
+
+/* Open files are spread over this many independently locked maps */
+#define N_HANDLE_SHARDS         16
+
 #define GET_FILE_HANDLE(fi)     ((gpointer) (fi)->fh)
 #define SET_FILE_HANDLE(fi, fh) ((fi)->fh = (guint64) (fh))
 
@@ -70,8 +99,47 @@ typedef struct {
   FileOp    op;
   gpointer  stream;
   goffset   pos;
+
+  /* Sequential writes not sent yet, they end at pos */
+  GByteArray *write_buffer;
+
+  /* Once a write or truncate needs more than the remote stream can do,
+   * the file is staged in an unlinked local file and all I/O goes there
+   * until it is uploaded in one go on flush. -1 when not staged. */
+  gint      staging_fd;
+  gboolean  staging_dirty;
+
+  /* Taken with mutex when changing the staging state or write_end, so
+   * that getattr can read them without waiting for the I/O done under
+   * mutex */
+  GMutex    state_mutex;
+  /* pos after the last write, and whether some of it is still buffered */
+  goffset   write_end;
+  gboolean  writes_buffered;
+
+  /* Index of the shard whose path maps hold us. Only changes with that
+   * shard locked. */
+  guint     shard;
+  /* Read-only handle of a single open() rather than the shared one of
+   * its path */
+  gboolean  is_private;
 } FileHandle;
 
+/* Lock order is path_mutex before active_mutex, and lower shards first */
+typedef struct {
+  GMutex      path_mutex;
+  GHashTable *path_to_fh;  /* Path -> shared FileHandle */
+  GHashTable *path_to_private;  /* Path -> GList of private FileHandles */
+  GMutex      active_mutex;
+  GHashTable *active_fh;   /* FileHandle -> FileHandle, every live handle */
+} HandleShard;
+
+typedef struct {
+  struct stat  sbuf;
+  gint64       expires;
+  GList       *link;  /* In attr_cache_order, data is the key */
+} AttrCacheEntry;
+
 static GThread        *subthread             = NULL;
 static GMainLoop      *subthread_main_loop   = NULL;
 static GVfs           *gvfs                  = NULL;
@@ -86,13 +154,21 @@ static time_t          daemon_creation_time;
 static uid_t           daemon_uid;
 static gid_t           daemon_gid;
 
-static GMutex          global_mutex          = {NULL};
-static GHashTable     *global_path_to_fh_map = NULL;
-static GHashTable     *global_active_fh_map  = NULL;
+static HandleShard     handle_shards [N_HANDLE_SHARDS];
 
 static GDBusConnection *dbus_conn            = NULL;
 static guint            daemon_name_watcher;
 
+/* Path -> AttrCacheEntry, oldest first in attr_cache_order */
+static GMutex          attr_cache_mutex      = {NULL};
+static GHashTable     *attr_cache            = NULL;
+static GQueue          attr_cache_order      = G_QUEUE_INIT;
+
+/* Directory path -> GFileMonitor (or NULL if unsupported), oldest first in dir_monitor_order */
+static GMutex          dir_monitor_mutex     = {NULL};
+static GHashTable     *dir_monitors          = NULL;
+static GQueue          dir_monitor_order     = G_QUEUE_INIT;
+
 /* ------- *
  * Helpers *
  * ------- */
@@ -204,18 +280,37 @@ set_pid_for_file (GFile *file)
   ;
 }
 
+static guint
+path_shard (const gchar *path)
+{
+  return g_str_hash (path) % N_HANDLE_SHARDS;
+}
+
+static HandleShard *
+active_shard (FileHandle *file_handle)
+{
+  /* Allocations are at least 8 byte aligned, skip the zero bits */
+  return &handle_shards [(GPOINTER_TO_SIZE (file_handle) >> 3) % N_HANDLE_SHARDS];
+}
+
 static FileHandle *
 file_handle_new (const gchar *path)
 {
-  FileHandle *file_handle;
+  FileHandle  *file_handle;
+  HandleShard *shard;
 
   file_handle = g_new0 (FileHandle, 1);
   file_handle->refcount = 1;
   g_mutex_init (&file_handle->mutex);
+  g_mutex_init (&file_handle->state_mutex);
   file_handle->op = FILE_OP_NONE;
   file_handle->path = g_strdup (path);
+  file_handle->staging_fd = -1;
 
-  g_hash_table_insert (global_active_fh_map, file_handle, file_handle);
+  shard = active_shard (file_handle);
+  g_mutex_lock (&shard->active_mutex);
+  g_hash_table_insert (shard->active_fh, file_handle, file_handle);
+  g_mutex_unlock (&shard->active_mutex);
 
   return file_handle;
 }
@@ -227,32 +322,375 @@ file_handle_ref (FileHandle *file_handle)
   return file_handle;
 }
 
+static void file_handle_destroy (FileHandle *file_handle);
+static void file_handle_free    (FileHandle *file_handle);
+
+/* Needs the shard's path_mutex */
+static void
+private_file_handle_remove (HandleShard *shard, FileHandle *file_handle)
+{
+  GList *list;
+
+  list = g_hash_table_lookup (shard->path_to_private, file_handle->path);
+  list = g_list_remove (list, file_handle);
+
+  if (list)
+    g_hash_table_insert (shard->path_to_private, g_strdup (file_handle->path), list);
+  else
+    g_hash_table_remove (shard->path_to_private, file_handle->path);
+}
+
 static void
 file_handle_unref (FileHandle *file_handle)
 {
   if (g_atomic_int_dec_and_test (&file_handle->refcount))
     {
-      gint refs;
+      HandleShard *shard;
+      HandleShard *active;
+      guint        shard_index;
+      gboolean     removed = FALSE;
+      gint         refs;
+
+      /* Test again after locking, since e.g. get_file_handle_for_path()
+       * might have snatched the lock and revived the file handle between
+       * g_atomic_int_dec_and_test() and us obtaining it. */
+
+      shard_index = g_atomic_int_get (&file_handle->shard);
+
+      for (;;)
+        {
+          shard = &handle_shards [shard_index];
+          g_mutex_lock (&shard->path_mutex);
+
+          /* A rename may have moved us to another shard meanwhile */
+          if (file_handle->shard == shard_index)
+            break;
+
+          shard_index = file_handle->shard;
+          g_mutex_unlock (&shard->path_mutex);
+        }
+
+      if (file_handle->is_private)
+        {
+          /* Private handles can also be revived through the active map */
+          active = active_shard (file_handle);
+          g_mutex_lock (&active->active_mutex);
+
+          refs = g_atomic_int_get (&file_handle->refcount);
+          if (refs == 0)
+            {
+              g_hash_table_remove (active->active_fh, file_handle);
+              private_file_handle_remove (shard, file_handle);
+              removed = TRUE;
+            }
+
+          g_mutex_unlock (&active->active_mutex);
+        }
+      else
+        {
+          refs = g_atomic_int_get (&file_handle->refcount);
+
+          if (refs == 0)
+            removed = g_hash_table_steal (shard->path_to_fh, file_handle->path);
+        }
+
+      g_mutex_unlock (&shard->path_mutex);
+
+      /* Not with the shard locked, closing may upload a staged file */
+      if (removed && file_handle->is_private)
+        file_handle_destroy (file_handle);
+      else if (removed)
+        file_handle_free (file_handle);
+    }
+}
+
+/* Publishes where the written data ends for getattr. Needs the handle's
+ * mutex. */
+static void
+file_handle_set_write_end (FileHandle *file_handle, gboolean writes_buffered)
+{
+  g_mutex_lock (&file_handle->state_mutex);
+  file_handle->write_end = file_handle->pos;
+  file_handle->writes_buffered = writes_buffered;
+  g_mutex_unlock (&file_handle->state_mutex);
+}
+
+/* Sends the buffered writes, if any. Needs the handle's mutex. */
+static gint
+file_handle_flush_writes (FileHandle *file_handle)
+{
+  GByteArray *buffer = file_handle->write_buffer;
+  GError     *error  = NULL;
+  gsize       bytes_written = 0;
+  gint        result = 0;
+
+  if (buffer == NULL || buffer->len == 0)
+    return 0;
+
+  g_assert (file_handle->op == FILE_OP_WRITE);
+
+  if (!g_output_stream_write_all (file_handle->stream, buffer->data, buffer->len,
+                                  &bytes_written, NULL, &error))
+    {
+      /* What didn't make it was never written */
+      file_handle->pos -= buffer->len - bytes_written;
+      result = -errno_from_error (error);
+      g_error_free (error);
+    }
+  else if (!g_output_stream_flush (file_handle->stream, NULL, &error))
+    {
+      result = -errno_from_error (error);
+      g_error_free (error);
+    }
+
+  g_byte_array_set_size (buffer, 0);
+  file_handle_set_write_end (file_handle, FALSE);
+
+  return result;
+}
+
+static GFile *file_from_full_path (const gchar *path);
+static void   file_handle_close_stream (FileHandle *file_handle);
+
+/* Copies the remote file into a new staging file. Needs the handle's mutex. */
+static gint
+file_handle_start_staging (FileHandle *file_handle)
+{
+  GFile            *file;
+  GFileInputStream *input_stream;
+  GError           *error = NULL;
+  gchar            *tmp_name;
+  gchar            *buf;
+  gssize            n_read;
+  gint              fd;
+  gint              result;
+
+  if (file_handle->staging_fd != -1)
+    return 0;
+
+  /* Commit what we already wrote, so the copy below includes it */
+  result = file_handle_flush_writes (file_handle);
+  file_handle_close_stream (file_handle);
+  if (result < 0)
+    return result;
+
+  file = file_from_full_path (file_handle->path);
+  if (file == NULL)
+    return -ENOENT;
+
+  fd = g_file_open_tmp ("gvfsd-fuse-XXXXXX", &tmp_name, &error);
+  if (fd == -1)
+    {
+      result = -errno_from_error (error);
+      g_error_free (error);
+      g_object_unref (file);
+      return result;
+    }
+  g_unlink (tmp_name);
+  g_free (tmp_name);
+
+  input_stream = g_file_read (file, NULL, &error);
+  if (input_stream == NULL)
+    {
+      /* A new file the backend didn't create yet simply starts empty */
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        g_clear_error (&error);
+      else
+        {
+          result = -errno_from_error (error);
+          g_error_free (error);
+        }
+    }
+  else
+    {
+      buf = g_malloc (STAGING_COPY_SIZE);
+
+      while ((n_read = g_input_stream_read (G_INPUT_STREAM (input_stream), buf,
+                                            STAGING_COPY_SIZE, NULL, &error)) > 0)
+        {
+          if (write (fd, buf, n_read) != n_read)
+            {
+              result = -EIO;
+              break;
+            }
+        }
+      if (n_read < 0)
+        {
+          result = -errno_from_error (error);
+          g_error_free (error);
+        }
+
+      g_free (buf);
+      g_input_stream_close (G_INPUT_STREAM (input_stream), NULL, NULL);
+      g_object_unref (input_stream);
+    }
+
+  g_object_unref (file);
+
+  if (result < 0)
+    {
+      close (fd);
+      return result;
+    }
+
+  g_mutex_lock (&file_handle->state_mutex);
+  file_handle->staging_fd = fd;
+  file_handle->staging_dirty = FALSE;
+  g_mutex_unlock (&file_handle->state_mutex);
+
+  return 0;
+}
+
+/* Creates a new hidden file next to file for the upload of the staged
+ * content, so the original stays intact until it has fully arrived */
+static GFileOutputStream *
+create_upload_file (GFile *file, GFile **upload_file, GError **error)
+{
+  GFileOutputStream *output_stream;
+  GFile             *parent;
+  gchar             *basename;
+  gchar             *name;
+  gint               i;
+
+  parent = g_file_get_parent (file);
+  if (parent == NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Can't upload the root");
+      return NULL;
+    }
+
+  basename = g_file_get_basename (file);
+  output_stream = NULL;
+
+  for (i = 0; i < 16 && output_stream == NULL; i++)
+    {
+      g_clear_error (error);
+
+      name = g_strdup_printf (".%s.gvfsd-fuse-%08x", basename, g_random_int ());
+      *upload_file = g_file_get_child (parent, name);
+      g_free (name);
+
+      output_stream = g_file_create (*upload_file, G_FILE_CREATE_NONE, NULL, error);
+      if (output_stream == NULL)
+        {
+          g_object_unref (*upload_file);
+          *upload_file = NULL;
+
+          if (!g_error_matches (*error, G_IO_ERROR, G_IO_ERROR_EXISTS))
+            break;
+        }
+    }
+
+  g_free (basename);
+  g_object_unref (parent);
+
+  return output_stream;
+}
+
+/* Replaces the remote file with the staged content, if it changed.
+ * Needs the handle's mutex. */
+static gint
+file_handle_upload_staging (FileHandle *file_handle)
+{
+  GFile             *file;
+  GFile             *upload_file = NULL;
+  GFileOutputStream *output_stream;
+  GError            *error = NULL;
+  gchar             *buf;
+  gssize             n_read;
+  goffset            offset = 0;
+  gint               result = 0;
+
+  if (file_handle->staging_fd == -1 || !file_handle->staging_dirty)
+    return 0;
+
+  file = file_from_full_path (file_handle->path);
+  if (file == NULL)
+    return -ENOENT;
+
+  output_stream = create_upload_file (file, &upload_file, &error);
+  if (output_stream == NULL)
+    {
+      result = -errno_from_error (error);
+      g_error_free (error);
+      g_object_unref (file);
+      return result;
+    }
+
+  buf = g_malloc (STAGING_COPY_SIZE);
+
+  while ((n_read = pread (file_handle->staging_fd, buf, STAGING_COPY_SIZE, offset)) != 0)
+    {
+      if (n_read < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          result = -errno;
+          break;
+        }
+
+      if (!g_output_stream_write_all (G_OUTPUT_STREAM (output_stream), buf, n_read,
+                                      NULL, NULL, &error))
+        {
+          result = -errno_from_error (error);
+          g_error_free (error);
+          break;
+        }
 
-      g_mutex_lock (&global_mutex);
+      offset += n_read;
+    }
 
-      /* Test again, since e.g. get_file_handle_for_path() might have
-       * snatched the global mutex and revived the file handle between
-       * g_atomic_int_dec_and_test() and us obtaining the global lock. */
+  g_free (buf);
 
-      refs = g_atomic_int_get (&file_handle->refcount);
+  /* Even a failed upload is closed normally, the daemon would do it
+   * anyway once the stream is gone */
+  if (!g_output_stream_close (G_OUTPUT_STREAM (output_stream), NULL, &error) &&
+      result == 0)
+    {
+      result = -errno_from_error (error);
+    }
+  g_clear_error (&error);
+  g_object_unref (output_stream);
 
-      if (refs == 0)
-        g_hash_table_remove (global_path_to_fh_map, file_handle->path);
+  /* Carry the mode, owner, times and extended attributes of the original
+   * over where the backend can set them. What it can't set is lost, as are
+   * hard links to the original, and CMIS makes the moved file a new
+   * document without the version history of the old one. */
+  if (result == 0)
+    g_file_copy_attributes (file, upload_file, G_FILE_COPY_ALL_METADATA, NULL, NULL);
 
-      g_mutex_unlock (&global_mutex);
+  /* Only a complete upload takes the place of the original */
+  if (result == 0 &&
+      !g_file_move (upload_file, file, G_FILE_COPY_OVERWRITE,
+                    NULL, NULL, NULL, &error))
+    {
+      result = -errno_from_error (error);
+      g_clear_error (&error);
     }
+
+  if (result == 0)
+    {
+      g_mutex_lock (&file_handle->state_mutex);
+      file_handle->staging_dirty = FALSE;
+      g_mutex_unlock (&file_handle->state_mutex);
+    }
+  else
+    g_file_delete (upload_file, NULL, NULL);
+
+  g_object_unref (upload_file);
+  g_object_unref (file);
+
+  return result;
 }
 
 static void
 file_handle_close_stream (FileHandle *file_handle)
 {
   debug_print ("file_handle_close_stream\n");
+
+  file_handle_upload_staging (file_handle);
+
   if (file_handle->stream)
     {
       switch (file_handle->op)
@@ -262,6 +700,7 @@ file_handle_close_stream (FileHandle *file_handle)
           break;
           
         case FILE_OP_WRITE:
+          file_handle_flush_writes (file_handle);
           g_output_stream_close (file_handle->stream, NULL, NULL);
           break;
           
@@ -275,42 +714,64 @@ file_handle_close_stream (FileHandle *file_handle)
     }
 }
 
-/* Called on hash table removal */
 static void
-file_handle_free (FileHandle *file_handle)
+file_handle_destroy (FileHandle *file_handle)
 {
-  g_hash_table_remove (global_active_fh_map, file_handle);
-
   file_handle_close_stream (file_handle);
+  if (file_handle->write_buffer)
+    g_byte_array_unref (file_handle->write_buffer);
+  if (file_handle->staging_fd != -1)
+    close (file_handle->staging_fd);
   g_mutex_clear (&file_handle->mutex);
+  g_mutex_clear (&file_handle->state_mutex);
   g_free (file_handle->path);
   g_free (file_handle);
 }
 
+/* Called once a shared handle is out of its path map */
+static void
+file_handle_free (FileHandle *file_handle)
+{
+  HandleShard *shard;
+
+  shard = active_shard (file_handle);
+  g_mutex_lock (&shard->active_mutex);
+  g_hash_table_remove (shard->active_fh, file_handle);
+  g_mutex_unlock (&shard->active_mutex);
+
+  file_handle_destroy (file_handle);
+}
+
 static FileHandle *
 get_file_handle_for_path (const gchar *path)
 {
-  FileHandle *fh;
+  HandleShard *shard;
+  FileHandle  *fh;
 
-  g_mutex_lock (&global_mutex);
+  shard = &handle_shards [path_shard (path)];
+  g_mutex_lock (&shard->path_mutex);
 
-  fh = g_hash_table_lookup (global_path_to_fh_map, path);
+  fh = g_hash_table_lookup (shard->path_to_fh, path);
 
   if (fh)
     file_handle_ref (fh);
 
-  g_mutex_unlock (&global_mutex);
+  g_mutex_unlock (&shard->path_mutex);
   return fh;
 }
 
 static FileHandle *
 get_or_create_file_handle_for_path (const gchar *path)
 {
-  FileHandle *fh;
+  HandleShard *shard;
+  FileHandle  *fh;
+  guint        shard_index;
 
-  g_mutex_lock (&global_mutex);
+  shard_index = path_shard (path);
+  shard = &handle_shards [shard_index];
+  g_mutex_lock (&shard->path_mutex);
 
-  fh = g_hash_table_lookup (global_path_to_fh_map, path);
+  fh = g_hash_table_lookup (shard->path_to_fh, path);
 
   if (fh)
     {
@@ -319,55 +780,148 @@ get_or_create_file_handle_for_path (const gchar *path)
   else
     {
       fh = file_handle_new (path);
-      g_hash_table_insert (global_path_to_fh_map, fh->path, fh);
+      fh->shard = shard_index;
+      g_hash_table_insert (shard->path_to_fh, fh->path, fh);
     }
 
-  g_mutex_unlock (&global_mutex);
+  g_mutex_unlock (&shard->path_mutex);
   return fh;
 }
 
 static FileHandle *
-get_file_handle_from_info (struct fuse_file_info *fi)
+create_private_file_handle_for_path (const gchar *path)
 {
-  FileHandle *fh;
+  HandleShard *shard;
+  FileHandle  *fh;
+  GList       *list;
+  guint        shard_index;
+
+  shard_index = path_shard (path);
+  shard = &handle_shards [shard_index];
+  g_mutex_lock (&shard->path_mutex);
+
+  fh = file_handle_new (path);
+  fh->shard = shard_index;
+  fh->is_private = TRUE;
+
+  list = g_hash_table_lookup (shard->path_to_private, path);
+  g_hash_table_insert (shard->path_to_private, g_strdup (path),
+                       g_list_prepend (list, fh));
+
+  g_mutex_unlock (&shard->path_mutex);
+  return fh;
+}
+
+/* Closes the streams of the private handles of path, so that the backend
+ * can delete or replace the file. They reopen it on their next read. */
+static void
+close_private_file_handles_for_path (const gchar *path)
+{
+  HandleShard *shard;
+  GList       *handles;
+  GList       *l;
+
+  shard = &handle_shards [path_shard (path)];
+  g_mutex_lock (&shard->path_mutex);
 
-  g_mutex_lock (&global_mutex);
+  handles = g_list_copy (g_hash_table_lookup (shard->path_to_private, path));
+  for (l = handles; l != NULL; l = l->next)
+    file_handle_ref (l->data);
+
+  g_mutex_unlock (&shard->path_mutex);
+
+  for (l = handles; l != NULL; l = l->next)
+    {
+      FileHandle *fh = l->data;
+
+      g_mutex_lock (&fh->mutex);
+      file_handle_close_stream (fh);
+      g_mutex_unlock (&fh->mutex);
+
+      file_handle_unref (fh);
+    }
+
+  g_list_free (handles);
+}
+
+static FileHandle *
+get_file_handle_from_info (struct fuse_file_info *fi)
+{
+  HandleShard *shard;
+  FileHandle  *fh;
 
   fh = GET_FILE_HANDLE (fi);
+  shard = active_shard (fh);
+
+  g_mutex_lock (&shard->active_mutex);
 
   /* If the file handle is still valid, its value won't change. If
    * invalid, it's set to NULL. */
-  fh = g_hash_table_lookup (global_active_fh_map, fh);
+  fh = g_hash_table_lookup (shard->active_fh, fh);
 
   if (fh)
     file_handle_ref (fh);
 
-  g_mutex_unlock (&global_mutex);
+  g_mutex_unlock (&shard->active_mutex);
   return fh;
 }
 
 static void
 reindex_file_handle_for_path (const gchar *old_path, const gchar *new_path)
 {
-  gchar      *old_path_internal;
-  FileHandle *fh;
+  HandleShard *old_shard, *new_shard;
+  guint        old_index, new_index;
+  gchar       *old_path_internal;
+  FileHandle  *fh;
+  GList       *handles;
+  GList       *l;
 
-  g_mutex_lock (&global_mutex);
+  old_index = path_shard (old_path);
+  new_index = path_shard (new_path);
+  old_shard = &handle_shards [old_index];
+  new_shard = &handle_shards [new_index];
 
-  if (!g_hash_table_lookup_extended (global_path_to_fh_map, old_path,
+  g_mutex_lock (&handle_shards [MIN (old_index, new_index)].path_mutex);
+  if (old_index != new_index)
+    g_mutex_lock (&handle_shards [MAX (old_index, new_index)].path_mutex);
+
+  if (g_hash_table_lookup_extended (old_shard->path_to_private, old_path,
+                                    (gpointer *) &old_path_internal,
+                                    (gpointer *) &handles))
+    {
+      g_hash_table_steal (old_shard->path_to_private, old_path);
+      g_free (old_path_internal);
+
+      for (l = handles; l != NULL; l = l->next)
+        {
+          fh = l->data;
+          g_free (fh->path);
+          fh->path = g_strdup (new_path);
+          g_atomic_int_set (&fh->shard, new_index);
+        }
+
+      handles = g_list_concat (handles,
+                               g_hash_table_lookup (new_shard->path_to_private, new_path));
+      g_hash_table_insert (new_shard->path_to_private, g_strdup (new_path), handles);
+    }
+
+  if (!g_hash_table_lookup_extended (old_shard->path_to_fh, old_path,
                                      (gpointer *) &old_path_internal,
                                      (gpointer *) &fh))
       goto out;
 
-  g_hash_table_steal (global_path_to_fh_map, old_path);
+  g_hash_table_steal (old_shard->path_to_fh, old_path);
 
   g_free (fh->path);
   fh->path = g_strdup (new_path);
+  g_atomic_int_set (&fh->shard, new_index);
 
-  g_hash_table_insert (global_path_to_fh_map, fh->path, fh);
+  g_hash_table_insert (new_shard->path_to_fh, fh->path, fh);
 
  out:
-  g_mutex_unlock (&global_mutex);
+  if (old_index != new_index)
+    g_mutex_unlock (&handle_shards [MAX (old_index, new_index)].path_mutex);
+  g_mutex_unlock (&handle_shards [MIN (old_index, new_index)].path_mutex);
 }
 
 static MountRecord *
@@ -617,6 +1171,183 @@ file_from_full_path (const gchar *path)
   return file;
 }
 
+/* --------------- *
+ * Attribute cache *
+ * --------------- */
+
+static void
+attr_cache_entry_free (AttrCacheEntry *entry)
+{
+  g_queue_delete_link (&attr_cache_order, entry->link);
+  g_free (entry);
+}
+
+static gboolean
+attr_cache_lookup (const gchar *path, struct stat *sbuf)
+{
+  AttrCacheEntry *entry;
+  gboolean        found = FALSE;
+
+  g_mutex_lock (&attr_cache_mutex);
+
+  entry = g_hash_table_lookup (attr_cache, path);
+  if (entry != NULL)
+    {
+      if (entry->expires > g_get_monotonic_time ())
+        {
+          *sbuf = entry->sbuf;
+          found = TRUE;
+        }
+      else
+        g_hash_table_remove (attr_cache, path);
+    }
+
+  g_mutex_unlock (&attr_cache_mutex);
+
+  return found;
+}
+
+static void
+attr_cache_insert (const gchar *path, const struct stat *sbuf)
+{
+  AttrCacheEntry *entry;
+  gchar          *key;
+
+  g_mutex_lock (&attr_cache_mutex);
+
+  g_hash_table_remove (attr_cache, path);
+
+  while (g_queue_get_length (&attr_cache_order) >= ATTR_CACHE_MAX_ENTRIES)
+    g_hash_table_remove (attr_cache, g_queue_peek_head (&attr_cache_order));
+
+  key = g_strdup (path);
+  entry = g_new (AttrCacheEntry, 1);
+  entry->sbuf = *sbuf;
+  entry->expires = g_get_monotonic_time () + ATTR_CACHE_TIMEOUT * G_USEC_PER_SEC;
+  g_queue_push_tail (&attr_cache_order, key);
+  entry->link = g_queue_peek_tail_link (&attr_cache_order);
+  g_hash_table_insert (attr_cache, key, entry);
+
+  g_mutex_unlock (&attr_cache_mutex);
+}
+
+static void
+attr_cache_remove (const gchar *path)
+{
+  g_mutex_lock (&attr_cache_mutex);
+  g_hash_table_remove (attr_cache, path);
+  g_mutex_unlock (&attr_cache_mutex);
+}
+
+/* Drops path and its parent, for operations that add or remove a directory entry */
+static void
+attr_cache_remove_entry (const gchar *path)
+{
+  gchar *parent;
+
+  parent = g_path_get_dirname (path);
+
+  g_mutex_lock (&attr_cache_mutex);
+  g_hash_table_remove (attr_cache, path);
+  g_hash_table_remove (attr_cache, parent);
+  g_mutex_unlock (&attr_cache_mutex);
+
+  g_free (parent);
+}
+
+/* Like attr_cache_remove_entry (), but also drops everything below path */
+static void
+attr_cache_remove_tree (const gchar *path)
+{
+  GHashTableIter  iter;
+  const gchar    *key;
+  gsize           len;
+
+  attr_cache_remove_entry (path);
+
+  len = strlen (path);
+
+  g_mutex_lock (&attr_cache_mutex);
+
+  g_hash_table_iter_init (&iter, attr_cache);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &key, NULL))
+    {
+      if (strncmp (key, path, len) == 0 && key [len] == '/')
+        g_hash_table_iter_remove (&iter);
+    }
+
+  g_mutex_unlock (&attr_cache_mutex);
+}
+
+static void
+dir_monitor_changed_cb (GFileMonitor      *monitor,
+                        GFile             *file,
+                        GFile             *other_file,
+                        GFileMonitorEvent  event_type,
+                        gpointer           user_data)
+{
+  const gchar *dir_path = user_data;
+  gchar       *basename;
+  gchar       *path;
+
+  basename = g_file_get_basename (file);
+  path = g_build_path ("/", dir_path, basename, NULL);
+
+  attr_cache_remove_tree (path);
+  attr_cache_remove (dir_path);
+
+  g_free (path);
+  g_free (basename);
+}
+
+static void
+dir_monitor_free (GFileMonitor *monitor)
+{
+  if (monitor == NULL)
+    return;
+
+  g_signal_handlers_disconnect_matched (monitor, G_SIGNAL_MATCH_FUNC,
+                                        0, 0, NULL, dir_monitor_changed_cb, NULL);
+  g_file_monitor_cancel (monitor);
+  g_object_unref (monitor);
+}
+
+/* Watch a directory we filled the cache from, so that changes made by
+ * others invalidate it early. The monitor signals are dispatched by the
+ * subthread, which runs the default main context. */
+static void
+dir_monitor_add (const gchar *path, GFile *file)
+{
+  GFileMonitor *monitor;
+  gchar        *key;
+
+  g_mutex_lock (&dir_monitor_mutex);
+
+  if (g_hash_table_contains (dir_monitors, path))
+    {
+      g_mutex_unlock (&dir_monitor_mutex);
+      return;
+    }
+
+  if (g_queue_get_length (&dir_monitor_order) >= MAX_DIR_MONITORS)
+    {
+      key = g_queue_pop_head (&dir_monitor_order);
+      g_hash_table_remove (dir_monitors, key);
+    }
+
+  /* Not all backends support monitoring, remember that too so we don't ask again */
+  monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, NULL);
+
+  key = g_strdup (path);
+  if (monitor != NULL)
+    g_signal_connect_data (monitor, "changed", G_CALLBACK (dir_monitor_changed_cb),
+                           g_strdup (path), (GClosureNotify) g_free, 0);
+  g_queue_push_tail (&dir_monitor_order, key);
+  g_hash_table_insert (dir_monitors, key, monitor);
+
+  g_mutex_unlock (&dir_monitor_mutex);
+}
+
 /* ------------- *
  * VFS functions *
  * ------------- */
@@ -723,6 +1454,37 @@ file_info_get_stat_mode (GFileInfo *file_info)
   return unix_mode;
 }
 
+static void
+stat_from_file_info (GFileInfo *file_info, struct stat *sbuf)
+{
+  GTimeVal mod_time;
+
+  sbuf->st_mode = file_info_get_stat_mode (file_info);
+  sbuf->st_size = g_file_info_get_size (file_info);
+  sbuf->st_uid = daemon_uid;
+  sbuf->st_gid = daemon_gid;
+
+  g_file_info_get_modification_time (file_info, &mod_time);
+  sbuf->st_mtime = mod_time.tv_sec;
+  sbuf->st_ctime = mod_time.tv_sec;
+  sbuf->st_atime = mod_time.tv_sec;
+
+  if (g_file_info_has_attribute (file_info, G_FILE_ATTRIBUTE_TIME_CHANGED))
+    sbuf->st_ctime = file_info_get_attribute_as_uint (file_info, G_FILE_ATTRIBUTE_TIME_CHANGED);
+  if (g_file_info_has_attribute (file_info, G_FILE_ATTRIBUTE_TIME_ACCESS))
+    sbuf->st_atime = file_info_get_attribute_as_uint (file_info, G_FILE_ATTRIBUTE_TIME_ACCESS);
+
+  if (g_file_info_has_attribute (file_info, G_FILE_ATTRIBUTE_UNIX_BLOCK_SIZE))
+    sbuf->st_blksize = file_info_get_attribute_as_uint (file_info, G_FILE_ATTRIBUTE_UNIX_BLOCK_SIZE);
+  if (g_file_info_has_attribute (file_info, G_FILE_ATTRIBUTE_UNIX_BLOCKS))
+    sbuf->st_blocks = file_info_get_attribute_as_uint (file_info, G_FILE_ATTRIBUTE_UNIX_BLOCKS);
+  else /* fake it to make 'du' work like 'du --apparent'. */
+    sbuf->st_blocks = (sbuf->st_size + 511) / 512;
+
+  /* Setting st_nlink to 1 for directories makes 'find' work */
+  sbuf->st_nlink = 1;
+}
+
 static gint
 getattr_for_file (GFile *file, struct stat *sbuf)
 {
@@ -730,49 +1492,11 @@ getattr_for_file (GFile *file, struct stat *sbuf)
   GError    *error  = NULL;
   gint       result = 0;
 
-  file_info = g_file_query_info (file, 
-                                 G_FILE_ATTRIBUTE_STANDARD_TYPE ","
-                                 G_FILE_ATTRIBUTE_STANDARD_NAME ","
-                                 G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK ","
-                                 G_FILE_ATTRIBUTE_STANDARD_SIZE ","
-                                 G_FILE_ATTRIBUTE_UNIX_MODE ","
-                                 G_FILE_ATTRIBUTE_TIME_CHANGED ","
-                                 G_FILE_ATTRIBUTE_TIME_MODIFIED ","
-                                 G_FILE_ATTRIBUTE_TIME_ACCESS ","
-                                 G_FILE_ATTRIBUTE_UNIX_BLOCK_SIZE ","
-                                 G_FILE_ATTRIBUTE_UNIX_BLOCKS ","
-				 "access::*",
-                                 0, NULL, &error);
+  file_info = g_file_query_info (file, STAT_ATTRIBUTES, 0, NULL, &error);
 
   if (file_info)
     {
-      GTimeVal mod_time;
-
-      sbuf->st_mode = file_info_get_stat_mode (file_info);
-      sbuf->st_size = g_file_info_get_size (file_info);
-      sbuf->st_uid = daemon_uid;
-      sbuf->st_gid = daemon_gid;
-
-      g_file_info_get_modification_time (file_info, &mod_time);
-      sbuf->st_mtime = mod_time.tv_sec;
-      sbuf->st_ctime = mod_time.tv_sec;
-      sbuf->st_atime = mod_time.tv_sec;
-
-      if (g_file_info_has_attribute (file_info, G_FILE_ATTRIBUTE_TIME_CHANGED))
-        sbuf->st_ctime = file_info_get_attribute_as_uint (file_info, G_FILE_ATTRIBUTE_TIME_CHANGED);
-      if (g_file_info_has_attribute (file_info, G_FILE_ATTRIBUTE_TIME_ACCESS))
-        sbuf->st_atime = file_info_get_attribute_as_uint (file_info, G_FILE_ATTRIBUTE_TIME_ACCESS);
-
-      if (g_file_info_has_attribute (file_info, G_FILE_ATTRIBUTE_UNIX_BLOCK_SIZE))
-	sbuf->st_blksize = file_info_get_attribute_as_uint (file_info, G_FILE_ATTRIBUTE_UNIX_BLOCK_SIZE);
-      if (g_file_info_has_attribute (file_info, G_FILE_ATTRIBUTE_UNIX_BLOCKS))
-	sbuf->st_blocks = file_info_get_attribute_as_uint (file_info, G_FILE_ATTRIBUTE_UNIX_BLOCKS);
-      else /* fake it to make 'du' work like 'du --apparent'. */
-	sbuf->st_blocks = (sbuf->st_size + 511) / 512;
-
-      /* Setting st_nlink to 1 for directories makes 'find' work */
-      sbuf->st_nlink = 1;
-
+      stat_from_file_info (file_info, sbuf);
       g_object_unref (file_info);
     }
   else
@@ -800,11 +1524,68 @@ getattr_for_file_handle (FileHandle *fh, struct stat *sbuf)
   sbuf->st_uid = daemon_uid;
   sbuf->st_gid = daemon_gid;
   sbuf->st_nlink = 1;
-  sbuf->st_size = fh->pos;
+  sbuf->st_size = fh->write_end;
   sbuf->st_blksize = 512;
+
+  if (fh->staging_fd != -1)
+    {
+      struct stat staging_sbuf;
+
+      if (fstat (fh->staging_fd, &staging_sbuf) == 0)
+        sbuf->st_size = staging_sbuf.st_size;
+    }
+
   sbuf->st_blocks = (sbuf->st_size + 511) / 512;
 }
 
+/* Staged files are ahead of the remote one until they are uploaded */
+static gboolean
+getattr_for_staged_path (const gchar *path, struct stat *sbuf)
+{
+  FileHandle *fh;
+  gboolean    staged = FALSE;
+
+  fh = get_file_handle_for_path (path);
+  if (fh == NULL)
+    return FALSE;
+
+  /* Not the handle's mutex, which a running upload holds */
+  g_mutex_lock (&fh->state_mutex);
+  if (fh->staging_fd != -1 && fh->staging_dirty)
+    {
+      getattr_for_file_handle (fh, sbuf);
+      staged = TRUE;
+    }
+  g_mutex_unlock (&fh->state_mutex);
+
+  file_handle_unref (fh);
+
+  return staged;
+}
+
+/* Writes still buffered in an open handle make the file bigger than the
+ * backend knows */
+static void
+getattr_add_buffered_writes (const gchar *path, struct stat *sbuf)
+{
+  FileHandle *fh;
+
+  fh = get_file_handle_for_path (path);
+  if (fh == NULL)
+    return;
+
+  /* The handle's mutex is held while the buffer is sent, don't wait */
+  g_mutex_lock (&fh->state_mutex);
+  if (fh->writes_buffered && fh->write_end > sbuf->st_size)
+    {
+      sbuf->st_size = fh->write_end;
+      sbuf->st_blocks = (sbuf->st_size + 511) / 512;
+    }
+  g_mutex_unlock (&fh->state_mutex);
+
+  file_handle_unref (fh);
+}
+
 static gint
 vfs_getattr (const gchar *path, struct stat *sbuf)
 {
@@ -839,13 +1620,23 @@ vfs_getattr (const gchar *path, struct stat *sbuf)
       sbuf->st_uid   = daemon_uid;
       sbuf->st_gid   = daemon_gid;
     }
+  else if (getattr_for_staged_path (path, sbuf))
+    {
+      /* Written locally, not uploaded yet */
+    }
+  else if (attr_cache_lookup (path, sbuf))
+    {
+      /* Cached from an earlier getattr or readdir */
+    }
   else if ((file = file_from_full_path (path)))
     {
       /* Submount */
 
       result = getattr_for_file (file, sbuf);
 
-      if (result != 0)
+      if (result == 0)
+        attr_cache_insert (path, sbuf);
+      else
         {
           FileHandle *fh = get_file_handle_for_path (path);
 
@@ -855,9 +1646,9 @@ vfs_getattr (const gchar *path, struct stat *sbuf)
 
           if (fh != NULL)
             {
-              g_mutex_lock (&fh->mutex);
+              g_mutex_lock (&fh->state_mutex);
               getattr_for_file_handle (fh, sbuf);
-              g_mutex_unlock (&fh->mutex);
+              g_mutex_unlock (&fh->state_mutex);
 
               file_handle_unref (fh);
               result = 0;
@@ -871,6 +1662,9 @@ vfs_getattr (const gchar *path, struct stat *sbuf)
       result = -ENOENT;
     }
 
+  if (result == 0 && S_ISREG (sbuf->st_mode))
+    getattr_add_buffered_writes (path, sbuf);
+
   debug_print ("vfs_getattr: -> %s\n", g_strerror (-result));
 
   return result;
@@ -895,6 +1689,9 @@ setup_input_stream (GFile *file, FileHandle *fh)
   GError *error  = NULL;
   gint    result = 0;
 
+  if (fh->staging_fd != -1)
+    return 0;
+
   if (fh->stream)
     {
       debug_print ("setup_input_stream: have stream\n");
@@ -907,6 +1704,7 @@ setup_input_stream (GFile *file, FileHandle *fh)
         {
           debug_print ("setup_input_stream: doing write\n");
 
+          file_handle_flush_writes (fh);
           g_output_stream_close (fh->stream, NULL, NULL);
           g_object_unref (fh->stream);
           fh->stream = NULL;
@@ -941,6 +1739,9 @@ setup_output_stream (GFile *file, FileHandle *fh, int flags)
   GError *error  = NULL;
   gint    result = 0;
 
+  if (fh->staging_fd != -1)
+    return 0;
+
   if (fh->stream)
     {
       if (fh->op == FILE_OP_WRITE)
@@ -961,7 +1762,10 @@ setup_output_stream (GFile *file, FileHandle *fh, int flags)
       else
         fh->stream = g_file_append_to (file, 0, NULL, &error);
       if (fh->stream)
-        fh->pos = g_seekable_tell (G_SEEKABLE (fh->stream));
+        {
+          fh->pos = g_seekable_tell (G_SEEKABLE (fh->stream));
+          file_handle_set_write_end (fh, FALSE);
+        }
     }
 
   if (fh->stream)
@@ -982,7 +1786,15 @@ static gint
 open_common (const gchar *path, struct fuse_file_info *fi, GFile *file, int output_flags)
 {
   gint        result;
-  FileHandle *fh = get_or_create_file_handle_for_path (path);
+  FileHandle *fh;
+
+  /* Writers share one handle per path, so that readers and getattr see
+   * what was written. Plain readers get their own stream unless a
+   * writer is around, so parallel reads of one file don't serialise. */
+  if (fi->flags & O_WRONLY || fi->flags & O_RDWR)
+    fh = get_or_create_file_handle_for_path (path);
+  else if ((fh = get_file_handle_for_path (path)) == NULL)
+    fh = create_private_file_handle_for_path (path);
 
   g_mutex_lock (&fh->mutex);
 
@@ -1064,6 +1876,9 @@ vfs_open (const gchar *path, struct fuse_file_info *fi)
       result = -ENOENT;
     }
 
+  if (fi->flags & O_TRUNC)
+    attr_cache_remove (path);
+
   debug_print ("vfs_open: -> %s\n", g_strerror (-result));
 
   return result;
@@ -1136,6 +1951,8 @@ vfs_create (const gchar *path, mode_t mode, struct fuse_file_info *fi)
       result = -ENOENT;
     }
 
+  attr_cache_remove_entry (path);
+
   debug_print ("vfs_create: -> %s\n", g_strerror (-result));
 
   return result;
@@ -1155,9 +1972,34 @@ vfs_release (const gchar *path, struct fuse_file_info *fi)
       file_handle_unref (fh);
     }
 
+  attr_cache_remove (path);
+
   return 0;
 }
 
+static gint
+read_fd (gint fd, gchar *output_buf, size_t output_buf_size, off_t offset)
+{
+  gssize n_bytes_read = 0;
+  gssize res;
+
+  while (n_bytes_read < output_buf_size)
+    {
+      res = pread (fd, output_buf + n_bytes_read,
+                   output_buf_size - n_bytes_read, offset + n_bytes_read);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res < 0)
+        return -errno;
+      if (res == 0)
+        break;
+
+      n_bytes_read += res;
+    }
+
+  return n_bytes_read;
+}
+
 static gint
 read_stream (FileHandle *fh, gchar *output_buf, size_t output_buf_size, off_t offset)
 {
@@ -1167,8 +2009,18 @@ read_stream (FileHandle *fh, gchar *output_buf, size_t output_buf_size, off_t of
   gint          result          = 0;
   GError       *error           = NULL;
 
+  if (fh->staging_fd != -1)
+    return read_fd (fh->staging_fd, output_buf, output_buf_size, offset);
+
   input_stream = fh->stream;
 
+  /* Backends keeping the file locally hand it over, read it in place
+   * rather than through the stream. This doesn't move the stream, so pos
+   * stays where it is. */
+  if (G_IS_FILE_DESCRIPTOR_BASED (input_stream))
+    return read_fd (g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (input_stream)),
+                    output_buf, output_buf_size, offset);
+
   if (offset != fh->pos)
     {
       if (g_seekable_can_seek (G_SEEKABLE (input_stream)))
@@ -1310,77 +2162,98 @@ vfs_read (const gchar *path, gchar *buf, size_t size,
   return result;
 }
 
+static gint
+write_staging (FileHandle *fh, const gchar *input_buf, size_t input_buf_size, off_t offset)
+{
+  gssize n_bytes_written = 0;
+  gssize res;
+
+  while (n_bytes_written < input_buf_size)
+    {
+      res = pwrite (fh->staging_fd, input_buf + n_bytes_written,
+                    input_buf_size - n_bytes_written, offset + n_bytes_written);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res < 0)
+        return -errno;
+
+      n_bytes_written += res;
+    }
+
+  fh->pos = offset + input_buf_size;
+  g_mutex_lock (&fh->state_mutex);
+  fh->staging_dirty = TRUE;
+  fh->write_end = fh->pos;
+  g_mutex_unlock (&fh->state_mutex);
+
+  return input_buf_size;
+}
+
 static gint
 write_stream (FileHandle *fh, const gchar *input_buf, size_t input_buf_size, off_t offset)
 {
   GOutputStream *output_stream;
-  gint           n_bytes_written = 0;
   gint           result          = 0;
   GError        *error           = NULL;
 
   debug_print ("write_stream: %d bytes at offset %d.\n", input_buf_size, offset);
 
+  if (fh->staging_fd != -1)
+    return write_staging (fh, input_buf, input_buf_size, offset);
+
   output_stream = fh->stream;
 
   if (offset != fh->pos)
     {
-      if (g_seekable_can_seek (G_SEEKABLE (output_stream)))
-        {
-          /* Can seek */
+      /* The stream is behind pos by what we buffered, catch up first */
+      result = file_handle_flush_writes (fh);
 
-          if (g_seekable_seek (G_SEEKABLE (output_stream), offset, G_SEEK_SET, NULL, &error))
+      if (result == 0)
+        {
+          if (g_seekable_can_seek (G_SEEKABLE (output_stream)))
             {
-              fh->pos = offset;
+              /* Can seek */
+
+              if (g_seekable_seek (G_SEEKABLE (output_stream), offset, G_SEEK_SET, NULL, &error))
+                {
+                  fh->pos = offset;
+                }
+              else
+                {
+                  result = -errno_from_error (error);
+                  g_error_free (error);
+                }
             }
           else
             {
-              result = -errno_from_error (error);
-              g_error_free (error);
-            }
-        }
-      else
-        {
-          /* Can't seek, and output streams can't skip */
+              /* Can't seek, and output streams can't skip, so finish
+               * the job locally and upload the result on flush */
 
-          result = -ENOTSUP;
+              result = file_handle_start_staging (fh);
+              if (result == 0)
+                return write_staging (fh, input_buf, input_buf_size, offset);
+            }
         }
     }
 
   if (result == 0)
     {
-      while (n_bytes_written < input_buf_size)
-        {
-          gboolean part_result;
-          gsize    part_bytes_written = 0;
+      /* The kernel hands us at most a page or max_write at a time, send
+       * sequential writes to the daemon in larger blocks */
+      if (fh->write_buffer == NULL)
+        fh->write_buffer = g_byte_array_sized_new (WRITE_BUFFER_SIZE);
 
-          part_result = g_output_stream_write_all (output_stream,
-                                                   (void *) (input_buf + n_bytes_written),
-                                                   input_buf_size - n_bytes_written,
-                                                   &part_bytes_written,
-                                                   NULL,
-                                                   &error);
+      g_byte_array_append (fh->write_buffer, (const guint8 *) input_buf, input_buf_size);
+      fh->pos += input_buf_size;
+      file_handle_set_write_end (fh, TRUE);
+      result = input_buf_size;
 
-          n_bytes_written += part_bytes_written;
-          fh->pos += part_bytes_written;
-
-          if (!part_result)
-            break;
-        }
-
-      result = n_bytes_written;
-
-      if (n_bytes_written < input_buf_size)
+      if (fh->write_buffer->len >= WRITE_BUFFER_SIZE)
         {
-          if (error)
-            {
-              result = -errno_from_error (error);
-              g_error_free (error);
-            }
-        }
-      else if (!g_output_stream_flush (output_stream, NULL, &error))
-        {
-          result = -errno_from_error (error);
-          g_error_free (error);
+          gint flush_result = file_handle_flush_writes (fh);
+
+          if (flush_result < 0)
+            result = flush_result;
         }
     }
 
@@ -1425,6 +2298,8 @@ vfs_write (const gchar *path, const gchar *buf, size_t len, off_t offset,
       result = -EIO;
     }
 
+  attr_cache_remove (path);
+
   if (result < 0)
     debug_print ("vfs_write: -> %s\n", g_strerror (-result));
   else
@@ -1437,12 +2312,17 @@ static gint
 vfs_flush (const gchar *path, struct fuse_file_info *fi)
 {
   FileHandle *fh = get_file_handle_from_info (fi);
+  gint        result = 0;
 
   debug_print ("vfs_flush: %s\n", path);
 
   if (fh)
     {
       g_mutex_lock (&fh->mutex);
+      /* Report failures of the writes we buffered or staged */
+      result = file_handle_flush_writes (fh);
+      if (result == 0)
+        result = file_handle_upload_staging (fh);
       file_handle_close_stream (fh);
       g_mutex_unlock (&fh->mutex);
 
@@ -1450,20 +2330,26 @@ vfs_flush (const gchar *path, struct fuse_file_info *fi)
       file_handle_unref (fh);
     }
 
-  /* TODO: Error handling. */
-  return 0;
+  attr_cache_remove (path);
+
+  return result;
 }
 
 static gint
 vfs_fsync (const gchar *path, gint sync_data_only, struct fuse_file_info *fi)
 {
   FileHandle *fh = get_file_handle_from_info (fi);
+  gint        result = 0;
 
   debug_print ("vfs_flush: %s\n", path);
 
   if (fh)
     {
       g_mutex_lock (&fh->mutex);
+      /* Report failures of the writes we buffered or staged */
+      result = file_handle_flush_writes (fh);
+      if (result == 0)
+        result = file_handle_upload_staging (fh);
       file_handle_close_stream (fh);
       g_mutex_unlock (&fh->mutex);
 
@@ -1471,8 +2357,9 @@ vfs_fsync (const gchar *path, gint sync_data_only, struct fuse_file_info *fi)
       file_handle_unref (fh);
     }
 
-  /* TODO: Error handling. */
-  return 0;
+  attr_cache_remove (path);
+
+  return result;
 }
 
 static gint
@@ -1506,15 +2393,19 @@ vfs_opendir (const gchar *path, struct fuse_file_info *fi)
 }
 
 static gint
-readdir_for_file (GFile *base_file, gpointer buf, fuse_fill_dir_t filler)
+readdir_for_file (const gchar *path, GFile *base_file, gpointer buf, fuse_fill_dir_t filler)
 {
   GFileEnumerator *enumerator;
   GFileInfo       *file_info;
   GError          *error = NULL;
+  struct stat      sbuf;
+  gchar           *child_path;
 
   g_assert (base_file != NULL);
 
-  enumerator = g_file_enumerate_children (base_file, G_FILE_ATTRIBUTE_STANDARD_NAME, 0, NULL, &error);
+  /* Ask for everything getattr needs, so the stat calls that usually
+   * follow a readdir can be answered from the cache */
+  enumerator = g_file_enumerate_children (base_file, STAT_ATTRIBUTES, 0, NULL, &error);
   if (!enumerator)
     {
       gint result;
@@ -1534,12 +2425,22 @@ readdir_for_file (GFile *base_file, gpointer buf, fuse_fill_dir_t filler)
       return result;
     }
 
+  dir_monitor_add (path, base_file);
+
   filler (buf, ".", NULL, 0);
   filler (buf, "..", NULL, 0);
 
   while ((file_info = g_file_enumerator_next_file (enumerator, NULL, &error)) != NULL)
     {
-      filler (buf, g_file_info_get_name (file_info), NULL, 0);
+      memset (&sbuf, 0, sizeof (sbuf));
+      sbuf.st_blksize = 4096;
+      stat_from_file_info (file_info, &sbuf);
+
+      child_path = g_build_path ("/", path, g_file_info_get_name (file_info), NULL);
+      attr_cache_insert (child_path, &sbuf);
+      g_free (child_path);
+
+      filler (buf, g_file_info_get_name (file_info), &sbuf, 0);
       g_object_unref (file_info);
     }
 
@@ -1581,7 +2482,7 @@ vfs_readdir (const gchar *path, gpointer buf, fuse_fill_dir_t filler, off_t offs
     {
       /* Submount */
 
-      result = readdir_for_file (base_file, buf, filler);
+      result = readdir_for_file (path, base_file, buf, filler);
 
       g_object_unref (base_file);
     }
@@ -1612,6 +2513,9 @@ vfs_rename (const gchar *old_path, const gchar *new_path)
     {
       FileHandle *fh = get_file_handle_for_path (old_path);
 
+      close_private_file_handles_for_path (old_path);
+      close_private_file_handles_for_path (new_path);
+
       if (fh)
         {
           g_mutex_lock (&fh->mutex);
@@ -1654,6 +2558,9 @@ vfs_rename (const gchar *old_path, const gchar *new_path)
   if (new_file)
     g_object_unref (new_file);
 
+  attr_cache_remove_tree (old_path);
+  attr_cache_remove_tree (new_path);
+
   debug_print ("vfs_rename: -> %s\n", g_strerror (-result));
 
   return result;
@@ -1674,6 +2581,8 @@ vfs_unlink (const gchar *path)
     {
       FileHandle *fh = get_file_handle_for_path (path);
 
+      close_private_file_handles_for_path (path);
+
       if (fh)
         {
           g_mutex_lock (&fh->mutex);
@@ -1703,6 +2612,8 @@ vfs_unlink (const gchar *path)
       result = -ENOENT;
     }
 
+  attr_cache_remove_entry (path);
+
   debug_print ("vfs_unlink: -> %s\n", g_strerror (-result));
 
   return result;
@@ -1741,6 +2652,8 @@ vfs_mkdir (const gchar *path, mode_t mode)
       result = -ENOENT;
     }
 
+  attr_cache_remove_entry (path);
+
   debug_print ("vfs_mkdir: -> %s\n", g_strerror (-result));
 
   return result;
@@ -1797,6 +2710,8 @@ vfs_rmdir (const gchar *path)
       result = -ENOENT;
     }
 
+  attr_cache_remove_tree (path);
+
   debug_print ("vfs_rmdir: -> %s\n", g_strerror (-result));
 
   return result;
@@ -1835,26 +2750,16 @@ file_handle_get_size (FileHandle *fh,
   return res;
 }
 
-#define PAD_BLOCK_SIZE 65536
-
 static gint
-pad_file (FileHandle *fh, gsize num, goffset current_size)
+truncate_staging (FileHandle *fh, off_t size)
 {
-  gpointer buf;
-  gsize written;
-  gint res;
+  if (ftruncate (fh->staging_fd, size) == -1)
+    return -errno;
 
-  res = 0;
-  buf = g_malloc0 (PAD_BLOCK_SIZE);
-  for (written = 0; written < num; written += PAD_BLOCK_SIZE)
-    {
-      res = write_stream (fh, buf, MIN (num - written, PAD_BLOCK_SIZE), current_size + written);
-      if (res < 0)
-        break;
-    }
-  g_free (buf);
-
-  return (res < 0 ? res : 0);
+  g_mutex_lock (&fh->state_mutex);
+  fh->staging_dirty = TRUE;
+  g_mutex_unlock (&fh->state_mutex);
+  return 0;
 }
 
 static gint
@@ -1878,8 +2783,14 @@ vfs_ftruncate (const gchar *path, off_t size, struct fuse_file_info *fi)
           g_mutex_lock (&fh->mutex);
 
           result = setup_output_stream (file, fh, 0);
-
           if (result == 0)
+            result = file_handle_flush_writes (fh);
+
+          if (result == 0 && fh->staging_fd != -1)
+            {
+              result = truncate_staging (fh, size);
+            }
+          else if (result == 0)
             {
               if (g_seekable_can_truncate (G_SEEKABLE (fh->stream)))
                 {
@@ -1903,25 +2814,17 @@ vfs_ftruncate (const gchar *path, off_t size, struct fuse_file_info *fi)
                       fh->stream = NULL;
                     }
                 }
-              else if (file_handle_get_size (fh, &current_size))
+              else if (file_handle_get_size (fh, &current_size) && current_size == size)
                 {
-                  if (current_size == size)
-                    {
-                      /* Don't have to do anything to succeed */
-                    }
-                  else if ((current_size < size) && g_seekable_can_seek (G_SEEKABLE (fh->stream)))
-                    {
-                      /* If the truncated size is larger than the current size
-                       * then we need to pad out the difference with 0's */
-                      goffset orig_pos = g_seekable_tell (G_SEEKABLE (fh->stream));
-                      result = pad_file (fh, size - current_size, current_size);
-                      if (result == 0)
-                        g_seekable_seek (G_SEEKABLE (fh->stream), orig_pos, G_SEEK_SET, NULL, &error);
-                    }
-		}
-	      else
-		{
-		  result = -ENOTSUP;
+                  /* Don't have to do anything to succeed */
+                }
+              else
+                {
+                  /* Stage the file and truncate the local copy, it is
+                   * uploaded on flush */
+                  result = file_handle_start_staging (fh);
+                  if (result == 0)
+                    result = truncate_staging (fh, size);
                 }
 
               if (error)
@@ -1946,6 +2849,8 @@ vfs_ftruncate (const gchar *path, off_t size, struct fuse_file_info *fi)
       result = -ENOENT;
     }
 
+  attr_cache_remove (path);
+
   debug_print ("vfs_ftruncate: -> %s\n", g_strerror (-result));
 
   return result;
@@ -1967,12 +2872,24 @@ vfs_truncate (const gchar *path, off_t size)
       GFileOutputStream *file_output_stream = NULL;
       FileHandle        *fh;
 
+      /* Readers would keep the file from being replaced */
+      close_private_file_handles_for_path (path);
+
       /* Get a file handle just to lock the path while we're working */
       fh = get_file_handle_for_path (path);
       if (fh)
-        g_mutex_lock (&fh->mutex);
+        {
+          g_mutex_lock (&fh->mutex);
+          /* Don't let buffered writes land after the truncation */
+          file_handle_flush_writes (fh);
+        }
 
-      if (size == 0)
+      if (fh && fh->staging_fd != -1)
+        {
+          /* The staged copy is uploaded over the remote file later anyway */
+          result = truncate_staging (fh, size);
+        }
+      else if (size == 0)
         {
           file_output_stream = g_file_replace (file, 0, FALSE, 0, NULL, &error);
         }
@@ -2008,6 +2925,8 @@ vfs_truncate (const gchar *path, off_t size)
       result = -ENOENT;
     }
 
+  attr_cache_remove (path);
+
   debug_print ("vfs_truncate: -> %s\n", g_strerror (-result));
 
   return result;
@@ -2039,6 +2958,8 @@ vfs_symlink (const gchar *path_old, const gchar *path_new)
       result = -ENOENT;
     }
 
+  attr_cache_remove_entry (path_new);
+
   debug_print ("vfs_symlink: -> %s\n", g_strerror (-result));
 
   return result;
@@ -2189,6 +3110,8 @@ vfs_utimens (const gchar *path, const struct timespec tv [2])
       result = -ENOENT;
     }
 
+  attr_cache_remove (path);
+
   debug_print ("vfs_utimens: -> %s\n", g_strerror (-result));
   return result;
 }
@@ -2215,6 +3138,8 @@ vfs_chmod (const gchar *path, mode_t mode)
       g_object_unref (file);
     }
 
+  attr_cache_remove (path);
+
   return result;
 }
 
@@ -2327,15 +3252,26 @@ vfs_init (struct fuse_conn_info *conn)
 {
   GVfsDBusMountTracker *proxy;
   GError *error;
+  gint i;
   
   daemon_creation_time = time (NULL);
   daemon_uid = getuid ();
   daemon_gid = getgid ();
 
-  global_path_to_fh_map = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                 NULL, (GDestroyNotify) file_handle_free);
-  global_active_fh_map = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-                                                NULL, NULL);
+  for (i = 0; i < N_HANDLE_SHARDS; i++)
+    {
+      g_mutex_init (&handle_shards [i].path_mutex);
+      g_mutex_init (&handle_shards [i].active_mutex);
+      handle_shards [i].path_to_fh = g_hash_table_new (g_str_hash, g_str_equal);
+      handle_shards [i].path_to_private = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                 g_free, NULL);
+      handle_shards [i].active_fh = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                           NULL, NULL);
+    }
+  attr_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                      g_free, (GDestroyNotify) attr_cache_entry_free);
+  dir_monitors = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        g_free, (GDestroyNotify) dir_monitor_free);
 
   
   error = NULL;
@@ -2391,6 +3327,12 @@ vfs_init (struct fuse_conn_info *conn)
   /* Indicate O_TRUNC support for open() */
   conn->want |= FUSE_CAP_ATOMIC_O_TRUNC;
 
+#ifdef FUSE_CAP_BIG_WRITES
+  /* Get writes in max_write sized pieces rather than one page at a time */
+  if (conn->capable & FUSE_CAP_BIG_WRITES)
+    conn->want |= FUSE_CAP_BIG_WRITES;
+#endif
+
   return NULL;
 }
 
@@ -2402,6 +3344,13 @@ vfs_destroy (gpointer param)
   g_clear_object (&dbus_conn);
   
   mount_list_free ();
+
+  g_mutex_lock (&dir_monitor_mutex);
+  g_queue_clear (&dir_monitor_order);
+  g_hash_table_destroy (dir_monitors);
+  dir_monitors = NULL;
+  g_mutex_unlock (&dir_monitor_mutex);
+
   if (subthread_main_loop != NULL) 
     g_main_loop_quit (subthread_main_loop);
   g_object_unref (gvfs);
@@ -2453,5 +3402,29 @@ static struct fuse_operations vfs_oper =
 gint
 main (gint argc, gchar *argv [])
 {
-  return fuse_main (argc, argv, &vfs_oper, NULL /* user data */);
+  gchar **new_argv;
+  gchar  *timeouts;
+  gint    result;
+  gint    i;
+
+  /* Let the kernel keep attributes and entries as long as our own
+   * cache does. These go first so that options on the command line
+   * still win. */
+  timeouts = g_strdup_printf ("attr_timeout=%d,entry_timeout=%d",
+                              ATTR_CACHE_TIMEOUT, ATTR_CACHE_TIMEOUT);
+
+  new_argv = g_new (gchar *, argc + 3);
+  new_argv[0] = argv[0];
+  new_argv[1] = "-o";
+  new_argv[2] = timeouts;
+  for (i = 1; i < argc; i++)
+    new_argv[i + 2] = argv[i];
+  new_argv[argc + 2] = NULL;
+
+  result = fuse_main (argc + 2, new_argv, &vfs_oper, NULL /* user data */);
+
+  g_free (new_argv);
+  g_free (timeouts);
+
+  return result;
 }
@@ -133,7 +133,7 @@ g_vfs_icon_load (GLoadableIcon  *icon,
   g_variant_unref (fd_id_val);
   g_object_unref (fd_list);
   
-  return G_INPUT_STREAM (g_daemon_file_input_stream_new (fd, can_seek));
+  return G_INPUT_STREAM (g_daemon_file_input_stream_new (fd, -1, -1, can_seek));
 }
 
 
@@ -305,7 +305,7 @@ open_icon_read_cb (GVfsDBusMount *proxy,
     }
   else
     {
-      stream = g_daemon_file_input_stream_new (fd, can_seek);
+      stream = g_daemon_file_input_stream_new (fd, -1, -1, can_seek);
       g_simple_async_result_set_op_res_gpointer (data->result, stream, g_object_unref);
       g_object_unref (fd_list);
     }
@@ -143,11 +143,9 @@ _g_dbus_type_from_file_attribute_type (GFileAttributeType type)
   return dbus_type;
 }
 
-GVariant *
-_g_dbus_append_file_attribute (const char *attribute,
-			       GFileAttributeStatus status,
-			       GFileAttributeType type,
-			       gpointer value_p)
+static GVariant *
+append_file_attribute_value (GFileAttributeType type,
+			     gpointer value_p)
 {
   const char *dbus_type;
   GVariant *v;
@@ -179,11 +177,20 @@ _g_dbus_append_file_attribute (const char *attribute,
     v = g_variant_new (dbus_type, *(gboolean *)value_p);
   else
     v = g_variant_new (dbus_type, value_p);
-  
+
+  return v;
+}
+
+GVariant *
+_g_dbus_append_file_attribute (const char *attribute,
+			       GFileAttributeStatus status,
+			       GFileAttributeType type,
+			       gpointer value_p)
+{
   return g_variant_new ("(suv)",
                         attribute,
                         status,
-                        v);
+                        append_file_attribute_value (type, value_p));
 }
 
 GVariant *
@@ -211,23 +218,67 @@ _g_dbus_append_file_info (GFileInfo *info)
   return g_variant_builder_end (&builder);
 }
 
-gboolean
-_g_dbus_get_file_attribute (GVariant *value,
-			    gchar **attribute,
-			    GFileAttributeStatus *status,
-			    GFileAttributeType *type,
-			    GDBusAttributeValue *attr_value)
+/* Like _g_dbus_append_file_info(), but the attributes are referred to
+ * by their index in a dictionary shared by all the infos of a stream,
+ * as a(qyv). attribute_ids maps the names already sent to their index
+ * + 1, it must own its keys. Names not seen before are added to it and
+ * to new_attributes, which the caller must send before the info. */
+GVariant *
+_g_dbus_append_file_info_compact (GFileInfo *info,
+				  GHashTable *attribute_ids,
+				  GPtrArray *new_attributes)
+{
+  GVariantBuilder builder;
+  char **attributes;
+  char *name;
+  guint id;
+  int i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(qyv)"));
+
+  attributes = g_file_info_list_attributes (info, NULL);
+  for (i = 0; attributes[i] != NULL; i++)
+    {
+      GFileAttributeType type;
+      GFileAttributeStatus status;
+      gpointer value_p;
+
+      if (!g_file_info_get_attribute_data (info, attributes[i], &type, &value_p, &status))
+        continue;
+
+      id = GPOINTER_TO_UINT (g_hash_table_lookup (attribute_ids, attributes[i]));
+      if (id == 0)
+        {
+          id = g_hash_table_size (attribute_ids) + 1;
+          if (id > G_MAXUINT16 + 1)
+            {
+              g_warning ("Too many attributes, ignoring %s\n", attributes[i]);
+              continue;
+            }
+          name = g_strdup (attributes[i]);
+          g_hash_table_insert (attribute_ids, name, GUINT_TO_POINTER (id));
+          g_ptr_array_add (new_attributes, name);
+        }
+
+      g_variant_builder_add (&builder, "(qyv)",
+                             (guint16) (id - 1),
+                             (guchar) status,
+                             append_file_attribute_value (type, value_p));
+    }
+  g_strfreev (attributes);
+
+  return g_variant_builder_end (&builder);
+}
+
+static gboolean
+get_file_attribute_value (GVariant *v,
+			  GFileAttributeType *type,
+			  GDBusAttributeValue *attr_value)
 {
   gboolean res;
   char *str;
   guint32 obj_type;
   GObject *obj;
-  GVariant *v;
-
-  g_variant_get (value, "(suv)",
-                 attribute,
-                 status,
-                 &v);
 
   res = TRUE;
   if (g_variant_is_of_type (v, G_VARIANT_TYPE_STRING))
@@ -315,6 +366,25 @@ _g_dbus_get_file_attribute (GVariant *value,
   else
     res = FALSE;
 
+  return res;
+}
+
+gboolean
+_g_dbus_get_file_attribute (GVariant *value,
+			    gchar **attribute,
+			    GFileAttributeStatus *status,
+			    GFileAttributeType *type,
+			    GDBusAttributeValue *attr_value)
+{
+  gboolean res;
+  GVariant *v;
+
+  g_variant_get (value, "(suv)",
+                 attribute,
+                 status,
+                 &v);
+
+  res = get_file_attribute_value (v, type, attr_value);
   g_variant_unref (v);
   
   return res;
@@ -359,6 +429,52 @@ _g_dbus_get_file_info (GVariant *value,
   return NULL;
 }
 
+/* Decodes an info from _g_dbus_append_file_info_compact(), attributes
+ * holds the names of the dictionary in index order */
+GFileInfo *
+_g_dbus_get_file_info_compact (GVariant *value,
+			       GPtrArray *attributes,
+			       GError **error)
+{
+  GFileInfo *info;
+  const char *attribute;
+  GFileAttributeType type;
+  GDBusAttributeValue attr_value;
+  GVariantIter iter;
+  GVariant *v;
+  guint16 id;
+  guchar status;
+
+  info = g_file_info_new ();
+
+  g_variant_iter_init (&iter, value);
+  while (g_variant_iter_next (&iter, "(qyv)", &id, &status, &v))
+    {
+      if (id >= attributes->len ||
+          !get_file_attribute_value (v, &type, &attr_value))
+        {
+          g_variant_unref (v);
+          goto error;
+        }
+      g_variant_unref (v);
+
+      attribute = g_ptr_array_index (attributes, id);
+      g_file_info_set_attribute (info, attribute, type, _g_dbus_attribute_as_pointer (type, &attr_value));
+      if (status)
+        g_file_info_set_attribute_status (info, attribute, status);
+
+      _g_dbus_attribute_value_destroy (type, &attr_value);
+    }
+
+  return info;
+
+ error:
+  g_object_unref (info);
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+		       _("Invalid file info format"));
+  return NULL;
+}
+
 GFileAttributeInfoList *
 _g_dbus_get_attribute_info_list (GVariant *value,
 				 GError **error)
@@ -393,3 +509,19 @@ _g_dbus_append_attribute_info_list (GFileAttributeInfoList *list)
   
   return g_variant_builder_end (&builder);
 }
+
+/* Returns the ring position of a block of size bytes following pos.
+ * Blocks never wrap around the end of the ring, they start at the
+ * beginning again instead. */
+guint32
+_g_vfs_daemon_shm_block_start (guint32 pos,
+			       guint32 size)
+{
+  guint32 offset;
+
+  offset = pos % G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_SIZE;
+  if (offset + size > G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_SIZE)
+    pos += G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_SIZE - offset;
+
+  return pos;
+}
@@ -41,6 +41,9 @@ typedef struct {
 read, readahead reply:
 type, seek_generation, size, data
 
+read, readahead reply with the data in shared memory:
+type, seek_generation, size
+
 seek reply:
 type, pos (64),
 
@@ -67,6 +70,31 @@ typedef struct {
 #define G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_WRITTEN  3
 #define G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_CLOSED   4
 #define G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_INFO     5
+#define G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_DATA_SHM 6
+
+/* Read channels opened with OpenForReadDirect may have a shared memory
+ * area, a header followed by a ring of G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_SIZE
+ * bytes. The daemon puts the data of DATA_SHM replies in the ring, one
+ * block after the other in the order of the replies, see
+ * _g_vfs_daemon_shm_block_start(). The client sets consumed to the ring
+ * position after the last block it took, the daemon only reuses the space
+ * before it. Until the client sets client_mapped only DATA replies are
+ * sent. Both are only accessed atomically.
+ */
+typedef struct {
+  gint client_mapped;
+  gint consumed;
+} GVfsDaemonSocketProtocolShmHeader;
+
+#define G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE 64
+#define G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_SIZE (4*1024*1024)
+
+guint32    _g_vfs_daemon_shm_block_start         (guint32                     pos,
+						  guint32                     size);
+
+/* Private flag of the Enumerate call, set by clients that take the
+ * infos through GotInfoCompact */
+#define G_VFS_DAEMON_ENUMERATE_FLAG_COMPACT_INFO (1 << 30)
 
 
 typedef union {
@@ -92,6 +120,12 @@ gboolean   _g_dbus_get_file_attribute            (GVariant                   *va
 						  GDBusAttributeValue        *attr_value);
 GFileInfo *_g_dbus_get_file_info                 (GVariant                   *value,
 						  GError                    **error);
+GVariant * _g_dbus_append_file_info_compact      (GFileInfo                  *file_info,
+						  GHashTable                 *attribute_ids,
+						  GPtrArray                  *new_attributes);
+GFileInfo *_g_dbus_get_file_info_compact         (GVariant                   *value,
+						  GPtrArray                  *attributes,
+						  GError                    **error);
 
 GFileAttributeInfoList *_g_dbus_get_attribute_info_list    (GVariant                *value,
 							    GError                 **error);
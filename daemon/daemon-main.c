@@ -350,6 +350,20 @@ do_name_acquired (gpointer user_data)
   return FALSE;
 }
 
+/* Number of jobs the backend can run in parallel, 0 if it doesn't care */
+static int
+backend_max_job_threads (GType backend_type)
+{
+  GVfsBackendClass *backend_class;
+  int max_job_threads;
+
+  backend_class = g_type_class_ref (backend_type);
+  max_job_threads = backend_class->max_job_threads;
+  g_type_class_unref (backend_class);
+
+  return max_job_threads;
+}
+
 void
 daemon_main (int argc,
 	     char *argv[],
@@ -363,6 +377,8 @@ daemon_main (int argc,
   const char *type;
   guint name_owner_id;
   DaemonData *data;
+  int backend_threads;
+  int max_backend_threads = 0;
 
   data = g_new0 (DaemonData, 1);
   data->mountable_name = g_strdup (mountable_name);
@@ -379,10 +395,21 @@ daemon_main (int argc,
       
       g_vfs_register_backend (backend_type, type);
 
+      /* The backends know best how many jobs they can run at once, so they
+       * override the build setting. The most restrictive one wins if the
+       * daemon handles several backends. */
+      backend_threads = backend_max_job_threads (backend_type);
+      if (backend_threads > 0 &&
+          (max_backend_threads == 0 || backend_threads < max_backend_threads))
+        max_backend_threads = backend_threads;
+
       type = va_arg (var_args, char *);
     }
   va_end (var_args);
 
+  if (max_backend_threads > 0)
+    data->max_job_threads = max_backend_threads;
+
   loop = g_main_loop_new (NULL, FALSE);
   
   name_owner_id = 0;
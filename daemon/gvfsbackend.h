@@ -89,6 +89,19 @@ struct _GVfsBackendClass
 {
   GObjectClass parent_class;
 
+  /* Maximum number of jobs the backend can run in parallel in the worker
+   * threads, 0 to keep the default of the daemon. Set this to 1 if the
+   * backend can't handle concurrent blocking calls, e.g. when it uses a
+   * single connection.
+   */
+  int max_job_threads;
+
+  /* Number of blocks read ahead of the client when it streams a file,
+   * 0 for the default of 1. The backend reads the next block while the
+   * previous ones are sent, which helps with high latency connections.
+   */
+  int read_pipeline_depth;
+
   /* vtable */
 
   /* These try_ calls should be fast and non-blocking, scheduling the i/o
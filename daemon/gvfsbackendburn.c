@@ -37,6 +37,7 @@
 #include <glib/gi18n.h>
 #include <gio/gio.h>
 #include <gio/gunixmounts.h>
+#include <gio/gfiledescriptorbased.h>
 
 #include "gvfsbackendburn.h"
 #include "gvfsmonitor.h"
@@ -466,6 +467,9 @@ try_open_for_read (GVfsBackend *backend,
     {
       g_vfs_job_open_for_read_set_can_seek (job, g_seekable_can_seek (G_SEEKABLE (stream)));
       g_vfs_job_open_for_read_set_handle (job, stream);
+      if (G_IS_FILE_DESCRIPTOR_BASED (stream))
+        g_vfs_job_open_for_read_set_direct_fd (job,
+          g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (stream)));
       g_vfs_job_succeeded (G_VFS_JOB (job));
     }
   else
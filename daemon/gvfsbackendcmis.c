@@ -21,10 +21,13 @@
  * Author: Cédric Bosdonnat <cbosdonnat@suse.com>
  */
 
+#include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
+#include <gio/gfiledescriptorbased.h>
 
 #include <libcmis-c/document.h>
 #include <libcmis-c/error.h>
@@ -43,28 +46,50 @@
 #include "gvfsbackendcmis.h"
 #include "gvfskeyring.h"
 #include "gvfsjobenumerate.h"
+#include "gvfsjobopenforread.h"
+#include "gvfsjobread.h"
+#include "gvfsjobseekread.h"
+#include "gvfsjobopenforwrite.h"
+#include "gvfsjobwrite.h"
+#include "gvfsjobseekwrite.h"
+#include "gvfsjobclosewrite.h"
+#include "gvfsjobsetdisplayname.h"
+#include "gvfsjobqueryattributes.h"
 
 G_DEFINE_TYPE (GVfsBackendCmis, g_vfs_backend_cmis, G_VFS_TYPE_BACKEND)
 
-/** Internal structure to pass a temporary file and it's stream for
-    read/write operations.
+/** Internal structure spooling the written content into a temporary file
+    until it is uploaded when closing.
  */
 struct TmpHandle
 {
     GFile *file;
     GFileIOStream *stream;
     char *filename;
+    /* Id of the document to overwrite, or NULL if it needs to be created */
+    char *object_id;
 };
 
+static GIOErrorEnum
+cmis_error_to_io_error (const char *error_type)
+{
+    if (g_strcmp0 (error_type, "permissionDenied") == 0)
+        return G_IO_ERROR_PERMISSION_DENIED;
+    if (g_strcmp0 (error_type, "objectNotFound") == 0)
+        return G_IO_ERROR_NOT_FOUND;
+    if (g_strcmp0 (error_type, "nameConstraintViolation") == 0 ||
+        g_strcmp0 (error_type, "contentAlreadyExists") == 0)
+        return G_IO_ERROR_EXISTS;
+    return G_IO_ERROR_FAILED;
+}
+
 static void
 output_cmis_error (GVfsJob *job, libcmis_ErrorPtr error)
 {
     const char* error_type = libcmis_error_getType (error);
-    /* TODO Handle NotFound errors */
-    g_vfs_job_failed (job, G_IO_ERROR,
-                         strcmp (error_type, "permissionDenied") == 0 ?
-                            G_IO_ERROR_PERMISSION_DENIED : G_IO_ERROR_FAILED,
-                         libcmis_error_getMessage (error) );
+    g_vfs_job_failed_literal (job, G_IO_ERROR,
+                              cmis_error_to_io_error (error_type),
+                              libcmis_error_getMessage (error));
 }
 
 static void
@@ -102,123 +127,70 @@ repository_to_file_info (libcmis_RepositoryPtr repository,
     g_free (name);
 }
 
+/** Whether the matcher wants any attribute of the ns namespace.
+    A NULL matcher wants everything.
+  */
+static gboolean
+matcher_wants_namespace (GFileAttributeMatcher *matcher,
+                         const char *ns)
+{
+    if (matcher == NULL)
+        return TRUE;
+    return g_file_attribute_matcher_enumerate_namespace (matcher, ns) ||
+           g_file_attribute_matcher_enumerate_next (matcher) != NULL;
+}
+
+static gboolean
+matcher_wants (GFileAttributeMatcher *matcher,
+               const char *attribute)
+{
+    return matcher == NULL || g_file_attribute_matcher_matches (matcher, attribute);
+}
+
 static void
-cmis_object_to_file_info (libcmis_ObjectPtr object,
-                          GFileInfo *info)
+set_access_attributes (libcmis_ObjectPtr object,
+                       libcmis_ObjectAction read_action,
+                       libcmis_ObjectAction write_action,
+                       GFileInfo *info)
 {
-    char *id;
-    char *name;
-    char *content_type;
-    bool is_folder;
-    bool is_document;
-    GIcon *icon = NULL;
-    GIcon *symbolic_icon = NULL;
-    time_t mod_time;
-    time_t create_time;
-    libcmis_vector_property_Ptr plist;
     libcmis_AllowableActionsPtr allowable_actions;
     bool can_read;
     bool can_write;
     bool can_delete;
     bool can_rename;
-    int i;
-
-    id = libcmis_object_getId (object);
-    name = libcmis_object_getName (object);
-    g_file_info_set_name (info, name);
-    g_file_info_set_display_name (info, name);
-
-    create_time = libcmis_object_getCreationDate (object);
-    g_file_info_set_attribute_uint64 (info,
-                                      G_FILE_ATTRIBUTE_TIME_CREATED,
-                                      create_time);
-    mod_time = libcmis_object_getLastModificationDate (object);
-    g_file_info_set_attribute_uint64 (info,
-                                      G_FILE_ATTRIBUTE_TIME_MODIFIED,
-                                      mod_time);
-
-    /* Don't assume not being a folder means we have a document
-     * as this is no longer true with CMIS v1.1 */
-    is_folder = libcmis_is_folder (object);
-    is_document = libcmis_is_document (object);
 
-    if (is_folder)
-    {
-        content_type = g_strdup ("inode/directory");
-        icon = g_themed_icon_new ("folder");
-        symbolic_icon = g_themed_icon_new ("folder-symbolic");
-        g_file_info_set_file_type (info, G_FILE_TYPE_DIRECTORY);
+    /* Set the permissions based on the Allowable Actions*/
+    allowable_actions = libcmis_object_getAllowableActions (object);
+    can_read = libcmis_allowable_actions_isAllowed (allowable_actions, read_action);
+    can_write = libcmis_allowable_actions_isAllowed (allowable_actions, write_action);
+    can_delete = libcmis_allowable_actions_isAllowed (allowable_actions, libcmis_DeleteObject);
+    can_rename = libcmis_allowable_actions_isAllowed (allowable_actions, libcmis_UpdateProperties);
 
-	/* Set the permissions based on the Allowable Actions*/
-	allowable_actions = libcmis_object_getAllowableActions (object);
-	can_read = libcmis_allowable_actions_isAllowed (allowable_actions, libcmis_GetChildren);
-	can_write = libcmis_allowable_actions_isAllowed (allowable_actions, libcmis_CreateDocument);
-	can_delete = libcmis_allowable_actions_isAllowed (allowable_actions, libcmis_DeleteObject);
-	can_rename = libcmis_allowable_actions_isAllowed (allowable_actions, libcmis_UpdateProperties);
-
-	if (libcmis_allowable_actions_isDefined (allowable_actions, libcmis_GetContentStream)) {
-	  g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_READ, can_read);
-	  g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_RENAME, can_rename);
-	}
-	if (libcmis_allowable_actions_isDefined (allowable_actions, libcmis_SetContentStream))
-	  g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE, can_write);
-	if (libcmis_allowable_actions_isDefined (allowable_actions, libcmis_DeleteObject)) {
-	  g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_DELETE, can_delete);
-	  g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_TRASH, can_delete);
-	}
-	libcmis_allowable_actions_free (allowable_actions);
+    if (libcmis_allowable_actions_isDefined (allowable_actions, libcmis_GetContentStream)) {
+      g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_READ, can_read);
+      g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_RENAME, can_rename);
     }
-    else if (is_document)
-    {
-        libcmis_DocumentPtr document;
-        long content_size = 0;
-
-        g_file_info_set_file_type (info, G_FILE_TYPE_REGULAR);
-
-        document = libcmis_document_cast (object);
-        content_type = libcmis_document_getContentType (document);
-
-        icon = g_content_type_get_icon (content_type);
-        if (icon == NULL)
-            icon = g_themed_icon_new ("text-x-generic");
-
-        symbolic_icon = g_content_type_get_symbolic_icon (content_type);
-        if (symbolic_icon == NULL)
-            symbolic_icon = g_themed_icon_new ("text-x-generic-symbolic");
-
-        content_size = libcmis_document_getContentLength (document);
-        g_file_info_set_size (info, content_size);
-
-	/* Set the permissions based on the Allowable Actions*/
-	allowable_actions = libcmis_object_getAllowableActions (object);
-	can_read = libcmis_allowable_actions_isAllowed (allowable_actions, libcmis_GetContentStream);
-	can_write = libcmis_allowable_actions_isAllowed (allowable_actions, libcmis_SetContentStream);
-	can_delete = libcmis_allowable_actions_isAllowed (allowable_actions, libcmis_DeleteObject);
-	can_rename = libcmis_allowable_actions_isAllowed (allowable_actions, libcmis_UpdateProperties);
-
-	if (libcmis_allowable_actions_isDefined (allowable_actions, libcmis_GetContentStream)) {
-	  g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_READ, can_read);
-	  g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_RENAME, can_rename);
-	}
-	if (libcmis_allowable_actions_isDefined (allowable_actions, libcmis_SetContentStream))
-	  g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE, can_write);
-	if (libcmis_allowable_actions_isDefined (allowable_actions, libcmis_DeleteObject)) {
-	  g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_DELETE, can_delete);
-	  g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_TRASH, can_delete);
-	}
-	libcmis_allowable_actions_free (allowable_actions);
+    if (libcmis_allowable_actions_isDefined (allowable_actions, libcmis_SetContentStream))
+      g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE, can_write);
+    if (libcmis_allowable_actions_isDefined (allowable_actions, libcmis_DeleteObject)) {
+      g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_DELETE, can_delete);
+      g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_TRASH, can_delete);
     }
-   
-    g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE, id);
+    libcmis_allowable_actions_free (allowable_actions);
+}
 
-    g_file_info_set_content_type (info, content_type);
-    g_file_info_set_icon (info, icon);
-    g_file_info_set_symbolic_icon (info, symbolic_icon);
+/* Insert raw metadata into the object so others can get it. */
+static void
+set_cmis_attributes (libcmis_ObjectPtr object,
+                     GFileInfo *info)
+{
+    libcmis_vector_property_Ptr plist;
+    size_t count;
+    size_t i;
 
-    /* Insert raw metadata into the object so others can get it. */
-    
     plist = libcmis_object_getProperties(object);
-    for (i = 0; libcmis_vector_property_get(plist, i); i++) {
+    count = libcmis_vector_property_size (plist);
+    for (i = 0; i < count; i++) {
       libcmis_vector_string_Ptr vs;
       libcmis_vector_bool_Ptr vb;
       libcmis_vector_long_Ptr vl;
@@ -226,10 +198,16 @@ cmis_object_to_file_info (libcmis_ObjectPtr object,
       libcmis_vector_time_Ptr vt;
 
       gchar *nt;
+      char *property_id;
 
       libcmis_PropertyPtr p = libcmis_vector_property_get(plist, i);
       libcmis_PropertyTypePtr ptype = libcmis_property_getPropertyType(p);
-      gchar *title =  g_strdup_printf ("cmis::%s", g_strdup(libcmis_property_type_getId(ptype)));
+      gchar *title;
+
+      property_id = libcmis_property_type_getId(ptype);
+      title = g_strdup_printf ("cmis::%s", property_id);
+      g_free (property_id);
+
       switch (libcmis_property_type_getType(ptype)) {
       case libcmis_String:
 	vs = libcmis_property_getStrings(p);
@@ -280,14 +258,126 @@ cmis_object_to_file_info (libcmis_ObjectPtr object,
 	break;
       }
 
+      g_free (title);
+      libcmis_property_type_free (ptype);
+      libcmis_property_free (p);
+    }
+    libcmis_vector_property_free (plist);
+}
+
+/** Convert a CMIS object into a GFileInfo.
+
+    Only the attributes wanted by the matcher are converted when they are
+    expensive to compute: the allowable actions, the icons and the raw CMIS
+    properties. A NULL matcher converts everything.
+  */
+static void
+cmis_object_to_file_info (libcmis_ObjectPtr object,
+                          GFileAttributeMatcher *matcher,
+                          GFileInfo *info)
+{
+    char *id;
+    char *name;
+    char *content_type = NULL;
+    char *change_token;
+    bool is_folder;
+    bool is_document;
+    GIcon *icon = NULL;
+    GIcon *symbolic_icon = NULL;
+    time_t mod_time;
+    time_t create_time;
+    gboolean want_icons;
+    gboolean want_access;
+
+    id = libcmis_object_getId (object);
+    name = libcmis_object_getName (object);
+    g_file_info_set_name (info, name);
+    g_file_info_set_display_name (info, name);
+
+    create_time = libcmis_object_getCreationDate (object);
+    g_file_info_set_attribute_uint64 (info,
+                                      G_FILE_ATTRIBUTE_TIME_CREATED,
+                                      create_time);
+    mod_time = libcmis_object_getLastModificationDate (object);
+    g_file_info_set_attribute_uint64 (info,
+                                      G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                      mod_time);
+
+    want_icons = matcher_wants (matcher, G_FILE_ATTRIBUTE_STANDARD_ICON) ||
+                 matcher_wants (matcher, G_FILE_ATTRIBUTE_STANDARD_SYMBOLIC_ICON);
+    want_access = matcher_wants_namespace (matcher, "access");
+
+    /* Don't assume not being a folder means we have a document
+     * as this is no longer true with CMIS v1.1 */
+    is_folder = libcmis_is_folder (object);
+    is_document = libcmis_is_document (object);
+
+    if (is_folder)
+    {
+        content_type = g_strdup ("inode/directory");
+        if (want_icons)
+        {
+            icon = g_themed_icon_new ("folder");
+            symbolic_icon = g_themed_icon_new ("folder-symbolic");
+        }
+        g_file_info_set_file_type (info, G_FILE_TYPE_DIRECTORY);
+
+        if (want_access)
+            set_access_attributes (object, libcmis_GetChildren, libcmis_CreateDocument, info);
+    }
+    else if (is_document)
+    {
+        libcmis_DocumentPtr document;
+        long content_size = 0;
+
+        g_file_info_set_file_type (info, G_FILE_TYPE_REGULAR);
+
+        document = libcmis_document_cast (object);
+        content_type = libcmis_document_getContentType (document);
+
+        if (want_icons)
+        {
+            icon = g_content_type_get_icon (content_type);
+            if (icon == NULL)
+                icon = g_themed_icon_new ("text-x-generic");
+
+            symbolic_icon = g_content_type_get_symbolic_icon (content_type);
+            if (symbolic_icon == NULL)
+                symbolic_icon = g_themed_icon_new ("text-x-generic-symbolic");
+        }
+
+        content_size = libcmis_document_getContentLength (document);
+        g_file_info_set_size (info, content_size);
+
+        if (want_access)
+            set_access_attributes (object, libcmis_GetContentStream, libcmis_SetContentStream, info);
     }
+   
+    g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE, id);
+
+    change_token = libcmis_object_getChangeToken (object);
+    if (change_token != NULL)
+        g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_ETAG_VALUE, change_token);
+    g_free (change_token);
+
+    if (content_type)
+        g_file_info_set_content_type (info, content_type);
+    if (icon)
+        g_file_info_set_icon (info, icon);
+    if (symbolic_icon)
+        g_file_info_set_symbolic_icon (info, symbolic_icon);
+
+    if (matcher_wants_namespace (matcher, "cmis"))
+        set_cmis_attributes (object, info);
 
     /* Cleanup */
     g_free (id);
     g_free (name);
     g_free (content_type);
-    g_object_unref (icon);
-    g_object_unref (symbolic_icon);
+    if (icon)
+        g_object_unref (icon);
+    if (symbolic_icon)
+        g_object_unref (symbolic_icon);
 }
 
 static gchar*
@@ -323,130 +413,1013 @@ extract_repository_from_path (const char* path,
     return repository_id;
 }
 
-static bool
-is_cmis_session_ready (GVfsBackendCmis *backend, GVfsJob *job)
+/* Default number of seconds object infos are kept in the cache. This can be
+ * changed using the GVFS_CMIS_CACHE_TTL environment variable, 0 disables the
+ * cache. */
+#define CMIS_CACHE_DEFAULT_TTL 30
+
+/* Bounds of the number of cached infos and listings. Expired ones are
+ * dropped when reaching them, and everything if that isn't enough. */
+#define CMIS_CACHE_MAX_ENTRIES 8192
+#define CMIS_CACHE_MAX_LISTINGS 256
+
+typedef struct
 {
-    bool success = true;
-    if (backend->session == NULL)
-    {
-        g_vfs_job_failed (job, G_IO_ERROR,
-                             G_IO_ERROR_NOT_MOUNTED,
-                       _("CMIS session not initialized"));
-        success = false;
-    }
-    return success;
-}
+    GFileInfo *info;
+    /* Attributes converted into info, NULL for all of them */
+    GFileAttributeMatcher *matcher;
+    gint64 stamp;
+} CmisCacheEntry;
 
-/** Get the CMIS object using its path. The root path is handled as a folder, not as a repository.
+static void
+cache_entry_free (gpointer data)
+{
+    CmisCacheEntry *entry = data;
 
-    This function will set errors on the job if needed.
+    g_object_unref (entry->info);
+    if (entry->matcher)
+        g_file_attribute_matcher_unref (entry->matcher);
+    g_free (entry);
+}
 
-    \return
-        the CMIS object or NULL. The resulting object needs to be freed using libcmis_object_free().
+/** Whether the entry is recent enough and has all the attributes wanted
+    by matcher. Needs to be called with cache_lock held.
   */
-libcmis_ObjectPtr get_cmis_object (GVfsJob *job,
-                                   libcmis_SessionPtr session,
-                                   const char *repository_id,
-                                   const char *path)
+static gboolean
+cache_entry_is_valid (GVfsBackendCmis *cmis_backend,
+                      CmisCacheEntry *entry,
+                      GFileAttributeMatcher *matcher,
+                      gint64 now)
 {
-    libcmis_ObjectPtr object = NULL;
+    GFileAttributeMatcher *missing;
 
-    if (libcmis_session_setRepository (session, repository_id))
-    {
-        if (path && strlen(path) > 0)
-        {
-            libcmis_ErrorPtr error;
+    if (now - entry->stamp >= cmis_backend->cache_ttl)
+        return FALSE;
 
-            error = libcmis_error_create ();
-            object = libcmis_session_getObjectByPath (session, path, error);
+    if (entry->matcher == NULL)
+        return TRUE;
+    if (matcher == NULL)
+        return FALSE;
 
-            if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
-                output_cmis_error (job, error);
+    missing = g_file_attribute_matcher_subtract (matcher, entry->matcher);
+    if (missing == NULL)
+        return TRUE;
 
-            libcmis_error_free (error);
-        }
-    }
-    else
-    {
-        char *message;
-        message = g_strdup_printf (_("No such repository: %s"), repository_id);
-        g_vfs_job_failed (job, G_IO_ERROR,
-                          G_IO_ERROR_NOT_FOUND,
-                          message );
-        g_free (message);
-    }
-    return object;
+    g_file_attribute_matcher_unref (missing);
+    return FALSE;
 }
 
-size_t write_to_io_stream (const void* ptr, size_t size, size_t nmemb, void* data)
+static gboolean
+cache_entry_is_expired (gpointer key, gpointer value, gpointer user_data)
 {
-    size_t read = 0;
-    GFileIOStream *stream = (GFileIOStream*) data;
-    GOutputStream *out_stream;
-    gsize bytes_written = 0;
+    CmisCacheEntry *entry = value;
+    GVfsBackendCmis *cmis_backend = user_data;
 
-    out_stream = g_io_stream_get_output_stream (G_IO_STREAM (stream));
-    g_output_stream_write_all (out_stream, ptr,
-            size * nmemb, &bytes_written, NULL, NULL);
+    return g_get_monotonic_time () - entry->stamp >= cmis_backend->cache_ttl;
+}
 
-    read = bytes_written / size;
+/** Make room for one more item in table. Needs to be called with
+    cache_lock held.
+  */
+static void
+cache_make_room (GVfsBackendCmis *cmis_backend,
+                 GHashTable *table,
+                 GHRFunc is_expired,
+                 guint max_size)
+{
+    if (g_hash_table_size (table) < max_size)
+        return;
 
-    return read;
+    g_hash_table_foreach_remove (table, is_expired, cmis_backend);
+
+    /* Leave room for a good number of insertions before coming back */
+    if (g_hash_table_size (table) >= max_size / 4 * 3)
+        g_hash_table_remove_all (table);
 }
 
-size_t write_to_g_output_stream (const void* ptr, size_t size, size_t nmemb, void* data)
+/** Add info to the cache, matcher being the one used to create it. */
+static void
+cache_insert (GVfsBackendCmis *cmis_backend,
+              const char *filename,
+              GFileAttributeMatcher *matcher,
+              GFileInfo *info)
 {
-    size_t read = 0;
-    GOutputStream *out_stream = (GOutputStream*) data;
-    gsize bytes_written = 0;
+    CmisCacheEntry *entry;
 
-    g_output_stream_write_all (out_stream, ptr,
-            size * nmemb, &bytes_written, NULL, NULL);
+    if (cmis_backend->cache_ttl == 0)
+        return;
 
-    read = bytes_written / size;
+    entry = g_new (CmisCacheEntry, 1);
+    entry->info = g_file_info_dup (info);
+    entry->matcher = matcher ? g_file_attribute_matcher_ref (matcher) : NULL;
+    entry->stamp = g_get_monotonic_time ();
 
-    return read;
+    g_mutex_lock (&cmis_backend->cache_lock);
+    cache_make_room (cmis_backend, cmis_backend->cache,
+                     cache_entry_is_expired, CMIS_CACHE_MAX_ENTRIES);
+    g_hash_table_replace (cmis_backend->cache, g_strdup (filename), entry);
+    g_mutex_unlock (&cmis_backend->cache_lock);
+}
+
+/** Fill info with the cached infos of filename.
+
+    \return
+        FALSE if there is no fresh enough entry for filename providing the
+        attributes wanted by matcher.
+  */
+static gboolean
+cache_lookup (GVfsBackendCmis *cmis_backend,
+              const char *filename,
+              GFileAttributeMatcher *matcher,
+              GFileInfo *info)
+{
+    CmisCacheEntry *entry;
+    gboolean found = FALSE;
+
+    g_mutex_lock (&cmis_backend->cache_lock);
+    entry = g_hash_table_lookup (cmis_backend->cache, filename);
+    if (entry != NULL &&
+        cache_entry_is_valid (cmis_backend, entry, matcher, g_get_monotonic_time ()))
+    {
+        g_file_info_copy_into (entry->info, info);
+        found = TRUE;
+    }
+    else if (entry != NULL &&
+             cache_entry_is_expired (NULL, entry, cmis_backend))
+        g_hash_table_remove (cmis_backend->cache, filename);
+    g_mutex_unlock (&cmis_backend->cache_lock);
+
+    return found;
 }
 
+typedef struct
+{
+    GPtrArray *names;
+    gint64 stamp;
+} CmisCacheListing;
+
 static void
-do_mount (GVfsBackend *backend,
-          GVfsJobMount *job,
-          GMountSpec *mount_spec,
-          GMountSource *mount_source,
-          gboolean is_automount)
+cache_listing_free (gpointer data)
 {
-    char *spec_str;
-    const char *host;
-    const char *user;
-    char* username = NULL;
-    char *binding_url = NULL;
-    char *password = NULL;
-    gboolean failed = FALSE;
-    GPasswordSave password_save = G_PASSWORD_SAVE_NEVER;
-    char *prompt = NULL;
-    GDecodedUri *decoded = NULL;
+    CmisCacheListing *listing = data;
 
-    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+    g_ptr_array_unref (listing->names);
+    g_free (listing);
+}
 
-    spec_str = g_mount_spec_to_string (mount_spec);
-    g_print ("mount_spec: %s\n", spec_str);
-    g_free (spec_str);
+static gboolean
+cache_listing_is_expired (gpointer key, gpointer value, gpointer user_data)
+{
+    CmisCacheListing *listing = value;
+    GVfsBackendCmis *cmis_backend = user_data;
 
-    /* In CMIS urls, the host is the url-encoded binding URL */
-    host = g_mount_spec_get (mount_spec, "host");
+    return g_get_monotonic_time () - listing->stamp >= cmis_backend->cache_ttl;
+}
 
-    if (host == NULL || *host == 0)
+/** Remember the names of the children of dirname, the infos of which have
+    been put in the cache too. The cache takes ownership of names.
+  */
+static void
+cache_insert_listing (GVfsBackendCmis *cmis_backend,
+                      const char *dirname,
+                      GPtrArray *names)
+{
+    CmisCacheListing *listing;
+
+    if (cmis_backend->cache_ttl == 0)
     {
-        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
-                          G_IO_ERROR_INVALID_ARGUMENT,
-                          _("Invalid mount spec"));
+        g_ptr_array_unref (names);
         return;
     }
-    binding_url = g_uri_unescape_string (host, NULL);
 
-    /* Get the hostname from the binding_url as display host */
-    decoded = g_vfs_decode_uri (binding_url);
-    if (decoded && decoded->host)
+    listing = g_new (CmisCacheListing, 1);
+    listing->names = names;
+    listing->stamp = g_get_monotonic_time ();
+
+    g_mutex_lock (&cmis_backend->cache_lock);
+    cache_make_room (cmis_backend, cmis_backend->listings,
+                     cache_listing_is_expired, CMIS_CACHE_MAX_LISTINGS);
+    g_hash_table_replace (cmis_backend->listings, g_strdup (dirname), listing);
+    g_mutex_unlock (&cmis_backend->cache_lock);
+}
+
+/** Get copies of the infos of all the children of dirname.
+
+    \return
+        FALSE if the listing or any of the children infos isn't in the cache
+        or is too old.
+  */
+static gboolean
+cache_lookup_listing (GVfsBackendCmis *cmis_backend,
+                      const char *dirname,
+                      GFileAttributeMatcher *matcher,
+                      GList **infos)
+{
+    CmisCacheListing *listing;
+    GList *result = NULL;
+    gint64 now;
+    guint i;
+
+    now = g_get_monotonic_time ();
+
+    g_mutex_lock (&cmis_backend->cache_lock);
+    listing = g_hash_table_lookup (cmis_backend->listings, dirname);
+    if (listing == NULL || now - listing->stamp >= cmis_backend->cache_ttl)
+    {
+        if (listing != NULL)
+            g_hash_table_remove (cmis_backend->listings, dirname);
+        g_mutex_unlock (&cmis_backend->cache_lock);
+        return FALSE;
+    }
+
+    for (i = 0; i < listing->names->len; i++)
+    {
+        CmisCacheEntry *entry;
+        char *child_filename;
+
+        child_filename = g_build_path ("/", dirname, g_ptr_array_index (listing->names, i), NULL);
+        entry = g_hash_table_lookup (cmis_backend->cache, child_filename);
+        g_free (child_filename);
+
+        if (entry == NULL || !cache_entry_is_valid (cmis_backend, entry, matcher, now))
+        {
+            g_mutex_unlock (&cmis_backend->cache_lock);
+            g_list_free_full (result, g_object_unref);
+            return FALSE;
+        }
+        result = g_list_prepend (result, g_file_info_dup (entry->info));
+    }
+    g_mutex_unlock (&cmis_backend->cache_lock);
+
+    *infos = g_list_reverse (result);
+    return TRUE;
+}
+
+static gboolean
+cache_is_below (gpointer key, gpointer value, gpointer user_data)
+{
+    const char *path = key;
+    const char *prefix = user_data;
+    gsize len = strlen (prefix);
+
+    return strncmp (path, prefix, len) == 0 &&
+           (path[len] == '\0' || path[len] == '/');
+}
+
+/** Forget about filename, its children and its parent folder, which
+    modification date changes with its content.
+  */
+static void
+cache_invalidate (GVfsBackendCmis *cmis_backend,
+                  const char *filename)
+{
+    char *parent;
+
+    parent = g_path_get_dirname (filename);
+
+    g_mutex_lock (&cmis_backend->cache_lock);
+    g_hash_table_foreach_remove (cmis_backend->cache, cache_is_below, (gpointer) filename);
+    g_hash_table_foreach_remove (cmis_backend->listings, cache_is_below, (gpointer) filename);
+    g_hash_table_remove (cmis_backend->cache, parent);
+    g_hash_table_remove (cmis_backend->listings, parent);
+    g_mutex_unlock (&cmis_backend->cache_lock);
+
+    g_free (parent);
+}
+
+/* Maximum number of sessions opened on the server for a mount, and thus of
+ * operations running on it in parallel. Sessions used by downloads running
+ * in the background are counted against CMIS_MAX_DOWNLOADS instead. */
+#define CMIS_MAX_SESSIONS 10
+
+/* Maximum number of documents downloaded in the background for files opened
+ * for reading. Opening more waits for one of them to be done. */
+#define CMIS_MAX_DOWNLOADS 4
+
+/* Seconds a job waits for a session before giving up */
+#define CMIS_SESSION_TIMEOUT 60
+
+static void
+pool_cancelled (GCancellable *cancellable, gpointer data)
+{
+    GVfsBackendCmis *cmis_backend = data;
+
+    g_mutex_lock (&cmis_backend->pool_lock);
+    g_cond_broadcast (&cmis_backend->pool_cond);
+    g_mutex_unlock (&cmis_backend->pool_lock);
+}
+
+/** Check a session out of the pool.
+
+    libcmis sessions can't be used by several threads at the same time, so
+    each job gets its own session. A new session is opened if all of them are
+    busy, otherwise this waits for one to be released, until the job gets
+    cancelled or CMIS_SESSION_TIMEOUT is over.
+
+    This function will set errors on the job if needed.
+
+    \return
+        the session or NULL. It has to be given back using release_session().
+  */
+static libcmis_SessionPtr
+acquire_session (GVfsBackendCmis *cmis_backend, GVfsJob *job)
+{
+    libcmis_SessionPtr session;
+    libcmis_ErrorPtr error;
+    gulong cancel_id = 0;
+    gint64 end_time;
+    gboolean mounted;
+    gboolean reserved = FALSE;
+
+    if (job->cancellable)
+        cancel_id = g_cancellable_connect (job->cancellable,
+                                           G_CALLBACK (pool_cancelled),
+                                           cmis_backend, NULL);
+
+    end_time = g_get_monotonic_time () + CMIS_SESSION_TIMEOUT * G_TIME_SPAN_SECOND;
+
+    g_mutex_lock (&cmis_backend->pool_lock);
+    while (cmis_backend->mounted &&
+           g_queue_is_empty (&cmis_backend->idle_sessions) &&
+           cmis_backend->n_sessions - cmis_backend->n_streaming >= CMIS_MAX_SESSIONS &&
+           !g_cancellable_is_cancelled (job->cancellable))
+    {
+        if (!g_cond_wait_until (&cmis_backend->pool_cond, &cmis_backend->pool_lock, end_time))
+            break;
+    }
+
+    mounted = cmis_backend->mounted;
+    session = mounted ? g_queue_pop_head (&cmis_backend->idle_sessions) : NULL;
+    if (session == NULL && mounted &&
+        !g_cancellable_is_cancelled (job->cancellable) &&
+        cmis_backend->n_sessions - cmis_backend->n_streaming < CMIS_MAX_SESSIONS)
+    {
+        /* Reserve the slot, but don't keep the lock while authenticating */
+        cmis_backend->n_sessions++;
+        reserved = TRUE;
+    }
+    g_mutex_unlock (&cmis_backend->pool_lock);
+
+    if (cancel_id)
+        g_cancellable_disconnect (job->cancellable, cancel_id);
+
+    if (session != NULL)
+        return session;
+
+    if (!reserved)
+    {
+        if (!mounted)
+            g_vfs_job_failed (job, G_IO_ERROR,
+                                 G_IO_ERROR_NOT_MOUNTED,
+                           _("CMIS session not initialized"));
+        else if (g_cancellable_is_cancelled (job->cancellable))
+            g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                              _("Operation was cancelled"));
+        else
+            g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_BUSY,
+                              _("Too many operations running on the server"));
+        return NULL;
+    }
+
+    error = libcmis_error_create ();
+    session = libcmis_createSession (cmis_backend->binding_url,
+            NULL, cmis_backend->username, cmis_backend->password, false, NULL, false, error);
+
+    if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
+    {
+        output_cmis_error (job, error);
+        if (session)
+            libcmis_session_free (session);
+        session = NULL;
+    }
+    else if (session == NULL)
+    {
+        g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_FAILED,
+                          _("Failed to open a CMIS session"));
+    }
+    libcmis_error_free (error);
+
+    if (session == NULL)
+    {
+        g_mutex_lock (&cmis_backend->pool_lock);
+        cmis_backend->n_sessions--;
+        g_cond_broadcast (&cmis_backend->pool_cond);
+        g_mutex_unlock (&cmis_backend->pool_lock);
+    }
+
+    return session;
+}
+
+/** Give a session back to the pool, closing it if unmounted meanwhile or if
+    there are more of them than needed now.
+  */
+static void
+release_session (GVfsBackendCmis *cmis_backend, libcmis_SessionPtr session)
+{
+    g_mutex_lock (&cmis_backend->pool_lock);
+    if (cmis_backend->mounted &&
+        cmis_backend->n_sessions - cmis_backend->n_streaming <= CMIS_MAX_SESSIONS)
+        g_queue_push_head (&cmis_backend->idle_sessions, session);
+    else
+    {
+        libcmis_session_free (session);
+        cmis_backend->n_sessions--;
+    }
+    g_cond_broadcast (&cmis_backend->pool_cond);
+    g_mutex_unlock (&cmis_backend->pool_lock);
+}
+
+/** Reserve one of the CMIS_MAX_DOWNLOADS background downloads, waiting for
+    a running one to be over like acquire_session() waits for a session.
+
+    This function will set errors on the job if needed.
+
+    \return
+        FALSE if no download can be started. Otherwise the reservation has to
+        be given back using cancel_download() or release_streaming_session().
+  */
+static gboolean
+reserve_download (GVfsBackendCmis *cmis_backend, GVfsJob *job)
+{
+    gulong cancel_id = 0;
+    gint64 end_time;
+    gboolean mounted;
+    gboolean reserved = FALSE;
+
+    if (job->cancellable)
+        cancel_id = g_cancellable_connect (job->cancellable,
+                                           G_CALLBACK (pool_cancelled),
+                                           cmis_backend, NULL);
+
+    end_time = g_get_monotonic_time () + CMIS_SESSION_TIMEOUT * G_TIME_SPAN_SECOND;
+
+    g_mutex_lock (&cmis_backend->pool_lock);
+    while (cmis_backend->mounted &&
+           cmis_backend->n_downloads >= CMIS_MAX_DOWNLOADS &&
+           !g_cancellable_is_cancelled (job->cancellable))
+    {
+        if (!g_cond_wait_until (&cmis_backend->pool_cond, &cmis_backend->pool_lock, end_time))
+            break;
+    }
+
+    mounted = cmis_backend->mounted;
+    if (mounted && !g_cancellable_is_cancelled (job->cancellable) &&
+        cmis_backend->n_downloads < CMIS_MAX_DOWNLOADS)
+    {
+        cmis_backend->n_downloads++;
+        reserved = TRUE;
+    }
+    g_mutex_unlock (&cmis_backend->pool_lock);
+
+    if (cancel_id)
+        g_cancellable_disconnect (job->cancellable, cancel_id);
+
+    if (reserved)
+        return TRUE;
+
+    if (!mounted)
+        g_vfs_job_failed (job, G_IO_ERROR,
+                             G_IO_ERROR_NOT_MOUNTED,
+                       _("CMIS session not initialized"));
+    else if (g_cancellable_is_cancelled (job->cancellable))
+        g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                          _("Operation was cancelled"));
+    else
+        g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_BUSY,
+                          _("Too many files being read from the server"));
+    return FALSE;
+}
+
+/** Give back a download reservation that didn't get used. */
+static void
+cancel_download (GVfsBackendCmis *cmis_backend)
+{
+    g_mutex_lock (&cmis_backend->pool_lock);
+    cmis_backend->n_downloads--;
+    g_cond_broadcast (&cmis_backend->pool_cond);
+    g_mutex_unlock (&cmis_backend->pool_lock);
+}
+
+/** Move a checked out session from CMIS_MAX_SESSIONS over to the reserved
+    download: it is going to be used by a download running in the
+    background, which shouldn't keep jobs from getting a session. Give it
+    back using release_streaming_session().
+  */
+static void
+detach_session (GVfsBackendCmis *cmis_backend)
+{
+    g_mutex_lock (&cmis_backend->pool_lock);
+    cmis_backend->n_streaming++;
+    g_cond_broadcast (&cmis_backend->pool_cond);
+    g_mutex_unlock (&cmis_backend->pool_lock);
+}
+
+static void
+release_streaming_session (GVfsBackendCmis *cmis_backend, libcmis_SessionPtr session)
+{
+    g_mutex_lock (&cmis_backend->pool_lock);
+    cmis_backend->n_streaming--;
+    cmis_backend->n_downloads--;
+    /* Wake up both the jobs waiting for a session and the ones waiting for
+     * a download */
+    g_cond_broadcast (&cmis_backend->pool_cond);
+    g_mutex_unlock (&cmis_backend->pool_lock);
+
+    release_session (cmis_backend, session);
+}
+
+/** Close all the idle sessions and make the busy ones close on release. */
+static void
+close_sessions (GVfsBackendCmis *cmis_backend)
+{
+    libcmis_SessionPtr session;
+
+    g_mutex_lock (&cmis_backend->pool_lock);
+    cmis_backend->mounted = FALSE;
+    while ((session = g_queue_pop_head (&cmis_backend->idle_sessions)) != NULL)
+    {
+        libcmis_session_free (session);
+        cmis_backend->n_sessions--;
+    }
+    g_cond_broadcast (&cmis_backend->pool_cond);
+    g_mutex_unlock (&cmis_backend->pool_lock);
+}
+
+/** Get the CMIS object using its path, like get_cmis_object(), but
+    reporting failures in error instead of the job.
+  */
+static libcmis_ObjectPtr
+lookup_cmis_object (libcmis_SessionPtr session,
+                    const char *repository_id,
+                    const char *path,
+                    GError **error)
+{
+    libcmis_ObjectPtr object = NULL;
+
+    if (libcmis_session_setRepository (session, repository_id))
+    {
+        if (path && strlen(path) > 0)
+        {
+            libcmis_ErrorPtr cmis_error;
+
+            cmis_error = libcmis_error_create ();
+            object = libcmis_session_getObjectByPath (session, path, cmis_error);
+
+            if (libcmis_error_getMessage (cmis_error) != NULL || libcmis_error_getType(cmis_error) != NULL)
+                g_set_error_literal (error, G_IO_ERROR,
+                                     cmis_error_to_io_error (libcmis_error_getType (cmis_error)),
+                                     libcmis_error_getMessage (cmis_error));
+            else if (object == NULL)
+                g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                     _("No such file or directory"));
+
+            libcmis_error_free (cmis_error);
+        }
+    }
+    else
+    {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                     _("No such repository: %s"), repository_id);
+    }
+    return object;
+}
+
+/** Get the CMIS object using its path. The root path is handled as a folder, not as a repository.
+
+    This function will set errors on the job if needed.
+
+    \return
+        the CMIS object or NULL. The resulting object needs to be freed using libcmis_object_free().
+  */
+libcmis_ObjectPtr get_cmis_object (GVfsJob *job,
+                                   libcmis_SessionPtr session,
+                                   const char *repository_id,
+                                   const char *path)
+{
+    libcmis_ObjectPtr object;
+    GError *error = NULL;
+
+    object = lookup_cmis_object (session, repository_id, path, &error);
+    if (error != NULL)
+    {
+        g_vfs_job_failed_from_error (job, error);
+        g_error_free (error);
+    }
+    return object;
+}
+
+size_t write_to_g_output_stream (const void* ptr, size_t size, size_t nmemb, void* data)
+{
+    size_t read = 0;
+    GOutputStream *out_stream = (GOutputStream*) data;
+    gsize bytes_written = 0;
+
+    g_output_stream_write_all (out_stream, ptr,
+            size * nmemb, &bytes_written, NULL, NULL);
+
+    read = bytes_written / size;
+
+    return read;
+}
+
+size_t read_from_g_input_stream (void* ptr, size_t size, size_t nmemb, void* data)
+{
+    GInputStream *in_stream = (GInputStream*) data;
+    gsize bytes_read = 0;
+
+    g_input_stream_read_all (in_stream, ptr,
+            size * nmemb, &bytes_read, NULL, NULL);
+
+    return bytes_read / size;
+}
+
+static void
+append_string_property (libcmis_vector_property_Ptr properties,
+                        libcmis_ObjectTypePtr type,
+                        const char *property_id,
+                        const char *value)
+{
+    libcmis_PropertyTypePtr property_type;
+    libcmis_PropertyPtr property;
+    const char *values[] = { value };
+
+    property_type = libcmis_object_type_getPropertyType (type, property_id);
+    if (property_type == NULL)
+        return;
+
+    property = libcmis_property_create (property_type, values, 1);
+    libcmis_vector_property_append (properties, property);
+
+    libcmis_property_free (property);
+    libcmis_property_type_free (property_type);
+}
+
+/** Build the properties needed to create or rename an object.
+
+    \param with_type_id
+        whether to add the cmis:objectTypeId property, needed only for creations.
+    \return
+        the properties or NULL if the type couldn't be found. The result needs
+        to be freed using libcmis_vector_property_free().
+  */
+static libcmis_vector_property_Ptr
+create_name_properties (libcmis_SessionPtr session,
+                        const char *type_id,
+                        const char *name,
+                        bool with_type_id,
+                        libcmis_ErrorPtr error)
+{
+    libcmis_ObjectTypePtr type;
+    libcmis_vector_property_Ptr properties = NULL;
+
+    type = libcmis_session_getType (session, type_id, error);
+    if (type != NULL)
+    {
+        properties = libcmis_vector_property_create ();
+        if (with_type_id)
+            append_string_property (properties, type, "cmis:objectTypeId", type_id);
+        append_string_property (properties, type, "cmis:name", name);
+        libcmis_object_type_free (type);
+    }
+
+    return properties;
+}
+
+/** Handle giving the content of a document to do_read.
+
+    This isn't streaming: libcmis can't fetch a range of the content, and
+    libcmis_document_getContentStream() only calls the write callback once
+    it has buffered the whole document in memory. The first read thus waits
+    for the complete download whatever its size. What the handle buys is
+    that the download doesn't hold a job thread: a producer thread runs
+    libcmis_document_getContentStream() and copies the content to an
+    unlinked spool file, while do_read waits for the data at its position
+    and reads it from there. Seeking never downloads anything again.
+
+    Producers are bounded by CMIS_MAX_DOWNLOADS.
+
+    The handle is shared by the producer and the reading jobs, the last of
+    them to let it go frees it.
+ */
+typedef struct
+{
+    volatile gint ref_count;
+
+    GVfsBackendCmis *backend;
+
+    /* Session and object used by the running producer, which releases them */
+    libcmis_SessionPtr session;
+    libcmis_ObjectPtr object;
+    libcmis_ErrorPtr error;
+    GThread *producer;
+
+    /* Only written by the producer */
+    int spool_fd;
+
+    GMutex lock;
+    GCond cond;
+    /* Bytes of the content written to the spool file */
+    goffset received;
+    gboolean eof;
+    gboolean closed;
+    GError *spool_error;
+
+    /* Offset of the next byte returned by do_read */
+    goffset position;
+    goffset size;
+} CmisReadHandle;
+
+static void
+read_handle_unref (CmisReadHandle *handle)
+{
+    if (!g_atomic_int_dec_and_test (&handle->ref_count))
+        return;
+
+    if (handle->producer)
+        g_thread_unref (handle->producer);
+    if (handle->error)
+        libcmis_error_free (handle->error);
+    g_clear_error (&handle->spool_error);
+    close (handle->spool_fd);
+    g_mutex_clear (&handle->lock);
+    g_cond_clear (&handle->cond);
+    g_object_unref (handle->backend);
+    g_free (handle);
+}
+
+static size_t
+read_handle_push (const void* ptr, size_t size, size_t nmemb, void* data)
+{
+    CmisReadHandle *handle = data;
+    const char *src = ptr;
+    gsize remaining = size * nmemb;
+    goffset offset;
+    GError *error = NULL;
+
+    g_mutex_lock (&handle->lock);
+    /* Nobody is going to read it, ask libcmis to stop */
+    if (handle->closed || handle->spool_error != NULL)
+    {
+        g_mutex_unlock (&handle->lock);
+        return 0;
+    }
+    offset = handle->received;
+    g_mutex_unlock (&handle->lock);
+
+    while (remaining > 0)
+    {
+        gssize written;
+
+        written = pwrite (handle->spool_fd, src, remaining, offset);
+        if (written < 0)
+        {
+            int errsv = errno;
+
+            if (errsv == EINTR)
+                continue;
+
+            g_set_error (&error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                         _("Error writing the document content: %s"),
+                         g_strerror (errsv));
+            break;
+        }
+
+        src += written;
+        offset += written;
+        remaining -= written;
+
+        g_mutex_lock (&handle->lock);
+        handle->received = offset;
+        g_cond_broadcast (&handle->cond);
+        g_mutex_unlock (&handle->lock);
+    }
+
+    if (error != NULL)
+    {
+        g_mutex_lock (&handle->lock);
+        handle->spool_error = error;
+        g_cond_broadcast (&handle->cond);
+        g_mutex_unlock (&handle->lock);
+
+        return 0;
+    }
+
+    return nmemb;
+}
+
+static gpointer
+read_handle_produce (gpointer data)
+{
+    CmisReadHandle *handle = data;
+    libcmis_DocumentPtr document;
+
+    document = libcmis_document_cast (handle->object);
+    libcmis_document_getContentStream (document, read_handle_push, handle, handle->error);
+
+    libcmis_object_free (handle->object);
+    handle->object = NULL;
+    release_streaming_session (handle->backend, handle->session);
+    handle->session = NULL;
+
+    g_mutex_lock (&handle->lock);
+    handle->eof = TRUE;
+    g_cond_broadcast (&handle->cond);
+    g_mutex_unlock (&handle->lock);
+
+    read_handle_unref (handle);
+
+    return NULL;
+}
+
+/** Create the handle and start downloading the content of object.
+
+    The producer takes ownership of the session and object, and gives them
+    back when the download is over.
+  */
+static CmisReadHandle *
+read_handle_new (GVfsBackendCmis *cmis_backend,
+                 libcmis_SessionPtr session,
+                 libcmis_ObjectPtr object,
+                 GError **error)
+{
+    CmisReadHandle *handle;
+    char *spool_name;
+    int fd;
+
+    fd = g_file_open_tmp ("gvfs-cmis-read-XXXXXX", &spool_name, error);
+    if (fd < 0)
+        return NULL;
+
+    /* The data is only reachable through the descriptor from now on */
+    g_unlink (spool_name);
+    g_free (spool_name);
+
+    handle = g_new0 (CmisReadHandle, 1);
+    /* One reference for the jobs, one for the producer */
+    handle->ref_count = 2;
+    handle->backend = g_object_ref (cmis_backend);
+    handle->session = session;
+    handle->object = object;
+    handle->error = libcmis_error_create ();
+    handle->spool_fd = fd;
+    handle->size = libcmis_document_getContentLength (libcmis_document_cast (object));
+    g_mutex_init (&handle->lock);
+    g_cond_init (&handle->cond);
+
+    detach_session (cmis_backend);
+    handle->producer = g_thread_new ("cmis-read", read_handle_produce, handle);
+
+    return handle;
+}
+
+/** Drop the reader's reference. The producer stops copying the content at
+    its next callback. */
+static void
+read_handle_close (CmisReadHandle *handle)
+{
+    g_mutex_lock (&handle->lock);
+    handle->closed = TRUE;
+    g_mutex_unlock (&handle->lock);
+
+    read_handle_unref (handle);
+}
+
+static void
+read_handle_cancelled (GCancellable *cancellable, gpointer data)
+{
+    CmisReadHandle *handle = data;
+
+    g_mutex_lock (&handle->lock);
+    g_cond_broadcast (&handle->cond);
+    g_mutex_unlock (&handle->lock);
+}
+
+/** Read up to count bytes at the read position.
+
+    Blocks until the content at the position has been downloaded, the
+    download ended or the job got cancelled.
+
+    This function will set errors on the job if needed.
+
+    \return
+        the number of bytes read, 0 at the end of the content or -1 on error.
+  */
+static gssize
+read_handle_read (CmisReadHandle *handle,
+                  GVfsJob *job,
+                  char *buffer,
+                  gsize count)
+{
+    GError *error = NULL;
+    gulong cancel_id = 0;
+    goffset available = 0;
+    gssize bytes_read = 0;
+
+    /* Don't wait for the whole content to be downloaded to tell that
+     * there is nothing after its end. The length is only trusted when the
+     * server gave one. */
+    if (count == 0 || (handle->size > 0 && handle->position >= handle->size))
+        return 0;
+
+    if (job->cancellable)
+        cancel_id = g_cancellable_connect (job->cancellable,
+                                           G_CALLBACK (read_handle_cancelled),
+                                           handle, NULL);
+
+    g_mutex_lock (&handle->lock);
+    while (handle->received <= handle->position &&
+           !handle->eof && handle->spool_error == NULL &&
+           !g_cancellable_is_cancelled (job->cancellable))
+        g_cond_wait (&handle->cond, &handle->lock);
+
+    if (handle->received > handle->position)
+        available = handle->received - handle->position;
+    else if (!g_cancellable_set_error_if_cancelled (job->cancellable, &error))
+    {
+        if (handle->spool_error != NULL)
+            error = g_error_copy (handle->spool_error);
+        else if (libcmis_error_getMessage (handle->error) != NULL ||
+                 libcmis_error_getType (handle->error) != NULL)
+        {
+            const char *error_type = libcmis_error_getType (handle->error);
+            const char *message = libcmis_error_getMessage (handle->error);
+
+            g_set_error_literal (&error, G_IO_ERROR,
+                                 cmis_error_to_io_error (error_type),
+                                 message ? message : _("Failed to read the document content"));
+        }
+    }
+    g_mutex_unlock (&handle->lock);
+
+    if (cancel_id)
+        g_cancellable_disconnect (job->cancellable, cancel_id);
+
+    while (error == NULL && available > 0)
+    {
+        bytes_read = pread (handle->spool_fd, buffer, MIN (count, available), handle->position);
+        if (bytes_read >= 0)
+            break;
+
+        if (errno != EINTR)
+        {
+            int errsv = errno;
+
+            g_set_error (&error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                         _("Error reading the document content: %s"),
+                         g_strerror (errsv));
+        }
+    }
+
+    if (error != NULL)
+    {
+        g_vfs_job_failed_from_error (job, error);
+        g_error_free (error);
+        return -1;
+    }
+
+    handle->position += bytes_read;
+    return bytes_read;
+}
+
+static void
+do_mount (GVfsBackend *backend,
+          GVfsJobMount *job,
+          GMountSpec *mount_spec,
+          GMountSource *mount_source,
+          gboolean is_automount)
+{
+    char *spec_str;
+    const char *host;
+    const char *user;
+    char* username = NULL;
+    char *binding_url = NULL;
+    char *password = NULL;
+    gboolean failed = FALSE;
+    GPasswordSave password_save = G_PASSWORD_SAVE_NEVER;
+    char *prompt = NULL;
+    GDecodedUri *decoded = NULL;
+
+    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+
+    spec_str = g_mount_spec_to_string (mount_spec);
+    g_print ("mount_spec: %s\n", spec_str);
+    g_free (spec_str);
+
+    /* In CMIS urls, the host is the url-encoded binding URL */
+    host = g_mount_spec_get (mount_spec, "host");
+
+    if (host == NULL || *host == 0)
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
+                          G_IO_ERROR_INVALID_ARGUMENT,
+                          _("Invalid mount spec"));
+        return;
+    }
+    binding_url = g_uri_unescape_string (host, NULL);
+
+    /* Get the hostname from the binding_url as display host */
+    decoded = g_vfs_decode_uri (binding_url);
+    if (decoded && decoded->host)
     {
         cmis_backend->display_name = g_strdup (decoded->host);
         if (decoded)
@@ -511,16 +1484,32 @@ do_mount (GVfsBackend *backend,
         /* TODO Setup the proxy settings on libcmis if any */
 
         /* Try to create the CMIS session */
+        libcmis_SessionPtr session;
         libcmis_ErrorPtr error = libcmis_error_create ();
-        cmis_backend->session = libcmis_createSession (binding_url,
+        session = libcmis_createSession (binding_url,
                 NULL, username, password, false, NULL, false, error);
 
         if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
+        {
             output_cmis_error (G_VFS_JOB (job), error);
+            if (session)
+                libcmis_session_free (session);
+        }
         else
         {
             char* display_name;
 
+            /* Keep the credentials to open more sessions later */
+            cmis_backend->binding_url = g_strdup (binding_url);
+            cmis_backend->username = g_strdup (username);
+            cmis_backend->password = g_strdup (password);
+
+            g_mutex_lock (&cmis_backend->pool_lock);
+            g_queue_push_head (&cmis_backend->idle_sessions, session);
+            cmis_backend->n_sessions = 1;
+            cmis_backend->mounted = TRUE;
+            g_mutex_unlock (&cmis_backend->pool_lock);
+
             /* Save password if we prompted it */
             if (prompt)
             {
@@ -564,11 +1553,7 @@ do_unmount (GVfsBackend *   backend,
 {
     GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
 
-    if (cmis_backend->session)
-    {
-        libcmis_session_free (cmis_backend->session);
-        cmis_backend->session = NULL;
-    }
+    close_sessions (cmis_backend);
 
     if (cmis_backend->display_name)
     {
@@ -584,26 +1569,22 @@ do_open_for_read (GVfsBackend *backend,
                    const char *filename)
 {
     GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
-    struct TmpHandle *handle;
-    GError *gerror = NULL;
+    CmisReadHandle *handle;
+    libcmis_SessionPtr session;
     libcmis_ObjectPtr object = NULL;
-    libcmis_DocumentPtr document = NULL;
+    GError *error = NULL;
     char *repository_id = NULL;
     char *path = NULL;
 
     g_print ("+do_open_for_read: %s\n", filename);
    
-    if (!is_cmis_session_ready (cmis_backend, G_VFS_JOB (job)))
+    if (!reserve_download (cmis_backend, G_VFS_JOB (job)))
         return;
 
-    /* Open a tmp file and put the document content stream in it */
-    handle = g_new (struct TmpHandle, 1);
-    handle->file = g_file_new_tmp ("gvfs-cmis-stream-XXXXXX", &handle->stream, &gerror);
-    if (gerror)
+    session = acquire_session (cmis_backend, G_VFS_JOB (job));
+    if (session == NULL)
     {
-        g_vfs_job_failed_from_error (G_VFS_JOB (job), gerror );
-        g_error_free (gerror);
-	g_free (handle);
+        cancel_download (cmis_backend);
         return;
     }
 
@@ -612,51 +1593,47 @@ do_open_for_read (GVfsBackend *backend,
     {
         g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
                 _("Root folder can't be opened for reading"));
-	g_free (handle);
     }
     else
     {
-        object = get_cmis_object (G_VFS_JOB (job), cmis_backend->session, repository_id, path);
+        object = get_cmis_object (G_VFS_JOB (job), session, repository_id, path);
 
         if (object && libcmis_is_document (object))
         {
-            libcmis_ErrorPtr error;
-
-            document = libcmis_document_cast (object);
-            error = libcmis_error_create ();
-
-            /* Get the content stream and write it to the GIOStream */
-            libcmis_document_getContentStream (document, write_to_io_stream, handle->stream, error);
+            /* The producer thread takes the session and object over for as
+             * long as the content is downloaded. */
+            handle = read_handle_new (cmis_backend, session, object, &error);
+            if (handle)
+            {
+                session = NULL;
 
-            if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
-                output_cmis_error (G_VFS_JOB (job), error);
+                g_vfs_job_open_for_read_set_can_seek (job, TRUE);
+                g_vfs_job_open_for_read_set_handle (job, handle);
+                g_vfs_job_succeeded (G_VFS_JOB (job));
+            }
             else
             {
-                /* Put the cursor back to the begining for reading */
-                GSeekable *seekable = G_SEEKABLE (handle->stream);
-                g_seekable_seek (seekable, 0, G_SEEK_SET, NULL, &gerror);
-                if (gerror)
-                {
-                    g_vfs_job_failed_from_error (G_VFS_JOB (job), gerror);
-                    g_error_free (gerror);
-                }
-                else
-                {
-                    /* We need to delete the tmp file later, so we need both
-                     * stream and file to be passed around. */
-                    g_vfs_job_open_for_read_set_handle (job, handle);
-                    g_vfs_job_succeeded (G_VFS_JOB (job));
-                }
+                g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+                g_error_free (error);
+                libcmis_object_free (object);
             }
-
+        }
+        else if (object)
+        {
+            g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
+                    _("Not a regular file"));
             libcmis_object_free (object);
-            libcmis_error_free (error);
         }
     }
     
     g_print ("-do_open_for_read\n");
 
     /* Cleanup */
+    if (session)
+    {
+        release_session (cmis_backend, session);
+        cancel_download (cmis_backend);
+    }
     if (path)
         g_free (path);
     if (repository_id)
@@ -670,25 +1647,12 @@ do_close_read (GVfsBackend *     backend,
                GVfsJobCloseRead *job,
                GVfsBackendHandle handle)
 {
-    struct TmpHandle *tmp_handle = (struct TmpHandle*) handle;
-    GError *error = NULL;
+    CmisReadHandle *read_handle = (CmisReadHandle*) handle;
 
     g_print ("+do_close_read\n");
 
-    g_io_stream_close (G_IO_STREAM (tmp_handle->stream), NULL, &error);
-    if (error)
-    {
-        g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
-        g_error_free (error);
-    }
-    else
-        g_vfs_job_succeeded (G_VFS_JOB (job));
-
-
-    g_file_delete (tmp_handle->file, NULL, NULL);
-    g_object_unref (tmp_handle->file);
-
-    g_free (tmp_handle);
+    read_handle_close (read_handle);
+    g_vfs_job_succeeded (G_VFS_JOB (job));
     
     g_print ("-do_close_read\n");
 }
@@ -700,111 +1664,252 @@ do_read (GVfsBackend *     backend,
          char *            buffer,
          gsize             bytes_requested)
 {
-    struct TmpHandle *tmp_handle = (struct TmpHandle*) handle;
-    GInputStream *in_stream;
-    gsize bytes_read = 0;
-    GError *error = NULL;
+    CmisReadHandle *read_handle = (CmisReadHandle*) handle;
+    gssize bytes_read;
+
+    g_print ("+do_read: bytes_requested: %" G_GSIZE_FORMAT "\n", bytes_requested);
 
-    g_print ("+do_read: bytes_requested: %d\n", bytes_requested);
-    in_stream = g_io_stream_get_input_stream ( G_IO_STREAM (tmp_handle->stream));
+    bytes_read = read_handle_read (read_handle, G_VFS_JOB (job), buffer, bytes_requested);
+    if (bytes_read >= 0)
+    {
+        g_vfs_job_read_set_size (job, bytes_read);
+        g_vfs_job_succeeded (G_VFS_JOB (job));
+    }
+    g_print ("-do_read: bytes_read: %" G_GSSIZE_FORMAT "\n", bytes_read);
+}
 
-    g_input_stream_read_all (in_stream, buffer, bytes_requested, &bytes_read, NULL, &error);
+static void
+do_seek_on_read (GVfsBackend *backend,
+                  GVfsJobSeekRead *job,
+                  GVfsBackendHandle handle,
+                  goffset    offset,
+                  GSeekType  type)
+{
+  CmisReadHandle *read_handle = (CmisReadHandle*) handle;
+  goffset target;
 
-    if (error != NULL)
+  g_print ("+do_seek_on_read: (handle = '%lx', offset = %ld) \n", (long int)handle, (long int)offset);
+
+  g_assert (read_handle != NULL);
+
+  switch (type)
     {
-        g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
-        g_error_free (error);
-	g_print ("=do_read: error\n");
+    case G_SEEK_CUR:
+      target = read_handle->position + offset;
+      break;
+    case G_SEEK_END:
+      target = read_handle->size + offset;
+      break;
+    case G_SEEK_SET:
+    default:
+      target = offset;
+      break;
     }
-    else
+
+  if (target < 0)
     {
-        g_vfs_job_read_set_size (job, bytes_read);
-        g_vfs_job_succeeded (G_VFS_JOB (job));
+      g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                        _("Invalid seek position"));
+      g_print ("-do_seek_on_read\n");
+      return;
     }
-    g_print ("-do_read: bytes_read: %d\n", bytes_read);
+
+  /* The next read waits for the download to get there if needed */
+  read_handle->position = target;
+  g_vfs_job_seek_read_set_offset (job, target);
+  g_vfs_job_succeeded (G_VFS_JOB (job));
+
+  g_print ("-do_seek_on_read\n");
 }
 
 static void
-do_seek_on_read (GVfsBackend *backend,
-                  GVfsJobSeekRead *job,
-                  GVfsBackendHandle handle,
-                  goffset    offset,
-                  GSeekType  type)
+tmp_handle_free (struct TmpHandle *handle)
 {
-  GError *error = NULL;
-  struct TmpHandle *tmp_handle = (struct TmpHandle*) handle;
-
-  g_print ("+do_seek_on_read: (handle = '%lx', offset = %ld) \n", (long int)handle, (long int)offset);
+    if (handle->stream)
+        g_object_unref (handle->stream);
+    if (handle->file)
+    {
+        g_file_delete (handle->file, NULL, NULL);
+        g_object_unref (handle->file);
+    }
+    g_free (handle->object_id);
+    g_free (handle->filename);
+    g_free (handle);
+}
 
-  g_assert (tmp_handle != NULL);
-
-  if (g_seekable_seek (G_SEEKABLE (G_IO_STREAM (tmp_handle->stream)), offset, type, G_VFS_JOB (job)->cancellable, &error)) {
-    g_vfs_job_seek_read_set_offset (job, g_seekable_tell (G_SEEKABLE (G_IO_STREAM (tmp_handle->stream))));
-    g_print ("(II) try_seek_on_read success. \n");
-  } else  {
-    g_vfs_job_failed_from_error (G_VFS_JOB (job), error); 
-    g_print ("  (EE) try_seek_on_read: g_file_input_stream_seek() failed, error: %s \n", error->message);
-    g_error_free (error);
-  }
-  
-  g_print ("-do_seek_on_read\n");
+typedef enum {
+    CMIS_WRITE_CREATE,
+    CMIS_WRITE_REPLACE,
+    CMIS_WRITE_APPEND
+} CmisWriteMode;
 
-}
+/** Open a file for writing: the content is spooled into a temporary file and
+    only sent to the server by do_close_write.
 
+    Documents are overwritten as a whole as libcmis doesn't provide any way
+    to append content to a document, thus appending first downloads the
+    current content into the spool file.
+  */
 static void
-do_create (GVfsBackend *backend,
-           GVfsJobOpenForWrite *job,
-           const char *filename,
-           GFileCreateFlags flags)
+open_for_write (GVfsBackendCmis *cmis_backend,
+                GVfsJobOpenForWrite *job,
+                const char *filename,
+                CmisWriteMode mode,
+                const char *etag)
 {
-    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
-    struct TmpHandle *handle;
+    struct TmpHandle *handle = NULL;
     GError *gerror = NULL;
     char *repository_id = NULL;
     char *path = NULL;
+    char *parent_path = NULL;
+    libcmis_SessionPtr session;
     libcmis_ObjectPtr object = NULL;
+    libcmis_ObjectPtr parent = NULL;
+    libcmis_ErrorPtr error;
+    GOutputStream *out_stream;
 
-    g_print ("+do_create: %s\n", filename);
-
-    if (!is_cmis_session_ready (cmis_backend, G_VFS_JOB (job)))
-        return;
-
-    /* Create a temporary file to get the content before pushing it to the server */
-    handle = g_new (struct TmpHandle, 1);
-    handle->file = g_file_new_tmp ("gvfs-cmis-stream-XXXXXX", &handle->stream, &gerror);
-    handle->filename = g_strdup (filename);
-    if (gerror)
-    {
-        g_vfs_job_failed_from_error (G_VFS_JOB (job), gerror);
-        g_error_free (gerror);
+    session = acquire_session (cmis_backend, G_VFS_JOB (job));
+    if (session == NULL)
         return;
-    }
 
+    error = libcmis_error_create ();
     repository_id = extract_repository_from_path (filename, &path);
     if (!path || strlen (path) == 0)
     {
         g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
                 _("Root folder can't be opened for writing"));
+        goto out;
     }
-    else
+
+    if (!libcmis_session_setRepository (session, repository_id))
     {
-        /* Make sure that the object exists */
-        object = get_cmis_object (G_VFS_JOB (job), cmis_backend->session, repository_id, path);
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                          _("No such repository: %s"), repository_id);
+        goto out;
+    }
 
-        if (object && libcmis_is_document (object))
+    /* Don't use get_cmis_object here: a missing file is fine */
+    object = libcmis_session_getObjectByPath (session, path, error);
+    if (object == NULL)
+    {
+        if (libcmis_error_getType (error) != NULL &&
+            cmis_error_to_io_error (libcmis_error_getType (error)) != G_IO_ERROR_NOT_FOUND)
         {
-            g_vfs_job_open_for_write_set_can_seek (job, TRUE);
-            g_vfs_job_open_for_write_set_handle (job, handle);
-            g_vfs_job_succeeded (G_VFS_JOB (job));
+            output_cmis_error (G_VFS_JOB (job), error);
+            goto out;
         }
-        else
+
+        /* The document will be created in its parent folder on close */
+        parent_path = g_path_get_dirname (path);
+        parent = get_cmis_object (G_VFS_JOB (job), session, repository_id, parent_path);
+        if (parent == NULL)
+            goto out;
+        if (!libcmis_is_folder (parent))
         {
-            g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
-                    _("Can't be opened for writing"));
+            g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY,
+                              _("Not a valid directory: %s"), parent_path);
+            goto out;
+        }
+    }
+    else if (libcmis_is_folder (object))
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY,
+                          _("Can't open directory"));
+        goto out;
+    }
+    else if (!libcmis_is_document (object))
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
+                          _("Can't be opened for writing"));
+        goto out;
+    }
+    else if (mode == CMIS_WRITE_CREATE)
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_EXISTS,
+                          _("Target file already exists"));
+        goto out;
+    }
+    else if (mode == CMIS_WRITE_REPLACE && etag != NULL)
+    {
+        char *change_token;
+        gboolean matches;
+
+        change_token = libcmis_object_getChangeToken (object);
+        matches = g_strcmp0 (change_token, etag) == 0;
+        g_free (change_token);
+
+        if (!matches)
+        {
+            g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_WRONG_ETAG,
+                              _("The file was externally modified"));
+            goto out;
         }
+    }
+
+    /* Create a temporary file to get the content before pushing it to the server */
+    handle = g_new0 (struct TmpHandle, 1);
+    handle->file = g_file_new_tmp ("gvfs-cmis-stream-XXXXXX", &handle->stream, &gerror);
+    handle->filename = g_strdup (filename);
+    if (gerror)
+    {
+        g_vfs_job_failed_from_error (G_VFS_JOB (job), gerror);
+        g_error_free (gerror);
+        goto out;
+    }
 
+    if (object && mode == CMIS_WRITE_APPEND)
+    {
+        out_stream = g_io_stream_get_output_stream (G_IO_STREAM (handle->stream));
+        libcmis_document_getContentStream (libcmis_document_cast (object),
+                                           write_to_g_output_stream, out_stream, error);
+        if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
+        {
+            output_cmis_error (G_VFS_JOB (job), error);
+            goto out;
+        }
+        g_vfs_job_open_for_write_set_initial_offset (job,
+                g_seekable_tell (G_SEEKABLE (handle->stream)));
     }
 
+    if (object)
+        handle->object_id = libcmis_object_getId (object);
+
+    /* Let the client write to the spool file itself */
+    out_stream = g_io_stream_get_output_stream (G_IO_STREAM (handle->stream));
+    if (G_IS_FILE_DESCRIPTOR_BASED (out_stream))
+        g_vfs_job_open_for_write_set_direct_fd (job,
+                g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (out_stream)));
+
+    g_vfs_job_open_for_write_set_can_seek (job, TRUE);
+    g_vfs_job_open_for_write_set_handle (job, handle);
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+    handle = NULL;
+
+out:
+    if (handle)
+        tmp_handle_free (handle);
+    if (object)
+        libcmis_object_free (object);
+    if (parent)
+        libcmis_object_free (parent);
+    libcmis_error_free (error);
+    release_session (cmis_backend, session);
+    g_free (parent_path);
+    g_free (path);
+    g_free (repository_id);
+}
+
+static void
+do_create (GVfsBackend *backend,
+           GVfsJobOpenForWrite *job,
+           const char *filename,
+           GFileCreateFlags flags)
+{
+    g_print ("+do_create: %s\n", filename);
+
+    open_for_write (G_VFS_BACKEND_CMIS (backend), job, filename,
+                    CMIS_WRITE_CREATE, NULL);
+
     g_print ("-do_create\n");
 }
 
@@ -814,8 +1919,12 @@ do_append (GVfsBackend *backend,
            const char *filename,
            GFileCreateFlags flags)
 {
-    g_print ("TODO Implement do_append\n");
-    g_vfs_job_succeeded (G_VFS_JOB (job));
+    g_print ("+do_append: %s\n", filename);
+
+    open_for_write (G_VFS_BACKEND_CMIS (backend), job, filename,
+                    CMIS_WRITE_APPEND, NULL);
+
+    g_print ("-do_append\n");
 }
 
 static void
@@ -826,8 +1935,17 @@ do_replace (GVfsBackend *backend,
             gboolean make_backup,
             GFileCreateFlags flags)
 {
-    g_print ("TODO Implement do_replace\n");
-    g_vfs_job_succeeded (G_VFS_JOB (job));
+    g_print ("+do_replace: %s\n", filename);
+
+    /* CMIS versioning would be the way to go for backups */
+    if (make_backup)
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_CANT_CREATE_BACKUP,
+                          _("Backups not supported"));
+    else
+        open_for_write (G_VFS_BACKEND_CMIS (backend), job, filename,
+                        CMIS_WRITE_REPLACE, etag);
+
+    g_print ("-do_replace\n");
 }
 
 static void
@@ -837,42 +1955,125 @@ do_close_write (GVfsBackend *backend,
 {
     GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
     struct TmpHandle *tmp_handle = (struct TmpHandle*) handle;
-    GError *error = NULL;
+    GError *gerror = NULL;
     char *repository_id = NULL;
     char *path = NULL;
-    libcmis_ObjectPtr object = NULL;
+    char *name = NULL;
+    char *content_type = NULL;
+    GInputStream *in_stream;
+    libcmis_SessionPtr session;
+    libcmis_ErrorPtr error;
 
     g_print ("+do_close_write\n");
 
-    /* TODO Set the content stream */
-    
-    if (!is_cmis_session_ready (cmis_backend, G_VFS_JOB (job)))
+    session = acquire_session (cmis_backend, G_VFS_JOB (job));
+    if (session == NULL)
+    {
+        tmp_handle_free (tmp_handle);
         return;
+    }
 
-    repository_id = extract_repository_from_path (tmp_handle->filename, &path);
-    object = get_cmis_object (G_VFS_JOB (job), cmis_backend->session, repository_id, path);
-
-    if (object && libcmis_is_document (object))
+    /* Put the cursor back to the begining for uploading */
+    if (!g_seekable_seek (G_SEEKABLE (tmp_handle->stream), 0, G_SEEK_SET, NULL, &gerror))
     {
-        libcmis_DocumentPtr document = libcmis_document_cast (object);
-        /* libcmis_document_setContentStream (document, read_from_io_stream, handle->stream, ); */
+        g_vfs_job_failed_from_error (G_VFS_JOB (job), gerror);
+        g_error_free (gerror);
+        tmp_handle_free (tmp_handle);
+        release_session (cmis_backend, session);
+        return;
     }
 
-    /* Close the streams and delete the tmp file */
-    g_io_stream_close (G_IO_STREAM (tmp_handle->stream), NULL, &error);
-    if (error)
+    repository_id = extract_repository_from_path (tmp_handle->filename, &path);
+    name = g_path_get_basename (path);
+    in_stream = g_io_stream_get_input_stream (G_IO_STREAM (tmp_handle->stream));
+    error = libcmis_error_create ();
+
+    if (tmp_handle->object_id)
     {
-        g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
-        g_error_free (error);
+        libcmis_ObjectPtr object = NULL;
+
+        if (libcmis_session_setRepository (session, repository_id))
+            object = libcmis_session_getObject (session, tmp_handle->object_id, error);
+
+        if (object && libcmis_is_document (object))
+        {
+            libcmis_DocumentPtr document = libcmis_document_cast (object);
+
+            content_type = libcmis_document_getContentType (document);
+            libcmis_document_setContentStream (document, read_from_g_input_stream, in_stream,
+                                               content_type, name, true, error);
+        }
+
+        /* Only now, or a stat during the upload would cache the old infos */
+        cache_invalidate (cmis_backend, tmp_handle->filename);
+
+        if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
+            output_cmis_error (G_VFS_JOB (job), error);
+        else if (object == NULL)
+            g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                              _("The file was removed while being written"));
+        else
+            g_vfs_job_succeeded (G_VFS_JOB (job));
+
+        if (object)
+            libcmis_object_free (object);
     }
     else
-        g_vfs_job_succeeded (G_VFS_JOB (job));
+    {
+        char *parent_path;
+        libcmis_ObjectPtr parent;
+
+        parent_path = g_path_get_dirname (path);
+        parent = get_cmis_object (G_VFS_JOB (job), session, repository_id, parent_path);
+        if (parent && libcmis_is_folder (parent))
+        {
+            libcmis_vector_property_Ptr properties;
+            libcmis_DocumentPtr document = NULL;
+
+            content_type = g_content_type_guess (name, NULL, 0, NULL);
+            properties = create_name_properties (session, "cmis:document",
+                                                 name, true, error);
+            if (properties)
+            {
+                document = libcmis_folder_createDocument (libcmis_folder_cast (parent),
+                                                          properties,
+                                                          read_from_g_input_stream, in_stream,
+                                                          content_type, name, error);
+                libcmis_vector_property_free (properties);
+            }
+            cache_invalidate (cmis_backend, tmp_handle->filename);
+
+            if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
+                output_cmis_error (G_VFS_JOB (job), error);
+            else
+                g_vfs_job_succeeded (G_VFS_JOB (job));
+
+            if (document)
+                libcmis_document_free (document);
+        }
+        else if (parent)
+        {
+            g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY,
+                              _("Not a valid directory: %s"), parent_path);
+        }
+
+        if (parent)
+            libcmis_object_free (parent);
+        g_free (parent_path);
+    }
+
+    /* Close the streams and delete the tmp file */
+    g_io_stream_close (G_IO_STREAM (tmp_handle->stream), NULL, NULL);
+    tmp_handle_free (tmp_handle);
 
+    libcmis_error_free (error);
+    release_session (cmis_backend, session);
+    g_free (content_type);
+    g_free (name);
+    g_free (path);
+    g_free (repository_id);
 
-    g_file_delete (tmp_handle->file, NULL, NULL);
-    g_object_unref (tmp_handle->file);
-    g_free (tmp_handle->filename);
-    g_free (tmp_handle);
+    g_print ("-do_close_write\n");
 }
 
 static void
@@ -882,46 +2083,105 @@ do_write (GVfsBackend *backend,
           char *buffer,
           gsize buffer_size)
 {
-    g_print ("TODO Implement do_write\n");
-    g_vfs_job_succeeded (G_VFS_JOB (job));
+    struct TmpHandle *tmp_handle = (struct TmpHandle*) handle;
+    GOutputStream *out_stream;
+    gsize bytes_written = 0;
+    GError *error = NULL;
+
+    out_stream = g_io_stream_get_output_stream (G_IO_STREAM (tmp_handle->stream));
+    if (g_output_stream_write_all (out_stream, buffer, buffer_size, &bytes_written,
+                                   G_VFS_JOB (job)->cancellable, &error))
+    {
+        g_vfs_job_write_set_written_size (job, bytes_written);
+        g_vfs_job_succeeded (G_VFS_JOB (job));
+    }
+    else
+    {
+        g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+        g_error_free (error);
+    }
 }
 
 static void
-do_query_info (GVfsBackend *backend,
-               GVfsJobQueryInfo *job,
-               const char *filename,
-               GFileQueryInfoFlags query_flags,
-               GFileInfo *info,
-               GFileAttributeMatcher *matcher)
+do_seek_on_write (GVfsBackend *backend,
+                  GVfsJobSeekWrite *job,
+                  GVfsBackendHandle handle,
+                  goffset    offset,
+                  GSeekType  type)
 {
-    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
-    gchar *repository_id = NULL;
-    gchar *path = NULL;
+    struct TmpHandle *tmp_handle = (struct TmpHandle*) handle;
+    GError *error = NULL;
 
-    g_print ("+do_query_info: %s\n", filename);
+    if (g_seekable_seek (G_SEEKABLE (tmp_handle->stream), offset, type,
+                         G_VFS_JOB (job)->cancellable, &error))
+    {
+        g_vfs_job_seek_write_set_offset (job, g_seekable_tell (G_SEEKABLE (tmp_handle->stream)));
+        g_vfs_job_succeeded (G_VFS_JOB (job));
+    }
+    else
+    {
+        g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+        g_error_free (error);
+    }
+}
 
-    if (!is_cmis_session_ready (cmis_backend, G_VFS_JOB (job)))
-        return;
+/** Convert child, an object of the folder dirname, into an info and put
+    it in the cache. Takes ownership of child.
+  */
+static GFileInfo *
+cache_child (GVfsBackendCmis *cmis_backend,
+             const char *dirname,
+             libcmis_ObjectPtr child,
+             GFileAttributeMatcher *matcher)
+{
+    GFileInfo *info;
+    char *child_filename;
+
+    info = g_file_info_new ();
+    cmis_object_to_file_info (child, matcher, info);
+    libcmis_object_free (child);
+
+    child_filename = g_build_path ("/", dirname, g_file_info_get_name (info), NULL);
+    cache_insert (cmis_backend, child_filename, matcher, info);
+    g_free (child_filename);
+
+    return info;
+}
+
+/** Fill info for filename, which may be the mount root, a repository or
+    an object in a repository.
+  */
+static gboolean
+query_cmis_info (GVfsBackendCmis *cmis_backend,
+                 libcmis_SessionPtr session,
+                 const char *filename,
+                 GFileAttributeMatcher *matcher,
+                 GFileInfo *info,
+                 GError **error)
+{
+    gchar *repository_id = NULL;
+    gchar *path = NULL;
+    gboolean success = FALSE;
 
     repository_id = extract_repository_from_path (filename, &path);
 
     if (repository_id)
     {
-        if (libcmis_session_setRepository (cmis_backend->session, repository_id))
+        if (libcmis_session_setRepository (session, repository_id))
         {
             if (!path || strlen(path) == 0)
             {
                 libcmis_RepositoryPtr repo;
 
-                repo = libcmis_session_getRepository (cmis_backend->session, NULL);
+                repo = libcmis_session_getRepository (session, NULL);
                 if (repo)
                 {
                     repository_to_file_info (repo, info);
-                    g_vfs_job_succeeded (G_VFS_JOB (job));
+                    success = TRUE;
                 }
                 else
                 {
-                    g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR,
+                    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                                          _("Failed to get repository infos"));
                 }
 
@@ -931,12 +2191,13 @@ do_query_info (GVfsBackend *backend,
             {
                 libcmis_ObjectPtr object;
 
-                object = get_cmis_object (G_VFS_JOB (job), cmis_backend->session, repository_id, path);
+                object = lookup_cmis_object (session, repository_id, path, error);
 
                 if (object)
                 {
-                    cmis_object_to_file_info (object, info);
-                    g_vfs_job_succeeded (G_VFS_JOB (job));
+                    cmis_object_to_file_info (object, matcher, info);
+                    cache_insert (cmis_backend, filename, matcher, info);
+                    success = TRUE;
 
                     libcmis_object_free (object);
                 }
@@ -944,12 +2205,8 @@ do_query_info (GVfsBackend *backend,
         }
         else
         {
-            char *message;
-            message = g_strdup_printf (_("No such repository: %s"), repository_id);
-            g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
-                                 G_IO_ERROR_NOT_FOUND,
-                                 message );
-            g_free (message);
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                         _("No such repository: %s"), repository_id);
         }
     }
     else
@@ -977,10 +2234,86 @@ do_query_info (GVfsBackend *backend,
         g_file_info_set_symbolic_icon (info, symbolic_icon);
         g_object_unref (symbolic_icon);
 
+        success = TRUE;
+    }
+
+    g_free (repository_id);
+    g_free (path);
+
+    return success;
+}
+
+static void
+do_query_info (GVfsBackend *backend,
+               GVfsJobQueryInfo *job,
+               const char *filename,
+               GFileQueryInfoFlags query_flags,
+               GFileInfo *info,
+               GFileAttributeMatcher *matcher)
+{
+    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+    libcmis_SessionPtr session;
+    GError *error = NULL;
+
+    g_print ("+do_query_info: %s\n", filename);
+
+    session = acquire_session (cmis_backend, G_VFS_JOB (job));
+    if (session == NULL)
+        return;
+
+    if (query_cmis_info (cmis_backend, session, filename, matcher, info, &error))
         g_vfs_job_succeeded (G_VFS_JOB (job));
+    else
+    {
+        g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+        g_error_free (error);
+    }
+
+    release_session (cmis_backend, session);
+    g_print ("-do_query_info\n");
+}
+
+static gboolean
+try_query_info (GVfsBackend *backend,
+                GVfsJobQueryInfo *job,
+                const char *filename,
+                GFileQueryInfoFlags query_flags,
+                GFileInfo *info,
+                GFileAttributeMatcher *matcher)
+{
+    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+
+    if (!cache_lookup (cmis_backend, filename, matcher, info))
+        return FALSE;
+
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+    return TRUE;
+}
+
+static gboolean
+try_enumerate (GVfsBackend *backend,
+               GVfsJobEnumerate *job,
+               const char *dirname,
+               GFileAttributeMatcher *matcher,
+               GFileQueryInfoFlags query_flags)
+{
+    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+    GList *infos = NULL;
+    GList *l;
+
+    if (!cache_lookup_listing (cmis_backend, dirname, matcher, &infos))
+        return FALSE;
+
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+    for (l = infos; l != NULL; l = l->next)
+    {
+        g_vfs_job_enumerate_add_info (job, l->data);
+        g_object_unref (l->data);
     }
+    g_list_free (infos);
+    g_vfs_job_enumerate_done (job);
 
-    g_print ("-do_query_info\n");
+    return TRUE;
 }
 
 static void
@@ -993,10 +2326,15 @@ do_enumerate (GVfsBackend *backend,
     g_print ("+do_enumerate: %s\n", dirname);
 
     GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+    libcmis_SessionPtr session;
     gchar *repository_id = NULL;
     gchar *path = NULL;
+    GList *infos = NULL;
+    GList *l;
+    gboolean listed = FALSE;
 
-    if (!is_cmis_session_ready (cmis_backend, G_VFS_JOB (job)))
+    session = acquire_session (cmis_backend, G_VFS_JOB (job));
+    if (session == NULL)
         return;
 
     /* Split the dirname into repository and path.
@@ -1010,7 +2348,7 @@ do_enumerate (GVfsBackend *backend,
          * whatever the dirname is */
         libcmis_vector_Repository_Ptr repositories = NULL;
 
-        repositories = libcmis_session_getRepositories (cmis_backend->session);
+        repositories = libcmis_session_getRepositories (session);
 
         size_t repositories_count = libcmis_vector_repository_size (repositories);
         size_t i;
@@ -1025,12 +2363,12 @@ do_enumerate (GVfsBackend *backend,
 
             repository_to_file_info (repo, info);
 
-            g_vfs_job_enumerate_add_info (job, info);
+            infos = g_list_prepend (infos, info);
         }
 
         libcmis_vector_repository_free (repositories);
         g_vfs_job_succeeded (G_VFS_JOB (job));
-        g_vfs_job_enumerate_done (G_VFS_JOB_ENUMERATE (job));
+        listed = TRUE;
     }
     else
     {
@@ -1044,7 +2382,7 @@ do_enumerate (GVfsBackend *backend,
         }
 
         /* List the files and folders for the given directory name */
-        object = get_cmis_object (G_VFS_JOB (job), cmis_backend->session, repository_id, path);
+        object = get_cmis_object (G_VFS_JOB (job), session, repository_id, path);
 
 
         error = libcmis_error_create ();
@@ -1063,108 +2401,699 @@ do_enumerate (GVfsBackend *backend,
             {
                 size_t objects_count = 0;
                 size_t i;
+                GPtrArray *names;
+
+                /* Reply right away, the client gets ready meanwhile */
+                g_vfs_job_succeeded (G_VFS_JOB (job));
+
+                objects_count = libcmis_vector_object_size (children);
+                names = g_ptr_array_new_full (objects_count, g_free);
+
+                /* Convert all instances of libcmis_Object into GFileInfo */
+                for (i = 0; i < objects_count; ++i)
+                {
+                    GFileInfo *info;
+
+                    /* Save the stats storm that usually follows */
+                    info = cache_child (cmis_backend, dirname,
+                                        libcmis_vector_object_get (children, i), matcher);
+                    g_ptr_array_add (names, g_strdup (g_file_info_get_name (info)));
+
+                    infos = g_list_prepend (infos, info);
+                }
+
+                cache_insert_listing (cmis_backend, dirname, names);
+                listed = TRUE;
+            }
+
+            libcmis_vector_object_free (children);
+        }
+        else if (object)
+        {
+            char *message;
+            message = g_strdup_printf (_("Not a valid directory: %s"), path);
+            g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY,
+                                 message );
+            g_free (message);
+        }
+
+        if (object)
+            libcmis_object_free (object);
+        libcmis_error_free (error);
+    }
+
+    /* Sending the infos waits for the client, don't keep the session that
+     * long */
+    release_session (cmis_backend, session);
+
+    infos = g_list_reverse (infos);
+    for (l = infos; l != NULL; l = l->next)
+        g_vfs_job_enumerate_add_info (job, l->data);
+    if (listed)
+        g_vfs_job_enumerate_done (G_VFS_JOB_ENUMERATE (job));
+
+    /* Clean up */
+    g_list_free_full (infos, g_object_unref);
+    g_free (repository_id);
+    g_free (path);
+    g_print ("-do_enumerate\n");
+}
+
+/** Get the object at filename in order to modify it: repositories and
+    their root folder can't be changed.
+
+    This function will set errors on the job if needed.
+
+    \return
+        the CMIS object or NULL. The resulting object needs to be freed using libcmis_object_free().
+  */
+static libcmis_ObjectPtr
+get_object_to_edit (GVfsJob *job,
+                    libcmis_SessionPtr session,
+                    const char *filename)
+{
+    libcmis_ObjectPtr object = NULL;
+    char *repository_id;
+    char *path;
+
+    repository_id = extract_repository_from_path (filename, &path);
+    if (repository_id == NULL || strlen (path) == 0 || strcmp (path, "/") == 0)
+        g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                          _("Repositories and their root folder can't be modified"));
+    else
+        object = get_cmis_object (job, session, repository_id, path);
+
+    g_free (path);
+    g_free (repository_id);
+    return object;
+}
+
+/** Get the folder containing filename.
+
+    This function will set errors on the job if needed.
+
+    \return
+        the CMIS folder or NULL. The resulting object needs to be freed using libcmis_object_free().
+  */
+static libcmis_ObjectPtr
+get_parent_folder (GVfsJob *job,
+                   libcmis_SessionPtr session,
+                   const char *filename)
+{
+    libcmis_ObjectPtr parent;
+    char *repository_id;
+    char *path;
+    char *parent_path;
+
+    repository_id = extract_repository_from_path (filename, &path);
+    parent_path = g_path_get_dirname (path);
+    parent = get_cmis_object (job, session, repository_id, parent_path);
+    if (parent && !libcmis_is_folder (parent))
+    {
+        g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY,
+                          _("Not a valid directory: %s"), parent_path);
+        libcmis_object_free (parent);
+        parent = NULL;
+    }
+
+    g_free (parent_path);
+    g_free (path);
+    g_free (repository_id);
+    return parent;
+}
+
+/** Change the cmis:name of an object, which renames it in all its folders.
+
+    This function will set errors on the job if needed.
+  */
+static gboolean
+rename_object (GVfsJob *job,
+               libcmis_SessionPtr session,
+               libcmis_ObjectPtr object,
+               const char *name)
+{
+    libcmis_vector_property_Ptr properties;
+    libcmis_ObjectPtr updated = NULL;
+    libcmis_ErrorPtr error;
+    gboolean result;
+
+    error = libcmis_error_create ();
+    properties = create_name_properties (session,
+                                         libcmis_is_folder (object) ? "cmis:folder" : "cmis:document",
+                                         name, false, error);
+    if (properties)
+    {
+        updated = libcmis_object_updateProperties (object, properties, error);
+        libcmis_vector_property_free (properties);
+    }
+
+    result = libcmis_error_getMessage (error) == NULL && libcmis_error_getType (error) == NULL;
+    if (!result)
+        output_cmis_error (job, error);
+
+    if (updated)
+        libcmis_object_free (updated);
+    libcmis_error_free (error);
+    return result;
+}
+
+static void
+do_set_display_name (GVfsBackend *backend,
+                     GVfsJobSetDisplayName *job,
+                     const char *filename,
+                     const char *display_name)
+{
+    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+    libcmis_SessionPtr session;
+    libcmis_ObjectPtr object;
+
+    g_print ("+do_set_display_name: %s -> %s\n", filename, display_name);
+
+    if (strchr (display_name, '/') != NULL)
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_INVALID_FILENAME,
+                          _("Filename can't contain a '/'"));
+        return;
+    }
+
+    session = acquire_session (cmis_backend, G_VFS_JOB (job));
+    if (session == NULL)
+        return;
+
+    object = get_object_to_edit (G_VFS_JOB (job), session, filename);
+    if (object && rename_object (G_VFS_JOB (job), session, object, display_name))
+    {
+        char *dirname;
+        char *new_path;
+
+        dirname = g_path_get_dirname (filename);
+        new_path = g_build_filename (dirname, display_name, NULL);
+
+        cache_invalidate (cmis_backend, filename);
+        cache_invalidate (cmis_backend, new_path);
+
+        g_vfs_job_set_display_name_set_new_path (job, new_path);
+        g_vfs_job_succeeded (G_VFS_JOB (job));
+
+        g_free (new_path);
+        g_free (dirname);
+    }
+
+    if (object)
+        libcmis_object_free (object);
+    release_session (cmis_backend, session);
+
+    g_print ("-do_set_display_name\n");
+}
+
+static void
+do_delete (GVfsBackend *backend,
+           GVfsJobDelete *job,
+           const char *filename)
+{
+    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+    libcmis_SessionPtr session;
+    libcmis_ObjectPtr object;
+    libcmis_ErrorPtr error;
+
+    g_print ("+do_delete: %s\n", filename);
+
+    session = acquire_session (cmis_backend, G_VFS_JOB (job));
+    if (session == NULL)
+        return;
+
+    object = get_object_to_edit (G_VFS_JOB (job), session, filename);
+    if (object)
+    {
+        error = libcmis_error_create ();
+
+        /* Servers refuse to delete folders with children with a constraint error */
+        libcmis_object_remove (object, true, error);
+        if (libcmis_is_folder (object) &&
+            g_strcmp0 (libcmis_error_getType (error), "constraint") == 0)
+            g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_EMPTY,
+                              _("Directory not empty"));
+        else if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
+            output_cmis_error (G_VFS_JOB (job), error);
+        else
+        {
+            cache_invalidate (cmis_backend, filename);
+            g_vfs_job_succeeded (G_VFS_JOB (job));
+        }
+
+        libcmis_error_free (error);
+        libcmis_object_free (object);
+    }
+    release_session (cmis_backend, session);
+
+    g_print ("-do_delete\n");
+}
+
+static void
+do_make_directory (GVfsBackend *backend,
+                   GVfsJobMakeDirectory *job,
+                   const char *filename)
+{
+    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+    libcmis_SessionPtr session;
+    libcmis_ObjectPtr parent;
+    libcmis_ErrorPtr error;
+    char *name;
+
+    g_print ("+do_make_directory: %s\n", filename);
+
+    session = acquire_session (cmis_backend, G_VFS_JOB (job));
+    if (session == NULL)
+        return;
+
+    parent = get_parent_folder (G_VFS_JOB (job), session, filename);
+    if (parent)
+    {
+        libcmis_vector_property_Ptr properties;
+        libcmis_FolderPtr folder = NULL;
+
+        error = libcmis_error_create ();
+        name = g_path_get_basename (filename);
+
+        properties = create_name_properties (session, "cmis:folder", name, true, error);
+        if (properties)
+        {
+            folder = libcmis_folder_createFolder (libcmis_folder_cast (parent),
+                                                  properties, error);
+            libcmis_vector_property_free (properties);
+        }
+
+        if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
+            output_cmis_error (G_VFS_JOB (job), error);
+        else
+        {
+            cache_invalidate (cmis_backend, filename);
+            g_vfs_job_succeeded (G_VFS_JOB (job));
+        }
+
+        if (folder)
+            libcmis_folder_free (folder);
+        libcmis_error_free (error);
+        libcmis_object_free (parent);
+        g_free (name);
+    }
+    release_session (cmis_backend, session);
+
+    g_print ("-do_make_directory\n");
+}
+
+/** Make room for the destination of a move, following the copy flags.
+
+    This function will set errors on the job if needed.
+  */
+static gboolean
+move_prepare_destination (GVfsJob *job,
+                          libcmis_SessionPtr session,
+                          const char *path,
+                          libcmis_ObjectPtr source,
+                          GFileCopyFlags flags)
+{
+    libcmis_ObjectPtr destination;
+    libcmis_ErrorPtr error;
+    gboolean result = FALSE;
+
+    error = libcmis_error_create ();
+    destination = libcmis_session_getObjectByPath (session, path, error);
+    if (destination == NULL)
+    {
+        /* Nothing to replace */
+        result = libcmis_error_getType (error) == NULL ||
+                 cmis_error_to_io_error (libcmis_error_getType (error)) == G_IO_ERROR_NOT_FOUND;
+        if (!result)
+            output_cmis_error (job, error);
+    }
+    else if (!(flags & G_FILE_COPY_OVERWRITE))
+        g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_EXISTS,
+                          _("Target file already exists"));
+    else if (libcmis_is_folder (destination))
+    {
+        if (libcmis_is_folder (source))
+            g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_WOULD_MERGE,
+                              _("Can't move directory over directory"));
+        else
+            g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY,
+                              _("Can't move over directory"));
+    }
+    else
+    {
+        libcmis_object_remove (destination, true, error);
+        result = libcmis_error_getMessage (error) == NULL && libcmis_error_getType (error) == NULL;
+        if (!result)
+            output_cmis_error (job, error);
+    }
+
+    if (destination)
+        libcmis_object_free (destination);
+    libcmis_error_free (error);
+    return result;
+}
+
+static void
+do_move (GVfsBackend *backend,
+         GVfsJobMove *job,
+         const char *source,
+         const char *destination,
+         GFileCopyFlags flags,
+         GFileProgressCallback progress_callback,
+         gpointer progress_callback_data)
+{
+    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+    libcmis_SessionPtr session;
+    libcmis_ObjectPtr object = NULL;
+    libcmis_ObjectPtr source_parent = NULL;
+    libcmis_ObjectPtr destination_parent = NULL;
+    char *source_repository;
+    char *source_path;
+    char *destination_repository;
+    char *destination_path;
+    char *source_dirname;
+    char *destination_dirname;
+    char *source_name;
+    char *destination_name;
+
+    g_print ("+do_move: %s -> %s\n", source, destination);
+
+    source_repository = extract_repository_from_path (source, &source_path);
+    destination_repository = extract_repository_from_path (destination, &destination_path);
+    source_dirname = g_path_get_dirname (source_path);
+    destination_dirname = g_path_get_dirname (destination_path);
+    source_name = g_path_get_basename (source_path);
+    destination_name = g_path_get_basename (destination_path);
+
+    /* Let GIO fall back to copy and delete */
+    if (g_strcmp0 (source_repository, destination_repository) != 0)
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                          _("Can't move between repositories"));
+        goto out;
+    }
+
+    if (flags & G_FILE_COPY_BACKUP)
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_CANT_CREATE_BACKUP,
+                          _("Backups not supported"));
+        goto out;
+    }
+
+    /* Don't remove the source as an overwritten destination */
+    if (strcmp (source_path, destination_path) == 0)
+    {
+        g_vfs_job_succeeded (G_VFS_JOB (job));
+        goto out;
+    }
+
+    session = acquire_session (cmis_backend, G_VFS_JOB (job));
+    if (session == NULL)
+        goto out;
+
+    object = get_object_to_edit (G_VFS_JOB (job), session, source);
+    if (object == NULL)
+        goto release;
+
+    if (strcmp (source_dirname, destination_dirname) != 0)
+    {
+        source_parent = get_parent_folder (G_VFS_JOB (job), session, source);
+        if (source_parent == NULL)
+            goto release;
+        destination_parent = get_parent_folder (G_VFS_JOB (job), session, destination);
+        if (destination_parent == NULL)
+            goto release;
+    }
+
+    if (!move_prepare_destination (G_VFS_JOB (job), session, destination_path,
+                                   object, flags))
+        goto release;
+
+    /* The object is moved first, then renamed: that's at most two requests
+     * whatever the size of the moved tree */
+    if (destination_parent)
+    {
+        libcmis_ErrorPtr error;
+        gboolean failed;
+
+        error = libcmis_error_create ();
+        libcmis_object_move (object, libcmis_folder_cast (source_parent),
+                             libcmis_folder_cast (destination_parent), error);
+        failed = libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL;
+        if (failed)
+            output_cmis_error (G_VFS_JOB (job), error);
+        libcmis_error_free (error);
+
+        if (failed)
+            goto release;
+    }
+
+    if (strcmp (source_name, destination_name) != 0 &&
+        !rename_object (G_VFS_JOB (job), session, object, destination_name))
+        goto release;
+
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+
+release:
+    /* Even a failed move may have changed something */
+    cache_invalidate (cmis_backend, source);
+    cache_invalidate (cmis_backend, destination);
+
+    if (object)
+        libcmis_object_free (object);
+    if (source_parent)
+        libcmis_object_free (source_parent);
+    if (destination_parent)
+        libcmis_object_free (destination_parent);
+    release_session (cmis_backend, session);
+out:
+    g_free (source_repository);
+    g_free (source_path);
+    g_free (destination_repository);
+    g_free (destination_path);
+    g_free (source_dirname);
+    g_free (destination_dirname);
+    g_free (source_name);
+    g_free (destination_name);
+
+    g_print ("-do_move\n");
+}
+
+static gboolean
+try_query_settable_attributes (GVfsBackend *backend,
+			       GVfsJobQueryAttributes *job,
+			       const char *filename)
+{
+    GFileAttributeInfoList *list;
+
+    /* Renaming is done with set_display_name, the rest is in the cmis namespace */
+    list = g_file_attribute_info_list_new ();
+    g_vfs_job_query_attributes_set_list (job, list);
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+    g_file_attribute_info_list_unref (list);
+
+    return TRUE;
+}
+
+static gboolean
+try_query_writable_namespaces (GVfsBackend *backend,
+                               GVfsJobQueryAttributes *job,
+                               const char *filename)
+{
+    GFileAttributeInfoList *list;
+
+    /* The properties are moved with the objects by the server */
+    list = g_file_attribute_info_list_new ();
+    g_file_attribute_info_list_add (list, "cmis",
+                                    G_FILE_ATTRIBUTE_TYPE_STRING,
+                                    G_FILE_ATTRIBUTE_INFO_NONE);
+    g_vfs_job_query_attributes_set_list (job, list);
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+    g_file_attribute_info_list_unref (list);
+
+    return TRUE;
+}
+
+/** Set the cmis::<property id> attributes: only single string properties
+    can be updated, the server checks whether they are updatable.
+  */
+static void
+do_set_attribute (GVfsBackend *backend,
+                  GVfsJobSetAttribute *job,
+                  const char *filename,
+                  const char *attribute,
+                  GFileAttributeType type,
+                  gpointer value_p,
+                  GFileQueryInfoFlags flags)
+{
+    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+    libcmis_SessionPtr session;
+    libcmis_ObjectPtr object;
+    libcmis_ObjectTypePtr object_type = NULL;
+    libcmis_vector_property_Ptr properties = NULL;
+    libcmis_ObjectPtr updated = NULL;
+    libcmis_ErrorPtr error;
+    char *type_id;
 
-                /* Convert all instances of libcmis_Object into GFileInfo */
-                objects_count = libcmis_vector_object_size (children);
-                for (i = 0; i < objects_count; ++i)
-                {
-                    libcmis_ObjectPtr child;
-                    GFileInfo *info;
+    g_print ("+do_set_attribute: %s %s\n", filename, attribute);
 
-                    child = libcmis_vector_object_get (children, i);
-                    info = g_file_info_new ();
+    if (!g_str_has_prefix (attribute, "cmis::") || type != G_FILE_ATTRIBUTE_TYPE_STRING)
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                          _("Operation unsupported"));
+        return;
+    }
 
-                    cmis_object_to_file_info (child, info);
+    session = acquire_session (cmis_backend, G_VFS_JOB (job));
+    if (session == NULL)
+        return;
 
-                    g_vfs_job_enumerate_add_info (job, info);
-                }
+    object = get_object_to_edit (G_VFS_JOB (job), session, filename);
+    if (object == NULL)
+    {
+        release_session (cmis_backend, session);
+        return;
+    }
 
-                g_vfs_job_succeeded (G_VFS_JOB (job));
-                g_vfs_job_enumerate_done (G_VFS_JOB_ENUMERATE (job));
-            }
+    error = libcmis_error_create ();
+    type_id = libcmis_object_getType (object);
+    object_type = libcmis_session_getType (session, type_id, error);
+    if (object_type)
+    {
+        properties = libcmis_vector_property_create ();
+        append_string_property (properties, object_type,
+                                attribute + strlen ("cmis::"), (const char *) value_p);
+    }
 
-            libcmis_vector_object_free (children);
-            libcmis_object_free (object);
-        }
+    if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
+        output_cmis_error (G_VFS_JOB (job), error);
+    else if (properties == NULL || libcmis_vector_property_size (properties) == 0)
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                          _("Unknown property: %s"), attribute + strlen ("cmis::"));
+    else
+    {
+        updated = libcmis_object_updateProperties (object, properties, error);
+        if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
+            output_cmis_error (G_VFS_JOB (job), error);
         else
         {
-            char *message;
-            message = g_strdup_printf (_("Not a valid directory: %s"), path);
-            g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY,
-                                 message );
-            g_free (message);
+            cache_invalidate (cmis_backend, filename);
+            g_vfs_job_succeeded (G_VFS_JOB (job));
         }
-
-        libcmis_error_free (error);
     }
 
-    /* Clean up */
-    g_free (repository_id);
-    g_free (path);
-    g_print ("-do_enumerate\n");
+    if (updated)
+        libcmis_object_free (updated);
+    if (properties)
+        libcmis_vector_property_free (properties);
+    if (object_type)
+        libcmis_object_type_free (object_type);
+    libcmis_error_free (error);
+    libcmis_object_free (object);
+    release_session (cmis_backend, session);
+    g_free (type_id);
+
+    g_print ("-do_set_attribute\n");
 }
 
-static void
-do_set_display_name (GVfsBackend *backend,
-                     GVfsJobSetDisplayName *job,
-                     const char *filename,
-                     const char *display_name)
-{
-    g_print ("TODO Implement do_set_display_name\n");
-    g_vfs_job_succeeded (G_VFS_JOB (job));
-}
+/* Minimum time between two progress reports of push and pull */
+#define CMIS_PROGRESS_INTERVAL (G_USEC_PER_SEC / 10)
 
-static void
-do_delete (GVfsBackend *backend,
-           GVfsJobDelete *job,
-           const char *filename)
+/** State of a push or pull, shared with the libcmis stream callbacks. */
+typedef struct
 {
-    g_print ("TODO Implement do_delete\n");
-    g_vfs_job_succeeded (G_VFS_JOB (job));
-}
+    GVfsJob *job;
+    GInputStream *in_stream;
+    GOutputStream *out_stream;
+    /* Whether the stream can be cut short when the job is cancelled */
+    gboolean can_abort;
+    GError *error;
+
+    goffset current;
+    goffset total;
+    gint64 last_progress;
+    GFileProgressCallback progress_callback;
+    gpointer progress_callback_data;
+} CmisTransfer;
 
 static void
-do_make_directory (GVfsBackend *backend,
-                   GVfsJobMakeDirectory *job,
-                   const char *filename)
+transfer_progress (CmisTransfer *transfer, gboolean force)
 {
-    g_print ("TODO Implement do_make_directory\n");
-    g_vfs_job_succeeded (G_VFS_JOB (job));
+    gint64 now;
+
+    if (transfer->progress_callback == NULL)
+        return;
+
+    now = g_get_monotonic_time ();
+    if (!force && now - transfer->last_progress < CMIS_PROGRESS_INTERVAL)
+        return;
+
+    transfer->last_progress = now;
+    transfer->progress_callback (transfer->current,
+                                 MAX (transfer->total, transfer->current),
+                                 transfer->progress_callback_data);
 }
 
-static void
-do_move (GVfsBackend *backend,
-         GVfsJobMove *job,
-         const char *source,
-         const char *destination,
-         GFileCopyFlags flags,
-         GFileProgressCallback progress_callback,
-         gpointer progress_callback_data)
+/* libcmis ignores the result of the callback, thus the remaining data is
+ * just dropped after an error. */
+static size_t
+transfer_write (const void* ptr, size_t size, size_t nmemb, void* data)
 {
-    g_print ("TODO Implement do_move\n");
-    g_vfs_job_succeeded (G_VFS_JOB (job));
+    CmisTransfer *transfer = data;
+    gsize bytes_written = 0;
+
+    if (transfer->error != NULL)
+        return 0;
+
+    if (!g_output_stream_write_all (transfer->out_stream, ptr, size * nmemb,
+                                    &bytes_written, transfer->job->cancellable,
+                                    &transfer->error))
+        return 0;
+
+    transfer->current += bytes_written;
+    transfer_progress (transfer, FALSE);
+
+    return nmemb;
 }
 
-static gboolean
-try_query_settable_attributes (GVfsBackend *backend,
-			       GVfsJobQueryAttributes *job,
-			       const char *filename)
+/* Returning 0 ends the content sent by libcmis */
+static size_t
+transfer_read (void* ptr, size_t size, size_t nmemb, void* data)
 {
-    g_print ("TODO Implement try_query_settable_attributes\n");
-    g_vfs_job_succeeded (G_VFS_JOB (job));
+    CmisTransfer *transfer = data;
+    gsize bytes_read = 0;
+
+    if (transfer->error != NULL)
+        return 0;
+
+    if (!g_input_stream_read_all (transfer->in_stream, ptr, size * nmemb, &bytes_read,
+                                  transfer->can_abort ? transfer->job->cancellable : NULL,
+                                  &transfer->error))
+        return 0;
+
+    transfer->current += bytes_read;
+    transfer_progress (transfer, FALSE);
+
+    return bytes_read / size;
 }
 
+/** Throw away a partially pulled file.
+
+    Closing with a cancelled cancellable makes a replacing stream drop its
+    temporary file and leave the original one in place.
+  */
 static void
-do_set_attribute (GVfsBackend *backend,
-                  GVfsJobSetAttribute *job,
-                  const char *filename,
-                  const char *attribute,
-                  GFileAttributeType type,
-                  gpointer value_p,
-                  GFileQueryInfoFlags flags)
+pull_abort (GFile *file, GFileOutputStream *stream, gboolean created)
 {
-    g_print ("TODO Implement do_set_attribute\n");
-    g_vfs_job_succeeded (G_VFS_JOB (job));
+    GCancellable *abort;
+
+    abort = g_cancellable_new ();
+    g_cancellable_cancel (abort);
+    g_output_stream_close (G_OUTPUT_STREAM (stream), abort, NULL);
+    g_object_unref (abort);
+
+    if (created)
+        g_file_delete (file, NULL, NULL);
 }
 
 static void
@@ -1178,93 +3107,368 @@ do_pull (GVfsBackend *         backend,
          gpointer              progress_callback_data)
 {
     GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+    GCancellable *cancellable = G_VFS_JOB (job)->cancellable;
     GError *gerror = NULL;
     libcmis_ObjectPtr object = NULL;
-    libcmis_DocumentPtr document = NULL;
+    libcmis_DocumentPtr document;
     char *repository_id = NULL;
     char *path = NULL;
-    libcmis_ErrorPtr error;
-    GFile *file;
-    GFileOutputStream *stream;
-
-    g_print ("+do_pull\n");
-    if (!is_cmis_session_ready (cmis_backend, G_VFS_JOB (job)))
+    libcmis_ErrorPtr error = NULL;
+    GFile *file = NULL;
+    GFileOutputStream *stream = NULL;
+    libcmis_SessionPtr session;
+    CmisTransfer transfer;
+
+    g_print ("+do_pull: %s -> %s\n", filename, local_path);
+    session = acquire_session (cmis_backend, G_VFS_JOB (job));
+    if (session == NULL)
         return;
 
+    repository_id = extract_repository_from_path (filename, &path);
+    if (!path || strlen (path) == 0)
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+                          _("Can't recursively copy directory"));
+        goto out;
+    }
+
+    object = get_cmis_object (G_VFS_JOB (job), session, repository_id, path);
+    if (object == NULL)
+        goto out;
+
+    if (libcmis_is_folder (object))
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+                          _("Can't recursively copy directory"));
+        goto out;
+    }
+    if (!libcmis_is_document (object))
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
+                          _("Not a regular file"));
+        goto out;
+    }
+    document = libcmis_document_cast (object);
+
     file = g_file_new_for_path (local_path);
     if (flags & G_FILE_COPY_OVERWRITE)
-      stream = g_file_replace (file,
-			       NULL, /* We don't have etags */
-			       flags & G_FILE_COPY_BACKUP ? TRUE : FALSE,
-			       G_FILE_CREATE_REPLACE_DESTINATION,
-			       NULL, /* We can't cancel yet */
-			       &gerror);
+        stream = g_file_replace (file,
+                                 NULL,
+                                 flags & G_FILE_COPY_BACKUP ? TRUE : FALSE,
+                                 G_FILE_CREATE_REPLACE_DESTINATION,
+                                 cancellable,
+                                 &gerror);
     else
-      stream = g_file_create (file,
-			      G_FILE_CREATE_NONE,
-			      NULL, /* We can't cancel yet */
-			      &gerror);
-    
-    if (stream == NULL) 
-      {
-	g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
-			  G_IO_ERROR_INVALID_ARGUMENT,
-			  _("File could not be created"));
-	goto do_pull_finish;
-      }
+        stream = g_file_create (file,
+                                G_FILE_CREATE_NONE,
+                                cancellable,
+                                &gerror);
+    if (stream == NULL)
+    {
+        g_vfs_job_failed_from_error (G_VFS_JOB (job), gerror);
+        g_error_free (gerror);
+        goto out;
+    }
 
-    repository_id = extract_repository_from_path (filename, &path);
-    if (!path || strlen (path) == 0)
+    memset (&transfer, 0, sizeof (transfer));
+    transfer.job = G_VFS_JOB (job);
+    transfer.out_stream = G_OUTPUT_STREAM (stream);
+    transfer.total = libcmis_document_getContentLength (document);
+    transfer.progress_callback = progress_callback;
+    transfer.progress_callback_data = progress_callback_data;
+
+    /* Stream the content straight into the local file */
+    error = libcmis_error_create ();
+    libcmis_document_getContentStream (document, transfer_write, &transfer, error);
+
+    if (transfer.error != NULL)
     {
-        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
-                _("Root folder can't be opened for reading"));
-	goto do_pull_finish;
+        pull_abort (file, stream, !(flags & G_FILE_COPY_OVERWRITE));
+        g_vfs_job_failed_from_error (G_VFS_JOB (job), transfer.error);
+        g_error_free (transfer.error);
+        goto out;
+    }
+    if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
+    {
+        pull_abort (file, stream, !(flags & G_FILE_COPY_OVERWRITE));
+        output_cmis_error (G_VFS_JOB (job), error);
+        goto out;
     }
-    
-    object = get_cmis_object (G_VFS_JOB (job), cmis_backend->session, repository_id, path);
 
-    if (!object || !libcmis_is_document (object))
-      {
-	output_cmis_error (G_VFS_JOB (job), error);
-	goto do_pull_finish;
-      }
+    if (!g_output_stream_close (G_OUTPUT_STREAM (stream), cancellable, &gerror))
+    {
+        g_vfs_job_failed_from_error (G_VFS_JOB (job), gerror);
+        g_error_free (gerror);
+        goto out;
+    }
+    transfer_progress (&transfer, TRUE);
+
+    if (remove_source)
+    {
+        libcmis_object_remove (object, true, error);
+        if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
+        {
+            output_cmis_error (G_VFS_JOB (job), error);
+            goto out;
+        }
+        cache_invalidate (cmis_backend, filename);
+    }
+
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+
+out:
+    if (stream)
+        g_object_unref (stream);
+    if (file)
+        g_object_unref (file);
+    if (object)
+        libcmis_object_free (object);
+    if (error)
+        libcmis_error_free (error);
+    release_session (cmis_backend, session);
+    g_free (path);
+    g_free (repository_id);
+    g_print ("-do_pull\n");
+}
+
+static void
+do_push (GVfsBackend *         backend,
+         GVfsJobPush *         job,
+         const char *          destination,
+         const char *          local_path,
+         GFileCopyFlags        flags,
+         gboolean              remove_source,
+         GFileProgressCallback progress_callback,
+         gpointer              progress_callback_data)
+{
+    GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (backend);
+    GCancellable *cancellable = G_VFS_JOB (job)->cancellable;
+    GError *gerror = NULL;
+    libcmis_SessionPtr session;
+    libcmis_ObjectPtr parent = NULL;
+    libcmis_ObjectPtr object = NULL;
+    libcmis_DocumentPtr document = NULL;
+    libcmis_ErrorPtr error = NULL;
+    char *repository_id = NULL;
+    char *path = NULL;
+    char *name = NULL;
+    char *content_type = NULL;
+    GFile *file;
+    GFileInputStream *stream = NULL;
+    GFileInfo *info = NULL;
+    CmisTransfer transfer;
+
+    g_print ("+do_push: %s -> %s\n", local_path, destination);
+
+    file = g_file_new_for_path (local_path);
+    stream = g_file_read (file, cancellable, &gerror);
+    if (stream == NULL)
+    {
+        g_vfs_job_failed_from_error (G_VFS_JOB (job), gerror);
+        g_error_free (gerror);
+        g_object_unref (file);
+        return;
+    }
+
+    info = g_file_input_stream_query_info (stream,
+                                           G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                           G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                                           G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
+                                           cancellable, &gerror);
+    if (info == NULL)
+    {
+        g_vfs_job_failed_from_error (G_VFS_JOB (job), gerror);
+        g_error_free (gerror);
+        g_object_unref (stream);
+        g_object_unref (file);
+        return;
+    }
+    if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+                          _("Can't recursively copy directory"));
+        g_object_unref (info);
+        g_object_unref (stream);
+        g_object_unref (file);
+        return;
+    }
+
+    session = acquire_session (cmis_backend, G_VFS_JOB (job));
+    if (session == NULL)
+    {
+        g_object_unref (info);
+        g_object_unref (stream);
+        g_object_unref (file);
+        return;
+    }
 
-    document = libcmis_document_cast (object);
     error = libcmis_error_create ();
-    
-    /* Get the content stream and write it to the GIOStream */
-    libcmis_document_getContentStream (document, write_to_g_output_stream, stream, error);
-    
-    if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL) 
-      {
-	output_cmis_error (G_VFS_JOB (job), error);
-	goto do_pull_finish;
-      }
-    
-    g_output_stream_close ((GOutputStream*) stream, NULL, &gerror);
-    if (gerror)
-      {
+    repository_id = extract_repository_from_path (destination, &path);
+    name = g_path_get_basename (path);
+
+    parent = get_parent_folder (G_VFS_JOB (job), session, destination);
+    if (parent == NULL)
+        goto out;
+
+    /* Don't use get_cmis_object here: a missing file is fine */
+    object = libcmis_session_getObjectByPath (session, path, error);
+    if (object == NULL)
+    {
+        if (libcmis_error_getType (error) != NULL &&
+            cmis_error_to_io_error (libcmis_error_getType (error)) != G_IO_ERROR_NOT_FOUND)
+        {
+            output_cmis_error (G_VFS_JOB (job), error);
+            goto out;
+        }
+        libcmis_error_free (error);
+        error = libcmis_error_create ();
+    }
+    else if (!(flags & G_FILE_COPY_OVERWRITE))
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_EXISTS,
+                          _("Target file already exists"));
+        goto out;
+    }
+    else if (libcmis_is_folder (object))
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY,
+                          _("Can't copy file over directory"));
+        goto out;
+    }
+    else if (!libcmis_is_document (object))
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
+                          _("Not a regular file"));
+        goto out;
+    }
+    else if (flags & G_FILE_COPY_BACKUP)
+    {
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_CANT_CREATE_BACKUP,
+                          _("Backups not supported"));
+        goto out;
+    }
+
+    if (g_cancellable_set_error_if_cancelled (cancellable, &gerror))
+    {
         g_vfs_job_failed_from_error (G_VFS_JOB (job), gerror);
-	goto do_pull_finish;
-      }
+        g_error_free (gerror);
+        goto out;
+    }
+
+    memset (&transfer, 0, sizeof (transfer));
+    transfer.job = G_VFS_JOB (job);
+    transfer.in_stream = G_INPUT_STREAM (stream);
+    transfer.total = g_file_info_get_size (info);
+    transfer.progress_callback = progress_callback;
+    transfer.progress_callback_data = progress_callback_data;
+
+    if (object)
+    {
+        /* libcmis can't abort an upload: a cancelled overwrite would
+         * replace the content by its beginning, so let it complete */
+        document = libcmis_document_cast (object);
+        content_type = libcmis_document_getContentType (document);
+        libcmis_document_setContentStream (document, transfer_read, &transfer,
+                                           content_type, name, true, error);
+        document = NULL;
+    }
+    else
+    {
+        libcmis_vector_property_Ptr properties;
+
+        transfer.can_abort = TRUE;
+        content_type = g_strdup (g_file_info_get_content_type (info));
+        if (content_type == NULL)
+            content_type = g_content_type_guess (name, NULL, 0, NULL);
+        properties = create_name_properties (session, "cmis:document",
+                                             name, true, error);
+        if (properties)
+        {
+            document = libcmis_folder_createDocument (libcmis_folder_cast (parent),
+                                                      properties,
+                                                      transfer_read, &transfer,
+                                                      content_type, name, error);
+            libcmis_vector_property_free (properties);
+        }
+    }
+
+    /* Only now, or a stat during the upload would cache the old infos */
+    cache_invalidate (cmis_backend, destination);
+
+    if (transfer.error != NULL)
+    {
+        /* Don't leave a truncated document behind */
+        if (document)
+        {
+            libcmis_ErrorPtr remove_error = libcmis_error_create ();
+            /* Documents are objects */
+            libcmis_object_remove ((libcmis_ObjectPtr) document, true, remove_error);
+            libcmis_error_free (remove_error);
+        }
+        g_vfs_job_failed_from_error (G_VFS_JOB (job), transfer.error);
+        g_error_free (transfer.error);
+        goto out;
+    }
+    if (libcmis_error_getMessage (error) != NULL || libcmis_error_getType(error) != NULL)
+    {
+        output_cmis_error (G_VFS_JOB (job), error);
+        goto out;
+    }
+    transfer_progress (&transfer, TRUE);
 
     if (remove_source)
-      {
-	/* FIXME: We need to initiate a delete operation */
-      }
+    {
+        g_input_stream_close (G_INPUT_STREAM (stream), NULL, NULL);
+        if (!g_file_delete (file, cancellable, &gerror))
+        {
+            g_vfs_job_failed_from_error (G_VFS_JOB (job), gerror);
+            g_error_free (gerror);
+            goto out;
+        }
+    }
 
     g_vfs_job_succeeded (G_VFS_JOB (job));
 
- do_pull_finish:
+out:
+    if (document)
+        libcmis_document_free (document);
+    if (object)
+        libcmis_object_free (object);
+    if (parent)
+        libcmis_object_free (parent);
+    libcmis_error_free (error);
+    release_session (cmis_backend, session);
+    g_object_unref (info);
+    g_object_unref (stream);
     g_object_unref (file);
-    g_print ("-do_pull\n");
+    g_free (content_type);
+    g_free (name);
+    g_free (path);
+    g_free (repository_id);
+    g_print ("-do_push\n");
 }
 
 static void
 g_vfs_backend_cmis_init (GVfsBackendCmis *cmis_backend)
 {
-    cmis_backend->session = NULL; 
+    const char *ttl;
+
     cmis_backend->display_name = NULL;
+
+    g_mutex_init (&cmis_backend->pool_lock);
+    g_cond_init (&cmis_backend->pool_cond);
+    g_queue_init (&cmis_backend->idle_sessions);
+
+    cmis_backend->cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 g_free, cache_entry_free);
+    cmis_backend->listings = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free, cache_listing_free);
+    g_mutex_init (&cmis_backend->cache_lock);
+
+    ttl = g_getenv ("GVFS_CMIS_CACHE_TTL");
+    cmis_backend->cache_ttl = (ttl ? g_ascii_strtoll (ttl, NULL, 10) : CMIS_CACHE_DEFAULT_TTL) * G_USEC_PER_SEC;
+    if (cmis_backend->cache_ttl < 0)
+        cmis_backend->cache_ttl = 0;
 }
 
 static void
@@ -1273,11 +3477,19 @@ g_vfs_backend_cmis_finalize (GObject *object)
     GVfsBackendCmis *cmis_backend = G_VFS_BACKEND_CMIS (object);
 
     /* Should have been done by do_unmount, but better be sure it's clean */
-    if (cmis_backend->session)
-        libcmis_session_free (cmis_backend->session);
+    close_sessions (cmis_backend);
+    g_mutex_clear (&cmis_backend->pool_lock);
+    g_cond_clear (&cmis_backend->pool_cond);
 
     if (cmis_backend->display_name)
         g_free (cmis_backend->display_name);
+    g_free (cmis_backend->binding_url);
+    g_free (cmis_backend->username);
+    g_free (cmis_backend->password);
+
+    g_hash_table_destroy (cmis_backend->cache);
+    g_hash_table_destroy (cmis_backend->listings);
+    g_mutex_clear (&cmis_backend->cache_lock);
     
     G_OBJECT_CLASS (g_vfs_backend_cmis_parent_class)->finalize (object);
 }
@@ -1290,6 +3502,11 @@ g_vfs_backend_cmis_class_init (GVfsBackendCmisClass *klass)
 
     gobject_class->finalize = g_vfs_backend_cmis_finalize;
 
+    /* Each job uses its own session */
+    backend_class->max_job_threads = CMIS_MAX_SESSIONS;
+    /* do_read is fed by the download thread, don't let it wait for the client */
+    backend_class->read_pipeline_depth = 4;
+
     backend_class->mount = do_mount;
     backend_class->try_mount = NULL;
     backend_class->unmount = do_unmount;
@@ -1302,13 +3519,18 @@ g_vfs_backend_cmis_class_init (GVfsBackendCmisClass *klass)
     backend_class->replace = do_replace;
     backend_class->close_write = do_close_write;
     backend_class->write = do_write;
+    backend_class->seek_on_write = do_seek_on_write;
     backend_class->query_info = do_query_info;
+    backend_class->try_query_info = try_query_info;
     backend_class->enumerate = do_enumerate;
+    backend_class->try_enumerate = try_enumerate;
     backend_class->set_display_name = do_set_display_name;
     backend_class->delete = do_delete;
     backend_class->make_directory = do_make_directory;
     backend_class->move = do_move;
     backend_class->try_query_settable_attributes = try_query_settable_attributes;
+    backend_class->try_query_writable_namespaces = try_query_writable_namespaces;
     backend_class->set_attribute = do_set_attribute;
     backend_class->pull = do_pull;
+    backend_class->push = do_push;
 }
@@ -42,8 +42,31 @@ typedef struct _GVfsBackendCmisClass    GVfsBackendCmisClass;
 struct _GVfsBackendCmis
 {
     GVfsBackend     backend;
-    libcmis_SessionPtr session;
     char* display_name;
+
+    /* Credentials used to open more sessions */
+    char *binding_url;
+    char *username;
+    char *password;
+
+    /* Pool of sessions, each job checks one out. Protected by pool_lock */
+    GMutex pool_lock;
+    GCond pool_cond;
+    GQueue idle_sessions;
+    guint n_sessions;
+    /* Sessions used by downloads, which count against the downloads limit
+     * instead of the sessions one */
+    guint n_streaming;
+    /* Downloads running or about to start */
+    guint n_downloads;
+    gboolean mounted;
+
+    /* Infos of the objects and children names of the folders, keyed by
+     * path. Protected by cache_lock */
+    GHashTable *cache;
+    GHashTable *listings;
+    GMutex cache_lock;
+    gint64 cache_ttl;
 };
 
 struct _GVfsBackendCmisClass
@@ -729,6 +729,9 @@ g_vfs_backend_http_class_init (GVfsBackendHttpClass *klass)
 
   backend_class = G_VFS_BACKEND_CLASS (klass); 
 
+  /* Keep a few reads in flight over the network, inherited by dav */
+  backend_class->read_pipeline_depth    = 4;
+
   backend_class->try_mount              = try_mount;
   backend_class->try_open_for_read      = try_open_for_read;
   backend_class->try_read               = try_read;
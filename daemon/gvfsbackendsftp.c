@@ -79,6 +79,13 @@
 
 #define SFTP_READ_TIMEOUT 40   /* seconds */
 
+/* Like the OpenSSH sftp client, keep several requests per handle in
+ * flight so that streaming isn't limited to one block per round trip */
+#define READ_AHEAD_BLOCK_SIZE (32*1024)
+#define READ_AHEAD_MIN_REQUESTS 2
+#define READ_AHEAD_MAX_REQUESTS 16
+#define MAX_PENDING_WRITES 16
+
 static GQuark id_q;
 
 typedef enum {
@@ -133,8 +140,33 @@ typedef struct {
   char *tempname;
   guint32 permissions;
   gboolean make_backup;
+
+  /* Read-ahead: ReadAheadRequests in offset order, the head one
+   * starting at offset. read_job waits for the head to arrive. */
+  GQueue read_ahead;
+  guint read_ahead_window;
+  GVfsJobRead *read_job;
+
+  /* Write-behind: writes are acknowledged before the server replies,
+   * the first error is kept and reported by later writes and close */
+  guint n_pending_writes;
+  GError *write_error;
+  GVfsJob *write_job;
+  GVfsJob *close_job;
 } SftpHandle;
 
+typedef struct {
+  SftpHandle *handle; /* NULL once abandoned */
+  goffset offset;
+  guint32 size;
+  gboolean done;
+  gboolean eof;
+  GError *error;
+  guchar *data;
+  guint32 data_len;
+  guint32 consumed;
+} ReadAheadRequest;
+
 
 typedef struct {
   ReplyCallback callback;
@@ -1128,6 +1160,40 @@ handle_login (GVfsBackend *backend,
   return ret_val;
 }
 
+static void read_ahead_reply (GVfsBackendSftp *backend, int reply_type, GDataInputStream *reply,
+                              guint32 len, GVfsJob *job, gpointer user_data);
+static void write_reply (GVfsBackendSftp *backend, int reply_type, GDataInputStream *reply,
+                         guint32 len, GVfsJob *job, gpointer user_data);
+
+/* Jobs parked on a handle have no reply of their own to wait for */
+static void
+fail_waiting_jobs (SftpHandle *handle, GError *error)
+{
+  GVfsJob *job;
+
+  if (handle->read_job != NULL)
+    {
+      job = G_VFS_JOB (handle->read_job);
+      handle->read_job = NULL;
+      g_vfs_job_failed_from_error (job, error);
+    }
+
+  if (handle->write_job != NULL)
+    {
+      job = handle->write_job;
+      handle->write_job = NULL;
+      g_vfs_job_failed_from_error (job, error);
+    }
+
+  if (handle->close_job != NULL)
+    {
+      job = handle->close_job;
+      handle->close_job = NULL;
+      g_vfs_job_failed_from_error (job, error);
+      g_object_unref (job);
+    }
+}
+
 static void
 fail_jobs_and_die (GVfsBackendSftp *backend, GError *error)
 {
@@ -1138,7 +1204,20 @@ fail_jobs_and_die (GVfsBackendSftp *backend, GError *error)
   while (g_hash_table_iter_next (&iter, &key, &value))
     {
       ExpectedReply *expected_reply = (ExpectedReply *) value;
-      g_vfs_job_failed_from_error (expected_reply->job, error);
+
+      if (expected_reply->callback == read_ahead_reply)
+        {
+          ReadAheadRequest *request = expected_reply->user_data;
+
+          if (request->handle != NULL)
+            fail_waiting_jobs (request->handle, error);
+        }
+      else if (expected_reply->callback == write_reply)
+        fail_waiting_jobs (expected_reply->user_data, error);
+
+      /* Read-ahead and write-behind requests outlive their jobs */
+      if (!g_vfs_job_is_finished (expected_reply->job))
+        g_vfs_job_failed_from_error (expected_reply->job, error);
     }
 
   g_error_free (error);
@@ -2300,9 +2379,13 @@ sftp_handle_new (GDataInputStream *reply)
   return handle;
 }
 
+static void read_ahead_abandon (SftpHandle *handle);
+
 static void
 sftp_handle_free (SftpHandle *handle)
 {
+  read_ahead_abandon (handle);
+  g_clear_error (&handle->write_error);
   data_buffer_free (handle->raw_handle);
   g_free (handle->filename);
   g_free (handle->tempname);
@@ -2439,46 +2522,194 @@ try_open_for_read (GVfsBackend *backend,
 }
 
 static void
-read_reply (GVfsBackendSftp *backend,
-            int reply_type,
-            GDataInputStream *reply,
-            guint32 len,
-            GVfsJob *job,
-            gpointer user_data)
+read_ahead_request_free (ReadAheadRequest *request)
 {
-  SftpHandle *handle;
-  guint32 count;
-  
-  handle = user_data;
-  
-  if (reply_type == SSH_FXP_STATUS)
+  g_clear_error (&request->error);
+  g_free (request->data);
+  g_slice_free (ReadAheadRequest, request);
+}
+
+/* Drops all read-ahead, e.g. on seek. Requests still waiting for their
+ * reply are freed when it arrives. */
+static void
+read_ahead_abandon (SftpHandle *handle)
+{
+  ReadAheadRequest *request;
+
+  while ((request = g_queue_pop_head (&handle->read_ahead)) != NULL)
     {
-      result_from_status (job, reply, -1, SSH_FX_EOF);
-      return;
+      if (request->done)
+        read_ahead_request_free (request);
+      else
+        request->handle = NULL;
     }
 
-  if (reply_type != SSH_FXP_DATA)
+  handle->read_ahead_window = READ_AHEAD_MIN_REQUESTS;
+}
+
+static void
+read_ahead_refill (GVfsBackendSftp *backend,
+                   SftpHandle *handle,
+                   GVfsJob *job)
+{
+  ReadAheadRequest *request, *last;
+  GDataOutputStream *command;
+  goffset offset;
+
+  if (handle->read_ahead_window == 0)
+    handle->read_ahead_window = READ_AHEAD_MIN_REQUESTS;
+
+  while (g_queue_get_length (&handle->read_ahead) < handle->read_ahead_window)
     {
-      g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_FAILED,
-                        _("Invalid reply received"));
-      return;
+      last = g_queue_peek_tail (&handle->read_ahead);
+      if (last == NULL)
+        offset = handle->offset;
+      else if (last->done && (last->eof || last->error != NULL))
+        break; /* No point reading past the end */
+      else
+        offset = last->offset + last->size;
+
+      request = g_slice_new0 (ReadAheadRequest);
+      request->handle = handle;
+      request->offset = offset;
+      request->size = READ_AHEAD_BLOCK_SIZE;
+      g_queue_push_tail (&handle->read_ahead, request);
+
+      command = new_command_stream (backend,
+                                    SSH_FXP_READ);
+      put_data_buffer (command, handle->raw_handle);
+      g_data_output_stream_put_uint64 (command, request->offset, NULL, NULL);
+      g_data_output_stream_put_uint32 (command, request->size, NULL, NULL);
+
+      queue_command_stream_and_free (backend, command, read_ahead_reply, job, request);
     }
-  
-  count = g_data_input_stream_read_uint32 (reply, NULL, NULL);
+}
+
+/* Completes job from the head request if that has arrived */
+static gboolean
+read_ahead_complete_job (GVfsBackendSftp *backend,
+                         SftpHandle *handle,
+                         GVfsJobRead *job)
+{
+  ReadAheadRequest *request;
+  gsize count, total;
 
-  if (!g_input_stream_read_all (G_INPUT_STREAM (reply),
-                                G_VFS_JOB_READ (job)->buffer, count,
-                                NULL, NULL, NULL))
+  request = g_queue_peek_head (&handle->read_ahead);
+  if (request == NULL || !request->done)
+    return FALSE;
+
+  if (request->error)
     {
-      g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_FAILED,
-                        _("Invalid reply received"));
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), request->error);
+      read_ahead_abandon (handle);
+      return TRUE;
+    }
+
+  if (request->eof)
+    {
+      g_vfs_job_read_set_size (job, 0);
+      g_vfs_job_succeeded (G_VFS_JOB (job));
+      read_ahead_abandon (handle);
+      return TRUE;
+    }
+
+  /* Hand out as much as has arrived contiguously */
+  total = 0;
+  while (total < job->bytes_requested &&
+         (request = g_queue_peek_head (&handle->read_ahead)) != NULL &&
+         request->done && !request->eof && request->error == NULL)
+    {
+      count = MIN (job->bytes_requested - total, request->data_len - request->consumed);
+      memcpy (job->buffer + total, request->data + request->consumed, count);
+      request->consumed += count;
+      handle->offset += count;
+      total += count;
+
+      if (request->consumed < request->data_len)
+        break;
+
+      g_queue_pop_head (&handle->read_ahead);
+
+      if (request->data_len < request->size)
+        {
+          /* A short read leaves a hole before the next request, start over */
+          read_ahead_abandon (handle);
+        }
+      else if (handle->read_ahead_window < READ_AHEAD_MAX_REQUESTS)
+        {
+          /* Reading sequentially, keep more in flight */
+          handle->read_ahead_window = MIN (handle->read_ahead_window * 2,
+                                           READ_AHEAD_MAX_REQUESTS);
+        }
+
+      read_ahead_request_free (request);
+    }
+
+  read_ahead_refill (backend, handle, G_VFS_JOB (job));
+
+  g_vfs_job_read_set_size (job, total);
+  g_vfs_job_succeeded (G_VFS_JOB (job));
+
+  return TRUE;
+}
+
+static void
+read_ahead_reply (GVfsBackendSftp *backend,
+                  int reply_type,
+                  GDataInputStream *reply,
+                  guint32 len,
+                  GVfsJob *job,
+                  gpointer user_data)
+{
+  ReadAheadRequest *request = user_data;
+  SftpHandle *handle;
+  GVfsJobRead *read_job;
+  guint32 code;
+
+  handle = request->handle;
+  if (handle == NULL)
+    {
+      read_ahead_request_free (request);
       return;
     }
-  
-  handle->offset += count;
 
-  g_vfs_job_read_set_size (G_VFS_JOB_READ (job), count);
-  g_vfs_job_succeeded (job);
+  request->done = TRUE;
+
+  if (reply_type == SSH_FXP_STATUS)
+    {
+      code = read_status_code (reply);
+      if (code == SSH_FX_EOF)
+        request->eof = TRUE;
+      else if (error_from_status_code (job, code, -1, -1, &request->error))
+        /* OK is not a valid reply to a read */
+        g_set_error_literal (&request->error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             _("Invalid reply received"));
+    }
+  else if (reply_type == SSH_FXP_DATA)
+    {
+      request->data_len = g_data_input_stream_read_uint32 (reply, NULL, NULL);
+      request->data = g_malloc (MAX (request->data_len, 1));
+
+      if (request->data_len > request->size ||
+          !g_input_stream_read_all (G_INPUT_STREAM (reply),
+                                    request->data, request->data_len,
+                                    NULL, NULL, NULL))
+        g_set_error_literal (&request->error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             _("Invalid reply received"));
+      else if (request->data_len == 0)
+        request->eof = TRUE;
+    }
+  else
+    g_set_error_literal (&request->error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                         _("Invalid reply received"));
+
+  if (handle->read_job != NULL &&
+      request == g_queue_peek_head (&handle->read_ahead))
+    {
+      read_job = handle->read_job;
+      handle->read_job = NULL;
+      read_ahead_complete_job (backend, handle, read_job);
+    }
 }
 
 static gboolean
@@ -2490,15 +2721,12 @@ try_read (GVfsBackend *backend,
 {
   SftpHandle *handle = _handle;
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
-  GDataOutputStream *command;
 
-  command = new_command_stream (op_backend,
-                                SSH_FXP_READ);
-  put_data_buffer (command, handle->raw_handle);
-  g_data_output_stream_put_uint64 (command, handle->offset, NULL, NULL);
-  g_data_output_stream_put_uint32 (command, bytes_requested, NULL, NULL);
-  
-  queue_command_stream_and_free (op_backend, command, read_reply, G_VFS_JOB (job), handle);
+  if (g_queue_is_empty (&handle->read_ahead))
+    read_ahead_refill (op_backend, handle, G_VFS_JOB (job));
+
+  if (!read_ahead_complete_job (op_backend, handle, job))
+    handle->read_job = job;
 
   return TRUE;
 }
@@ -2572,6 +2800,9 @@ try_seek_on_read (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *command;
 
+  /* Whatever we read ahead is for the old position */
+  read_ahead_abandon (handle);
+
   command = new_command_stream (op_backend,
                                 SSH_FXP_FSTAT);
   put_data_buffer (command, handle->raw_handle);
@@ -2786,6 +3017,21 @@ close_write_reply (GVfsBackendSftp *backend,
     g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_FAILED,
 	                 _("Invalid reply received"));
 
+  if (res && handle->write_error)
+    {
+      res = FALSE;
+      if (handle->tempname)
+        /* Don't put an incomplete file in place of the original */
+        error = g_error_copy (handle->write_error);
+      else
+        /* Appending or replacing in place, the writes before the
+         * failed one already changed the file */
+        error = g_error_new (handle->write_error->domain,
+                             handle->write_error->code,
+                             _("The file was only partly written: %s"),
+                             handle->write_error->message);
+    }
+
   if (res)
     {
       if (handle->tempname)
@@ -2857,6 +3103,19 @@ close_write_fstat_reply (GVfsBackendSftp *backend,
   queue_command_stream_and_free (backend, command, close_write_reply, G_VFS_JOB (job), handle);
 }
 
+static void
+close_write_start (GVfsBackendSftp *backend,
+                   SftpHandle *handle,
+                   GVfsJob *job)
+{
+  GDataOutputStream *command;
+
+  command = new_command_stream (backend, SSH_FXP_FSTAT);
+  put_data_buffer (command, handle->raw_handle);
+
+  queue_command_stream_and_free (backend, command, close_write_fstat_reply, job, handle);
+}
+
 static gboolean
 try_close_write (GVfsBackend *backend,
                  GVfsJobCloseWrite *job,
@@ -2864,12 +3123,13 @@ try_close_write (GVfsBackend *backend,
 {
   SftpHandle *handle = _handle;
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
-  GDataOutputStream *command;
-
-  command = new_command_stream (op_backend, SSH_FXP_FSTAT);
-  put_data_buffer (command, handle->raw_handle);
 
-  queue_command_stream_and_free (op_backend, command, close_write_fstat_reply, G_VFS_JOB (job), handle);
+  /* Let the writes we already acknowledged finish first, so that
+   * their errors are reported here */
+  if (handle->n_pending_writes > 0)
+    handle->close_job = g_object_ref (job);
+  else
+    close_write_start (op_backend, handle, G_VFS_JOB (job));
 
   return TRUE;
 }
@@ -2904,6 +3164,8 @@ try_close_read (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *command;
 
+  read_ahead_abandon (handle);
+
   command = new_command_stream (op_backend, SSH_FXP_CLOSE);
   put_data_buffer (command, handle->raw_handle);
 
@@ -3531,19 +3793,47 @@ write_reply (GVfsBackendSftp *backend,
              gpointer user_data)
 {
   SftpHandle *handle;
-  
+  GError *error;
+  GVfsJob *waiting_job;
+
   handle = user_data;
+  handle->n_pending_writes--;
 
+  /* job was usually acknowledged already, so keep the error for later */
+  error = NULL;
   if (reply_type == SSH_FXP_STATUS)
+    error_from_status (job, reply, -1, -1, &error);
+  else
+    g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                         _("Invalid reply received"));
+
+  if (error != NULL)
     {
-      if (result_from_status (job, reply, -1, -1))
-        {
-          handle->offset += G_VFS_JOB_WRITE (job)->data_size;
-        }
+      if (handle->write_error == NULL)
+        handle->write_error = error;
+      else
+        g_error_free (error);
+    }
+
+  if (handle->write_job != NULL)
+    {
+      waiting_job = handle->write_job;
+      handle->write_job = NULL;
+
+      if (handle->write_error)
+        g_vfs_job_failed_from_error (waiting_job, handle->write_error);
+      else
+        g_vfs_job_succeeded (waiting_job);
+    }
+
+  if (handle->n_pending_writes == 0 && handle->close_job != NULL)
+    {
+      waiting_job = handle->close_job;
+      handle->close_job = NULL;
+
+      close_write_start (backend, handle, waiting_job);
+      g_object_unref (waiting_job);
     }
-  else
-    g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_FAILED,
-                      _("Invalid reply received"));
 }
 
 static gboolean
@@ -3557,6 +3847,12 @@ try_write (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *command;
 
+  if (handle->write_error)
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), handle->write_error);
+      return TRUE;
+    }
+
   command = new_command_stream (op_backend,
                                 SSH_FXP_WRITE);
   put_data_buffer (command, handle->raw_handle);
@@ -3570,9 +3866,18 @@ try_write (GVfsBackend *backend,
   
   queue_command_stream_and_free (op_backend, command, write_reply, G_VFS_JOB (job), handle);
 
+  handle->offset += buffer_size;
+  handle->n_pending_writes++;
+
   /* We always write the full size (on success) */
   g_vfs_job_write_set_written_size (job, buffer_size);
 
+  /* Acknowledge right away unless too much is in flight already */
+  if (handle->n_pending_writes < MAX_PENDING_WRITES)
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+  else
+    handle->write_job = G_VFS_JOB (job);
+
   return TRUE;
 }
 
@@ -4651,6 +4956,9 @@ g_vfs_backend_sftp_class_init (GVfsBackendSftpClass *klass)
   
   gobject_class->finalize = g_vfs_backend_sftp_finalize;
 
+  /* Keep a few reads in flight over the network */
+  backend_class->read_pipeline_depth = 4;
+
   backend_class->mount = real_do_mount;
   backend_class->try_mount = try_mount;
   backend_class->try_unmount = try_unmount;
@@ -28,6 +28,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 
 #include <glib.h>
@@ -38,6 +39,7 @@
 #include <gio/gunixoutputstream.h>
 #include <gvfsdaemonprotocol.h>
 #include <gvfsdaemonutils.h>
+#include <gvfsjobread.h>
 #include <gvfsjobcloseread.h>
 #include <gvfsjobclosewrite.h>
 #include <gvfsjoberror.h>
@@ -81,6 +83,19 @@ typedef struct {
   gboolean cancelled;
 } Request;
 
+typedef struct {
+  GVfsChannel *channel;
+  GVfsJob *job; /* NULL if not sent by a job */
+
+  char header[G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE];
+  int header_pos;
+
+  const char *data; /* Owned by job, or by the reply if free_data is set */
+  gsize data_size;
+  gsize data_pos;
+  GDestroyNotify free_data;
+} Reply;
+
 struct _GVfsChannelPrivate
 {
   GVfsBackend *backend;
@@ -96,16 +111,20 @@ struct _GVfsChannelPrivate
   guint32 current_job_seq_nr;
 
   GList *queued_requests;
-  
-  char reply_buffer[G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE];
-  int reply_buffer_pos;
-  
-  const char *output_data; /* Owned by job */
-  gsize output_data_size;
-  gsize output_data_pos;
+
+  /* Replies waiting to be written, the head one is being written. Successful
+   * reads don't wait for their reply to be written before the next job
+   * starts, so the backend works on the next block meanwhile. */
+  GQueue replies;
 };
 
 static void start_request_reader       (GVfsChannel  *channel);
+static void queue_reply                (GVfsChannel  *channel,
+					GVfsJob      *job,
+					GVfsDaemonSocketProtocolReply *header,
+					const void   *data,
+					gsize         data_len,
+					GDestroyNotify free_data);
 static void g_vfs_channel_get_property (GObject      *object,
 					guint         prop_id,
 					GValue       *value,
@@ -126,6 +145,8 @@ g_vfs_channel_finalize (GObject *object)
   if (channel->priv->current_job)
     g_object_unref (channel->priv->current_job);
   channel->priv->current_job = NULL;
+
+  g_assert (g_queue_is_empty (&channel->priv->replies));
   
   if (channel->priv->reply_stream)
     g_object_unref (channel->priv->reply_stream);
@@ -198,6 +219,7 @@ g_vfs_channel_init (GVfsChannel *channel)
 					       G_VFS_TYPE_CHANNEL,
 					       GVfsChannelPrivate);
   channel->priv->remote_fd = -1;
+  g_queue_init (&channel->priv->replies);
 
   ret = socketpair (AF_UNIX, SOCK_STREAM, 0, socket_fds);
   if (ret == -1) 
@@ -371,7 +393,7 @@ got_request (GVfsChannel *channel,
 			   "Channel blocked");
       seq_nr = g_ntohl (request->seq_nr);
       data = g_error_to_daemon_reply (err, seq_nr, &data_len);
-      g_vfs_channel_send_reply (channel, NULL, data, data_len);
+      queue_reply (channel, NULL, NULL, data, data_len, g_free);
       g_error_free (err);
       return;
     }
@@ -552,93 +574,279 @@ start_request_reader (GVfsChannel *channel)
 }
 
 static void
-send_reply_cb (GObject *source_object,
-	       GAsyncResult *res,
-	       gpointer user_data)
+reply_free (Reply *reply)
+{
+  if (reply->free_data)
+    reply->free_data ((gpointer) reply->data);
+  if (reply->job)
+    g_object_unref (reply->job);
+  g_object_unref (reply->channel);
+  g_free (reply);
+}
+
+/* Start the job following the finished current one */
+static void
+start_next_job (GVfsChannel *channel,
+		GVfsJob     *finished_job)
 {
-  GOutputStream *output_stream = G_OUTPUT_STREAM (source_object);
-  gssize bytes_written;
-  GVfsChannel *channel = user_data;
   GVfsChannelClass *class;
-  GVfsJob *job;
 
-  bytes_written = g_output_stream_write_finish (output_stream, res, NULL);
-  
-  if (bytes_written <= 0)
+  class = G_VFS_CHANNEL_GET_CLASS (channel);
+
+  if (channel->priv->connection_closed)
     {
-      g_vfs_channel_connection_closed (channel);
-      goto error_out;
+      if (channel->priv->backend_handle != NULL)
+	{
+	  channel->priv->current_job = class->close (channel);
+	  channel->priv->current_job_seq_nr = 0;
+	  g_vfs_job_source_new_job (G_VFS_JOB_SOURCE (channel), channel->priv->current_job);
+	}
     }
+  /* Start queued request or readahead */
+  else if (!start_queued_request (channel) &&
+	   class->readahead)
+    {
+      /* No queued requests, maybe we want to do a readahead call */
+      channel->priv->current_job = class->readahead (channel, finished_job);
+      channel->priv->current_job_seq_nr = 0;
+      if (channel->priv->current_job)
+	g_vfs_job_source_new_job (G_VFS_JOB_SOURCE (channel), channel->priv->current_job);
+    }
+}
+
+/* Whether the next job can start before the reply of job is written */
+static gboolean
+can_pipeline_reply (GVfsChannel *channel,
+		    GVfsJob     *job)
+{
+  GVfsBackendClass *backend_class;
+  guint depth;
 
-  if (channel->priv->reply_buffer_pos < G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE)
+  if (job->failed || !G_VFS_IS_JOB_READ (job) ||
+      channel->priv->connection_closed)
+    return FALSE;
+
+  backend_class = G_VFS_BACKEND_GET_CLASS (channel->priv->backend);
+  depth = MAX (backend_class->read_pipeline_depth, 1);
+
+  return g_queue_get_length (&channel->priv->replies) < depth;
+}
+
+/* Replies gathered into a single sendmsg() */
+#define MAX_REPLY_IOV 32
+
+static void write_replies (GVfsChannel *channel);
+
+static gboolean
+reply_stream_writable_cb (GObject  *stream,
+			  gpointer  user_data)
+{
+  write_replies (G_VFS_CHANNEL (user_data));
+  return FALSE;
+}
+
+static gboolean
+reply_is_written (Reply *reply)
+{
+  return reply->header_pos == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE &&
+    (reply->data == NULL || reply->data_pos == reply->data_size);
+}
+
+/* Called when a reply is fully written, or can't be written anymore */
+static void
+reply_done (GVfsChannel *channel,
+	    Reply       *reply)
+{
+  GVfsJob *job;
+
+  job = reply->job;
+
+  if (job != NULL)
     {
-      channel->priv->reply_buffer_pos += bytes_written;
+      g_vfs_job_emit_finished (job);
 
-      /* Write more of reply header if needed */
-      if (channel->priv->reply_buffer_pos < G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE)
+      if (G_VFS_IS_JOB_CLOSE_READ (job) ||
+	  G_VFS_IS_JOB_CLOSE_WRITE (job))
+	{
+	  /* Cancel the reader */
+	  g_cancellable_cancel (channel->priv->cancellable);
+	  g_vfs_job_source_closed (G_VFS_JOB_SOURCE (channel));
+	  channel->priv->backend_handle = NULL;
+	  if (job == channel->priv->current_job)
+	    {
+	      channel->priv->current_job = NULL;
+	      g_object_unref (job);
+	    }
+	}
+      else if (job == channel->priv->current_job)
 	{
-	  g_output_stream_write_async (channel->priv->reply_stream,
-				       channel->priv->reply_buffer + channel->priv->reply_buffer_pos,
-				       G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE - channel->priv->reply_buffer_pos,
-				       0, NULL,
-				       send_reply_cb, channel);  
-	  return;
+	  channel->priv->current_job = NULL;
+	  start_next_job (channel, job);
+	  g_object_unref (job);
 	}
-      bytes_written = 0;
+      /* Otherwise the next job was already started by queue_reply_cb */
     }
 
-  channel->priv->output_data_pos += bytes_written;
+  reply_free (reply);
+}
 
-  /* Write more of output_data if needed */
-  if (channel->priv->output_data != NULL &&
-      channel->priv->output_data_pos < channel->priv->output_data_size)
-    {
-      g_output_stream_write_async (channel->priv->reply_stream,
-				   channel->priv->output_data + channel->priv->output_data_pos,
-				   channel->priv->output_data_size - channel->priv->output_data_pos,
-				   0, NULL,
-				   send_reply_cb, channel);
-      return;
-    }
+/* Writes as much of the queued replies as the socket takes without
+ * blocking. The header and data of all the queued replies go out in a
+ * single sendmsg(), so a reply costs one syscall instead of two, and
+ * the small replies that pile up while the client is busy share one.
+ */
+static void
+write_replies (GVfsChannel *channel)
+{
+  struct iovec iov[MAX_REPLY_IOV];
+  struct msghdr msg;
+  GSource *source;
+  GList *l;
+  Reply *reply;
+  gssize res;
+  gsize len;
+  int fd, n;
 
- error_out:
-  
-  /* Sent full reply */
-  channel->priv->output_data = NULL;
+  fd = g_unix_output_stream_get_fd (G_UNIX_OUTPUT_STREAM (channel->priv->reply_stream));
 
-  job = channel->priv->current_job;
-  channel->priv->current_job = NULL;
-  g_vfs_job_emit_finished (job);
+  /* Finishing the last reply may drop the last other reference */
+  g_object_ref (channel);
 
-  class = G_VFS_CHANNEL_GET_CLASS (channel);
-  
-  if (G_VFS_IS_JOB_CLOSE_READ (job) ||
-      G_VFS_IS_JOB_CLOSE_WRITE (job))
-    {
-      /* Cancel the reader */
-      g_cancellable_cancel (channel->priv->cancellable);
-      g_vfs_job_source_closed (G_VFS_JOB_SOURCE (channel));
-      channel->priv->backend_handle = NULL;
-    }
-  else if (channel->priv->connection_closed)
+  while (!g_queue_is_empty (&channel->priv->replies))
     {
+      reply = g_queue_peek_head (&channel->priv->replies);
+      if (reply_is_written (reply))
+	{
+	  reply_done (channel, g_queue_pop_head (&channel->priv->replies));
+	  continue;
+	}
 
-      channel->priv->current_job = class->close (channel);
-      channel->priv->current_job_seq_nr = 0;
-      g_vfs_job_source_new_job (G_VFS_JOB_SOURCE (channel), channel->priv->current_job);
+      n = 0;
+      for (l = channel->priv->replies.head; l != NULL && n + 2 <= MAX_REPLY_IOV; l = l->next)
+	{
+	  reply = l->data;
+	  if (reply->header_pos < G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE)
+	    {
+	      iov[n].iov_base = reply->header + reply->header_pos;
+	      iov[n].iov_len = G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE - reply->header_pos;
+	      n++;
+	    }
+	  if (reply->data != NULL && reply->data_pos < reply->data_size)
+	    {
+	      iov[n].iov_base = (char *)reply->data + reply->data_pos;
+	      iov[n].iov_len = reply->data_size - reply->data_pos;
+	      n++;
+	    }
+	}
+
+      memset (&msg, 0, sizeof (msg));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = n;
+
+      res = sendmsg (fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+      if (res == -1 && errno == EINTR)
+	continue;
+
+      if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+	  /* Continue when the client read some, the head reply keeps the
+	     channel alive until then */
+	  source = g_pollable_output_stream_create_source (G_POLLABLE_OUTPUT_STREAM (channel->priv->reply_stream),
+							   NULL);
+	  g_source_set_callback (source, (GSourceFunc) reply_stream_writable_cb, channel, NULL);
+	  g_source_attach (source, NULL);
+	  g_source_unref (source);
+	  break;
+	}
+
+      if (res <= 0)
+	{
+	  g_vfs_channel_connection_closed (channel);
+	  reply_done (channel, g_queue_pop_head (&channel->priv->replies));
+	  continue;
+	}
+
+      /* Account for what was written, and finish the complete replies */
+      while (res > 0)
+	{
+	  reply = g_queue_peek_head (&channel->priv->replies);
+
+	  if (reply->header_pos < G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE)
+	    {
+	      len = MIN ((gsize) res, G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE - reply->header_pos);
+	      reply->header_pos += len;
+	      res -= len;
+	    }
+	  if (res > 0 && reply->data != NULL)
+	    {
+	      len = MIN ((gsize) res, reply->data_size - reply->data_pos);
+	      reply->data_pos += len;
+	      res -= len;
+	    }
+
+	  if (reply_is_written (reply))
+	    reply_done (channel, g_queue_pop_head (&channel->priv->replies));
+	}
     }
-  /* Start queued request or readahead */
-  else if (!start_queued_request (channel) &&
-	   class->readahead)
+
+  g_object_unref (channel);
+}
+
+/* Always called in the main thread */
+static gboolean
+queue_reply_cb (gpointer user_data)
+{
+  Reply *reply = user_data;
+  GVfsChannel *channel = reply->channel;
+  gboolean was_writing;
+
+  was_writing = !g_queue_is_empty (&channel->priv->replies);
+  g_queue_push_tail (&channel->priv->replies, reply);
+
+  if (reply->job != NULL &&
+      reply->job == channel->priv->current_job &&
+      can_pipeline_reply (channel, reply->job))
     {
-      /* No queued requests, maybe we want to do a readahead call */
-      channel->priv->current_job = class->readahead (channel, job);
-      channel->priv->current_job_seq_nr = 0;
-      if (channel->priv->current_job)
-	g_vfs_job_source_new_job (G_VFS_JOB_SOURCE (channel), channel->priv->current_job);
+      /* The reply keeps its own reference until it's written */
+      channel->priv->current_job = NULL;
+      start_next_job (channel, reply->job);
+      g_object_unref (reply->job);
     }
 
-  g_object_unref (job);
+  if (!was_writing)
+    write_replies (channel);
+
+  return FALSE;
+}
+
+/* Might be called on an i/o thread.
+ * The data of the replies of a job is owned by the job */
+static void
+queue_reply (GVfsChannel *channel,
+	     GVfsJob *job,
+	     GVfsDaemonSocketProtocolReply *header,
+	     const void *data,
+	     gsize data_len,
+	     GDestroyNotify free_data)
+{
+  Reply *reply;
+
+  reply = g_new0 (Reply, 1);
+  reply->channel = g_object_ref (channel);
+  if (job)
+    reply->job = g_object_ref (job);
+  reply->data = data;
+  reply->data_size = data_len;
+  reply->free_data = free_data;
+
+  if (header != NULL)
+    memcpy (reply->header, header, sizeof (GVfsDaemonSocketProtocolReply));
+  else
+    reply->header_pos = G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE;
+
+  /* The channel state is only handled in the main thread */
+  g_idle_add_full (G_PRIORITY_DEFAULT, queue_reply_cb, reply, NULL);
 }
 
 /* Might be called on an i/o thread */
@@ -648,31 +856,7 @@ g_vfs_channel_send_reply (GVfsChannel *channel,
 			  const void *data,
 			  gsize data_len)
 {
-  
-  channel->priv->output_data = data;
-  channel->priv->output_data_size = data_len;
-  channel->priv->output_data_pos = 0;
-
-  if (reply != NULL)
-    {
-      memcpy (channel->priv->reply_buffer, reply, sizeof (GVfsDaemonSocketProtocolReply));
-      channel->priv->reply_buffer_pos = 0;
-
-      g_output_stream_write_async (channel->priv->reply_stream,
-				   channel->priv->reply_buffer,
-				   G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE,
-				   0, NULL,
-				   send_reply_cb, channel);  
-    }
-  else
-    {
-      channel->priv->reply_buffer_pos = G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SIZE;
-      g_output_stream_write_async (channel->priv->reply_stream,
-				   channel->priv->output_data,
-				   channel->priv->output_data_size,
-				   0, NULL,
-				   send_reply_cb, channel);  
-    }
+  queue_reply (channel, channel->priv->current_job, reply, data, data_len, NULL);
 }
 
 /* Might be called on an i/o thread
@@ -685,7 +869,7 @@ g_vfs_channel_send_error (GVfsChannel *channel,
   gsize data_len;
   
   data = g_error_to_daemon_reply (error, channel->priv->current_job_seq_nr, &data_len);
-  g_vfs_channel_send_reply (channel, NULL, data, data_len);
+  queue_reply (channel, channel->priv->current_job, NULL, data, data_len, g_free);
 }
 
 /* Might be called on an i/o thread
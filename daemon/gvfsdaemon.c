@@ -232,7 +232,7 @@ static void
 g_vfs_daemon_init (GVfsDaemon *daemon)
 {
   GError *error;
-  gint max_threads = 1; /* TODO: handle max threads */
+  gint max_threads = 1; /* Raised by g_vfs_daemon_set_max_threads () */
 
   daemon->thread_pool = g_thread_pool_new (job_handler_callback,
 					   daemon,
@@ -33,6 +33,18 @@
 #include "gvfsdaemonprotocol.h"
 #include <gvfsdbus.h>
 
+/* The infos are sent in batches that start small, so that the first
+ * files show up quickly, and grow with each batch sent, up to a limit
+ * in number and in encoded size. */
+#define BATCH_SIZE_MIN 16
+#define BATCH_SIZE_MAX 1024
+#define BATCH_BYTES_MAX (256 * 1024)
+
+/* The client acknowledges a batch only when it has room for more
+ * infos, so a slow reader doesn't get the whole directory pushed into
+ * its memory. The batches it has no room for wait in the job. */
+#define MAX_PENDING_BATCHES 2
+
 G_DEFINE_TYPE (GVfsJobEnumerate, g_vfs_job_enumerate, G_VFS_TYPE_JOB_DBUS)
 
 static void         run        (GVfsJob        *job);
@@ -42,10 +54,25 @@ static void         create_reply (GVfsJob               *job,
                                   GVfsDBusMount         *object,
                                   GDBusMethodInvocation *invocation);
 
+typedef struct {
+  GVariant *infos;
+  /* Attribute names first used in infos, for GotInfoCompact */
+  char **new_attributes;
+} InfoBatch;
+
+static void
+info_batch_free (InfoBatch *batch)
+{
+  g_variant_unref (batch->infos);
+  g_strfreev (batch->new_attributes);
+  g_slice_free (InfoBatch, batch);
+}
+
 static void
 g_vfs_job_enumerate_finalize (GObject *object)
 {
   GVfsJobEnumerate *job;
+  InfoBatch *batch;
 
   job = G_VFS_JOB_ENUMERATE (object);
 
@@ -54,6 +81,13 @@ g_vfs_job_enumerate_finalize (GObject *object)
   g_file_attribute_matcher_unref (job->attribute_matcher);
   g_free (job->object_path);
   g_free (job->uri);
+  if (job->attribute_ids)
+    g_hash_table_unref (job->attribute_ids);
+  if (job->new_attributes)
+    g_ptr_array_unref (job->new_attributes);
+  while ((batch = g_queue_pop_head (&job->queued_batches)) != NULL)
+    info_batch_free (batch);
+  g_mutex_clear (&job->lock);
   
   if (G_OBJECT_CLASS (g_vfs_job_enumerate_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_job_enumerate_parent_class)->finalize) (object);
@@ -76,6 +110,9 @@ g_vfs_job_enumerate_class_init (GVfsJobEnumerateClass *klass)
 static void
 g_vfs_job_enumerate_init (GVfsJobEnumerate *job)
 {
+  job->batch_size = BATCH_SIZE_MIN;
+  g_mutex_init (&job->lock);
+  g_queue_init (&job->queued_batches);
 }
 
 gboolean 
@@ -103,9 +140,16 @@ g_vfs_job_enumerate_new_handle (GVfsDBusMount *object,
   job->backend = backend;
   job->attributes = g_strdup (arg_attributes);
   job->attribute_matcher = g_file_attribute_matcher_new (arg_attributes);
-  job->flags = arg_flags;
+  job->flags = arg_flags & ~G_VFS_DAEMON_ENUMERATE_FLAG_COMPACT_INFO;
   job->uri = g_strdup (arg_uri);
 
+  if (arg_flags & G_VFS_DAEMON_ENUMERATE_FLAG_COMPACT_INFO)
+    {
+      job->compact_infos = TRUE;
+      job->attribute_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      job->new_attributes = g_ptr_array_new ();
+    }
+
   g_vfs_job_source_new_job (G_VFS_JOB_SOURCE (backend), G_VFS_JOB (job));
   g_object_unref (job);
 
@@ -129,6 +173,32 @@ create_enumerator_proxy (GVfsJobEnumerate *job)
                                               NULL);
 }
 
+static void send_queued_batches (GVfsJobEnumerate *job);
+
+/* Called in the main thread */
+static void
+infos_sent (GVfsJobEnumerate *job,
+            GError *error)
+{
+  g_mutex_lock (&job->lock);
+  job->n_pending_batches--;
+  if (error != NULL)
+    job->client_failed = TRUE;
+  g_mutex_unlock (&job->lock);
+
+  if (error != NULL)
+    {
+      g_dbus_error_strip_remote_error (error);
+      g_warning ("send_infos_cb: %s (%s, %d)\n", error->message, g_quark_to_string (error->domain), error->code);
+      g_error_free (error);
+    }
+
+  /* The client has room again */
+  send_queued_batches (job);
+
+  g_object_unref (job);
+}
+
 static void
 send_infos_cb (GVfsDBusEnumerator *proxy,
                GAsyncResult *res,
@@ -137,31 +207,131 @@ send_infos_cb (GVfsDBusEnumerator *proxy,
   GError *error = NULL;
   
   gvfs_dbus_enumerator_call_got_info_finish (proxy, res, &error);
+  infos_sent (G_VFS_JOB_ENUMERATE (user_data), error);
+}
+
+static void
+send_infos_compact_cb (GVfsDBusEnumerator *proxy,
+                       GAsyncResult *res,
+                       gpointer user_data)
+{
+  GError *error = NULL;
+  
+  gvfs_dbus_enumerator_call_got_info_compact_finish (proxy, res, &error);
+  infos_sent (G_VFS_JOB_ENUMERATE (user_data), error);
+}
+
+static void
+send_done_cb (GVfsDBusEnumerator *proxy,
+               GAsyncResult *res,
+               gpointer user_data)
+{
+  GError *error = NULL;
+
+  gvfs_dbus_enumerator_call_done_finish (proxy, res, &error);
   if (error != NULL)
     {
       g_dbus_error_strip_remote_error (error);
-      g_warning ("send_infos_cb: %s (%s, %d)\n", error->message, g_quark_to_string (error->domain), error->code);
+      g_warning ("send_done_cb: %s (%s, %d)\n", error->message, g_quark_to_string (error->domain), error->code);
       g_error_free (error);
     }
 }
 
+/* Sends the queued batches the client has room for, then Done once
+ * everything went out. Never waits: the backend thread only queues, and
+ * the acknowledgements, handled in the main thread, send the rest. The
+ * lock is kept while sending so the calls go out in order. */
 static void
-send_infos (GVfsJobEnumerate *job)
+send_queued_batches (GVfsJobEnumerate *job)
 {
   GVfsDBusEnumerator *proxy;
+  InfoBatch *batch;
+
+  g_mutex_lock (&job->lock);
+
+  if (job->client_failed)
+    {
+      while ((batch = g_queue_pop_head (&job->queued_batches)) != NULL)
+        info_batch_free (batch);
+    }
+
+  if ((g_queue_is_empty (&job->queued_batches) ||
+       job->n_pending_batches >= MAX_PENDING_BATCHES) &&
+      !(job->done_queued && !job->done_sent &&
+        g_queue_is_empty (&job->queued_batches)))
+    {
+      g_mutex_unlock (&job->lock);
+      return;
+    }
 
   proxy = create_enumerator_proxy (job);
   g_assert (proxy != NULL);
-  
-  gvfs_dbus_enumerator_call_got_info (proxy,
-                                      g_variant_builder_end (job->building_infos),
+
+  /* The client holds back the reply while it is full */
+  g_dbus_proxy_set_default_timeout (G_DBUS_PROXY (proxy), G_MAXINT);
+
+  while (job->n_pending_batches < MAX_PENDING_BATCHES &&
+         (batch = g_queue_pop_head (&job->queued_batches)) != NULL)
+    {
+      job->n_pending_batches++;
+
+      if (job->compact_infos)
+        gvfs_dbus_enumerator_call_got_info_compact (proxy,
+                                                    (const gchar * const *) batch->new_attributes,
+                                                    batch->infos,
+                                                    NULL,
+                                                    (GAsyncReadyCallback) send_infos_compact_cb,
+                                                    g_object_ref (job));
+      else
+        gvfs_dbus_enumerator_call_got_info (proxy,
+                                            batch->infos,
+                                            NULL,
+                                            (GAsyncReadyCallback) send_infos_cb,
+                                            g_object_ref (job));
+      info_batch_free (batch);
+    }
+
+  if (job->done_queued && !job->done_sent &&
+      g_queue_is_empty (&job->queued_batches))
+    {
+      job->done_sent = TRUE;
+      g_dbus_proxy_set_default_timeout (G_DBUS_PROXY (proxy), -1);
+      gvfs_dbus_enumerator_call_done (proxy,
                                       NULL,
-                                      (GAsyncReadyCallback) send_infos_cb,
+                                      (GAsyncReadyCallback) send_done_cb,
                                       NULL);
+    }
+
+  g_mutex_unlock (&job->lock);
+
   g_object_unref (proxy);
+}
+
+/* Closes the batch being built and queues it for sending */
+static void
+queue_infos (GVfsJobEnumerate *job)
+{
+  InfoBatch *batch;
+
+  batch = g_slice_new0 (InfoBatch);
+  batch->infos = g_variant_ref_sink (g_variant_builder_end (job->building_infos));
+  if (job->compact_infos)
+    {
+      /* The names are owned by attribute_ids */
+      g_ptr_array_add (job->new_attributes, NULL);
+      batch->new_attributes = g_strdupv ((char **) job->new_attributes->pdata);
+      g_ptr_array_set_size (job->new_attributes, 0);
+    }
 
+  g_variant_builder_unref (job->building_infos);
   job->building_infos = NULL;
   job->n_building_infos = 0;
+  job->building_infos_size = 0;
+  job->batch_size = MIN (job->batch_size * 2, BATCH_SIZE_MAX);
+
+  g_mutex_lock (&job->lock);
+  g_queue_push_tail (&job->queued_batches, batch);
+  g_mutex_unlock (&job->lock);
 }
 
 void
@@ -173,7 +343,10 @@ g_vfs_job_enumerate_add_info (GVfsJobEnumerate *job,
   
   if (job->building_infos == NULL)
     {
-      job->building_infos = g_variant_builder_new (G_VARIANT_TYPE ("aa(suv)"));
+      if (job->compact_infos)
+        job->building_infos = g_variant_builder_new (G_VARIANT_TYPE ("aa(qyv)"));
+      else
+        job->building_infos = g_variant_builder_new (G_VARIANT_TYPE ("aa(suv)"));
       job->n_building_infos = 0;
     }
 
@@ -196,12 +369,20 @@ g_vfs_job_enumerate_add_info (GVfsJobEnumerate *job,
 
   g_file_info_set_attribute_mask (info, job->attribute_matcher);
 
-  v = _g_dbus_append_file_info (info);
+  if (job->compact_infos)
+    v = _g_dbus_append_file_info_compact (info, job->attribute_ids, job->new_attributes);
+  else
+    v = _g_dbus_append_file_info (info);
+  job->building_infos_size += g_variant_get_size (v);
   g_variant_builder_add_value (job->building_infos, v);
   job->n_building_infos++;
 
-  if (job->n_building_infos == 50)
-    send_infos (job);
+  if (job->n_building_infos >= job->batch_size ||
+      job->building_infos_size >= BATCH_BYTES_MAX)
+    {
+      queue_infos (job);
+      send_queued_batches (job);
+    }
 }
 
 void
@@ -218,40 +399,20 @@ g_vfs_job_enumerate_add_infos (GVfsJobEnumerate *job,
     }
 }
 
-static void
-send_done_cb (GVfsDBusEnumerator *proxy,
-               GAsyncResult *res,
-               gpointer user_data)
-{
-  GError *error = NULL;
-
-  gvfs_dbus_enumerator_call_done_finish (proxy, res, &error);
-  if (error != NULL)
-    {
-      g_dbus_error_strip_remote_error (error);
-      g_warning ("send_done_cb: %s (%s, %d)\n", error->message, g_quark_to_string (error->domain), error->code);
-      g_error_free (error);
-    }
-}
-
 void
 g_vfs_job_enumerate_done (GVfsJobEnumerate *job)
 {
-  GVfsDBusEnumerator *proxy;
-  
   g_assert (!G_VFS_JOB (job)->failed);
 
   if (job->building_infos != NULL)
-    send_infos (job);
-
-  proxy = create_enumerator_proxy (job);
-  g_assert (proxy != NULL);
-  
-  gvfs_dbus_enumerator_call_done (proxy,
-                                  NULL,
-                                  (GAsyncReadyCallback) send_done_cb,
-                                  NULL);
-  g_object_unref (proxy);
+    queue_infos (job);
+
+  /* Done goes out after the last batch, which may take the client a
+   * while, but the job is over as far as the backend is concerned */
+  g_mutex_lock (&job->lock);
+  job->done_queued = TRUE;
+  g_mutex_unlock (&job->lock);
+  send_queued_batches (job);
 
   g_vfs_job_emit_finished (G_VFS_JOB (job));
 }
@@ -53,6 +53,22 @@ struct _GVfsJobEnumerate
 
   GVariantBuilder *building_infos;
   int n_building_infos;
+  gsize building_infos_size;
+  int batch_size;
+
+  /* Set if the client takes GotInfoCompact */
+  gboolean compact_infos;
+  GHashTable *attribute_ids;
+  GPtrArray *new_attributes;
+
+  /* GotInfo calls the client hasn't acknowledged yet, and the batches
+   * waiting for the client to have room. Protected by lock */
+  GMutex lock;
+  int n_pending_batches;
+  GQueue queued_batches;
+  gboolean client_failed;
+  gboolean done_queued;
+  gboolean done_sent;
 };
 
 struct _GVfsJobEnumerateClass
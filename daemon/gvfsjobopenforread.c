@@ -78,15 +78,16 @@ g_vfs_job_open_for_read_class_init (GVfsJobOpenForReadClass *klass)
 static void
 g_vfs_job_open_for_read_init (GVfsJobOpenForRead *job)
 {
+  job->direct_fd = -1;
 }
 
-gboolean
-g_vfs_job_open_for_read_new_handle (GVfsDBusMount *object,
-                                    GDBusMethodInvocation *invocation,
-                                    GUnixFDList *fd_list,
-                                    const gchar *arg_path_data,
-                                    guint arg_pid,
-                                    GVfsBackend *backend)
+static gboolean
+new_handle (GVfsDBusMount *object,
+            GDBusMethodInvocation *invocation,
+            const gchar *arg_path_data,
+            guint arg_pid,
+            GVfsBackend *backend,
+            gboolean direct)
 {
   GVfsJobOpenForRead *job;
 
@@ -101,6 +102,7 @@ g_vfs_job_open_for_read_new_handle (GVfsDBusMount *object,
   job->filename = g_strdup (arg_path_data);
   job->backend = backend;
   job->pid = arg_pid;
+  job->direct = direct;
 
   g_vfs_job_source_new_job (G_VFS_JOB_SOURCE (backend), G_VFS_JOB (job));
   g_object_unref (job);
@@ -108,6 +110,28 @@ g_vfs_job_open_for_read_new_handle (GVfsDBusMount *object,
   return TRUE;
 }
 
+gboolean
+g_vfs_job_open_for_read_new_handle (GVfsDBusMount *object,
+                                    GDBusMethodInvocation *invocation,
+                                    GUnixFDList *fd_list,
+                                    const gchar *arg_path_data,
+                                    guint arg_pid,
+                                    GVfsBackend *backend)
+{
+  return new_handle (object, invocation, arg_path_data, arg_pid, backend, FALSE);
+}
+
+gboolean
+g_vfs_job_open_for_read_direct_new_handle (GVfsDBusMount *object,
+                                           GDBusMethodInvocation *invocation,
+                                           GUnixFDList *fd_list,
+                                           const gchar *arg_path_data,
+                                           guint arg_pid,
+                                           GVfsBackend *backend)
+{
+  return new_handle (object, invocation, arg_path_data, arg_pid, backend, TRUE);
+}
+
 static void
 run (GVfsJob *job)
 {
@@ -155,6 +179,18 @@ g_vfs_job_open_for_read_set_can_seek (GVfsJobOpenForRead *job,
   job->can_seek = can_seek;
 }
 
+/* Lets the client read the data directly from fd, a local file backing
+ * the handle. The fd is duplicated when the reply is sent, so it only has
+ * to stay valid until then. It must not be used by the backend afterwards
+ * as the file offset is shared with the client.
+ */
+void
+g_vfs_job_open_for_read_set_direct_fd (GVfsJobOpenForRead *job,
+				       int                 fd)
+{
+  job->direct_fd = fd;
+}
+
 /* Might be called on an i/o thread */
 static void
 create_reply (GVfsJob *job,
@@ -166,6 +202,8 @@ create_reply (GVfsJob *job,
   GError *error;
   int remote_fd;
   int fd_id;
+  int direct_fd_id;
+  int shm_fd, shm_fd_id;
   GUnixFDList *fd_list;
 
   g_assert (open_job->backend_handle != NULL);
@@ -194,10 +232,31 @@ create_reply (GVfsJob *job,
       g_error_free (error);
     }
 
+  /* Not fatal if these fail, the client then just reads through the channel */
+  direct_fd_id = -1;
+  shm_fd_id = -1;
+  if (open_job->direct && open_job->direct_fd != -1)
+    direct_fd_id = g_unix_fd_list_append (fd_list, open_job->direct_fd, NULL);
+  else if (open_job->direct)
+    {
+      shm_fd = g_vfs_read_channel_create_shm (channel);
+      if (shm_fd != -1)
+        {
+          shm_fd_id = g_unix_fd_list_append (fd_list, shm_fd, NULL);
+          close (shm_fd);
+        }
+    }
+
   if (open_job->read_icon)
     gvfs_dbus_mount_complete_open_icon_for_read (object, invocation,
                                                  fd_list, g_variant_new_handle (fd_id),
                                                  open_job->can_seek);
+  else if (open_job->direct)
+    gvfs_dbus_mount_complete_open_for_read_direct (object, invocation,
+                                                   fd_list, g_variant_new_handle (fd_id),
+                                                   open_job->can_seek,
+                                                   direct_fd_id,
+                                                   shm_fd_id);
   else
     gvfs_dbus_mount_complete_open_for_read (object, invocation,
                                             fd_list, g_variant_new_handle (fd_id),
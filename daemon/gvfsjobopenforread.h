@@ -48,6 +48,8 @@ struct _GVfsJobOpenForRead
   gboolean can_seek;
   GVfsReadChannel *read_channel;
   gboolean read_icon;
+  gboolean direct;
+  int direct_fd;
 
   GPid pid;
 };
@@ -65,10 +67,18 @@ gboolean         g_vfs_job_open_for_read_new_handle    (GVfsDBusMount         *o
                                                         const gchar           *arg_path_data,
                                                         guint                  arg_pid,
                                                         GVfsBackend           *backend);
+gboolean         g_vfs_job_open_for_read_direct_new_handle (GVfsDBusMount         *object,
+                                                            GDBusMethodInvocation *invocation,
+                                                            GUnixFDList           *fd_list,
+                                                            const gchar           *arg_path_data,
+                                                            guint                  arg_pid,
+                                                            GVfsBackend           *backend);
 void             g_vfs_job_open_for_read_set_handle    (GVfsJobOpenForRead *job,
 							GVfsBackendHandle   handle);
 void             g_vfs_job_open_for_read_set_can_seek  (GVfsJobOpenForRead *job,
 							gboolean            can_seek);
+void             g_vfs_job_open_for_read_set_direct_fd (GVfsJobOpenForRead *job,
+							int                 fd);
 GPid             g_vfs_job_open_for_read_get_pid       (GVfsJobOpenForRead *job);
 
 G_END_DECLS
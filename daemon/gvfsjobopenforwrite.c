@@ -79,19 +79,20 @@ g_vfs_job_open_for_write_class_init (GVfsJobOpenForWriteClass *klass)
 static void
 g_vfs_job_open_for_write_init (GVfsJobOpenForWrite *job)
 {
+  job->direct_fd = -1;
 }
 
-gboolean
-g_vfs_job_open_for_write_new_handle (GVfsDBusMount *object,
-                                     GDBusMethodInvocation *invocation,
-                                     GUnixFDList *fd_list,
-                                     const gchar *arg_path_data,
-                                     guint16 arg_mode,
-                                     const gchar *arg_etag,
-                                     gboolean arg_make_backup,
-                                     guint arg_flags,
-                                     guint arg_pid,
-                                     GVfsBackend *backend)
+static gboolean
+new_handle (GVfsDBusMount *object,
+            GDBusMethodInvocation *invocation,
+            const gchar *arg_path_data,
+            guint16 arg_mode,
+            const gchar *arg_etag,
+            gboolean arg_make_backup,
+            guint arg_flags,
+            guint arg_pid,
+            GVfsBackend *backend,
+            gboolean direct)
 {
   GVfsJobOpenForWrite *job;
   
@@ -111,6 +112,7 @@ g_vfs_job_open_for_write_new_handle (GVfsDBusMount *object,
   job->flags = arg_flags;
   job->backend = backend;
   job->pid = arg_pid;
+  job->direct = direct;
 
   g_vfs_job_source_new_job (G_VFS_JOB_SOURCE (backend), G_VFS_JOB (job));
   g_object_unref (job);
@@ -118,6 +120,38 @@ g_vfs_job_open_for_write_new_handle (GVfsDBusMount *object,
   return TRUE;
 }
 
+gboolean
+g_vfs_job_open_for_write_new_handle (GVfsDBusMount *object,
+                                     GDBusMethodInvocation *invocation,
+                                     GUnixFDList *fd_list,
+                                     const gchar *arg_path_data,
+                                     guint16 arg_mode,
+                                     const gchar *arg_etag,
+                                     gboolean arg_make_backup,
+                                     guint arg_flags,
+                                     guint arg_pid,
+                                     GVfsBackend *backend)
+{
+  return new_handle (object, invocation, arg_path_data, arg_mode, arg_etag,
+                     arg_make_backup, arg_flags, arg_pid, backend, FALSE);
+}
+
+gboolean
+g_vfs_job_open_for_write_direct_new_handle (GVfsDBusMount *object,
+                                            GDBusMethodInvocation *invocation,
+                                            GUnixFDList *fd_list,
+                                            const gchar *arg_path_data,
+                                            guint16 arg_mode,
+                                            const gchar *arg_etag,
+                                            gboolean arg_make_backup,
+                                            guint arg_flags,
+                                            guint arg_pid,
+                                            GVfsBackend *backend)
+{
+  return new_handle (object, invocation, arg_path_data, arg_mode, arg_etag,
+                     arg_make_backup, arg_flags, arg_pid, backend, TRUE);
+}
+
 static void
 run (GVfsJob *job)
 {
@@ -239,6 +273,18 @@ g_vfs_job_open_for_write_set_initial_offset (GVfsJobOpenForWrite *job,
   job->initial_offset = initial_offset;
 }
 
+/* Lets the client write the data directly to fd, a local file backing
+ * the handle. The fd is duplicated when the reply is sent, so it only has
+ * to stay valid until then. The backend may only use it again once the
+ * handle is closed, the file offset is shared with the client.
+ */
+void
+g_vfs_job_open_for_write_set_direct_fd (GVfsJobOpenForWrite *job,
+					int                  fd)
+{
+  job->direct_fd = fd;
+}
+
 /* Might be called on an i/o thread */
 static void
 create_reply (GVfsJob *job,
@@ -250,6 +296,7 @@ create_reply (GVfsJob *job,
   GError *error;
   int remote_fd;
   int fd_id;
+  int direct_fd_id;
   GUnixFDList *fd_list;
 
   g_assert (open_job->backend_handle != NULL);
@@ -278,10 +325,24 @@ create_reply (GVfsJob *job,
       g_error_free (error);
     }
 
-  gvfs_dbus_mount_complete_open_for_write (object, invocation,
-                                           fd_list, g_variant_new_handle (fd_id),
-                                           open_job->can_seek,
-                                           open_job->initial_offset);
+  if (open_job->direct)
+    {
+      direct_fd_id = -1;
+      if (open_job->direct_fd != -1)
+        /* Not fatal, the client then just writes through the channel */
+        direct_fd_id = g_unix_fd_list_append (fd_list, open_job->direct_fd, NULL);
+
+      gvfs_dbus_mount_complete_open_for_write_direct (object, invocation,
+                                                      fd_list, g_variant_new_handle (fd_id),
+                                                      open_job->can_seek,
+                                                      open_job->initial_offset,
+                                                      direct_fd_id);
+    }
+  else
+    gvfs_dbus_mount_complete_open_for_write (object, invocation,
+                                             fd_list, g_variant_new_handle (fd_id),
+                                             open_job->can_seek,
+                                             open_job->initial_offset);
   
   close (remote_fd);
   g_object_unref (fd_list);
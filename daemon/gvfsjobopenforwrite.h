@@ -60,6 +60,8 @@ struct _GVfsJobOpenForWrite
   gboolean can_seek;
   goffset initial_offset;
   GVfsWriteChannel *write_channel;
+  gboolean direct;
+  int direct_fd;
 
   GPid pid;
 };
@@ -81,12 +83,24 @@ gboolean g_vfs_job_open_for_write_new_handle         (GVfsDBusMount         *obj
                                                       guint                  arg_flags,
                                                       guint                  arg_pid,
                                                       GVfsBackend           *backend);
+gboolean g_vfs_job_open_for_write_direct_new_handle  (GVfsDBusMount         *object,
+                                                      GDBusMethodInvocation *invocation,
+                                                      GUnixFDList           *fd_list,
+                                                      const gchar           *arg_path_data,
+                                                      guint16                arg_mode,
+                                                      const gchar           *arg_etag,
+                                                      gboolean               arg_make_backup,
+                                                      guint                  arg_flags,
+                                                      guint                  arg_pid,
+                                                      GVfsBackend           *backend);
 void     g_vfs_job_open_for_write_set_handle         (GVfsJobOpenForWrite *job,
 						      GVfsBackendHandle    handle);
 void     g_vfs_job_open_for_write_set_can_seek       (GVfsJobOpenForWrite *job,
 						      gboolean             can_seek);
 void     g_vfs_job_open_for_write_set_initial_offset (GVfsJobOpenForWrite *job,
 						      goffset              initial_offset);
+void     g_vfs_job_open_for_write_set_direct_fd      (GVfsJobOpenForWrite *job,
+						      int                  fd);
 GPid     g_vfs_job_open_for_write_get_pid            (GVfsJobOpenForWrite *job);
 
 G_END_DECLS
@@ -24,14 +24,17 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 
 #include <glib.h>
 #include <glib-object.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <gvfsreadchannel.h>
 #include <gvfsdaemonprotocol.h>
 #include <gvfsdaemonutils.h>
@@ -46,9 +49,20 @@ struct _GVfsReadChannel
   GVfsChannel parent_instance;
 
   guint read_count;
+  guint readahead_count;
   int seek_generation;
+
+  /* Shared memory area, if the client has one */
+  char *shm;
+  guint32 shm_pos;
 };
 
+/* Smaller blocks are cheap enough to send through the socket */
+#define SHM_MIN_BLOCK_SIZE (16*1024)
+
+#define SHM_MAP_SIZE (G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE + \
+		      G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_SIZE)
+
 G_DEFINE_TYPE (GVfsReadChannel, g_vfs_read_channel, G_VFS_TYPE_CHANNEL)
 
 static GVfsJob *read_channel_close          (GVfsChannel  *channel);
@@ -66,6 +80,11 @@ static GVfsJob *read_channel_readahead      (GVfsChannel  *channel,
 static void
 g_vfs_read_channel_finalize (GObject *object)
 {
+  GVfsReadChannel *read_channel = G_VFS_READ_CHANNEL (object);
+
+  if (read_channel->shm)
+    munmap (read_channel->shm, SHM_MAP_SIZE);
+
   if (G_OBJECT_CLASS (g_vfs_read_channel_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_read_channel_parent_class)->finalize) (object);
 }
@@ -101,33 +120,38 @@ read_channel_close (GVfsChannel *channel)
  * gstreamer tends to do 4k reads and seeks, and
  * the first read when sniffing is also small, so
  * it makes sense to never read more that 4k
- * (one page) on the first read. It should not affect
- * long-file copy performance anyway.
+ * (one page) on the first read. After that the size
+ * doubles with each read as long as the client reads
+ * sequentially, and falls back to 4k on seeks.
  */
+#define READ_SIZE_MIN (4*1024)
+#define READ_SIZE_MAX (1024*1024)
+
+/* Memory used by the readahead buffers of all the channels of the
+ * daemon, they are only started while below this. */
+#define READAHEAD_MAX_BYTES (16*1024*1024)
+
+static volatile gint readahead_bytes = 0;
+
 static guint32
 modify_read_size (GVfsReadChannel *channel,
 		  guint32 requested_size)
 {
   guint32 real_size;
+  guint shift;
 
-  if (channel->read_count <= 1)
-    real_size = 4*1024;
-  else if (channel->read_count <= 2)
-    real_size = 8*1024;
-  else if (channel->read_count <= 3)
-    real_size = 16*1024;
-  else if (channel->read_count <= 4)
-    real_size = 32*1024;
-  else
-    real_size = 64*1024;
+  shift = channel->read_count <= 1 ? 0 : channel->read_count - 1;
+  if (shift > 8)
+    shift = 8;
+  real_size = READ_SIZE_MIN << shift;
 
   if (requested_size > real_size)
       real_size = requested_size;
 
-  /* Don't do ridicoulously large requests as this
-     is just stupid on the network */
-  if (real_size > 128 * 1024)
-    real_size = 128 * 1024;
+  /* Don't do ridicoulously large requests, they take
+     ages on slow networks before anything is returned */
+  if (real_size > READ_SIZE_MAX)
+    real_size = READ_SIZE_MAX;
 
   return real_size;
 }
@@ -175,6 +199,7 @@ read_channel_handle_request (GVfsChannel *channel,
 	seek_type = G_SEEK_END;
       
       read_channel->read_count = 0;
+      read_channel->readahead_count = 0;
       read_channel->seek_generation++;
       job = g_vfs_job_seek_read_new (read_channel,
 				     backend_handle,
@@ -205,6 +230,13 @@ read_channel_handle_request (GVfsChannel *channel,
   return job;
 }
 
+static void
+readahead_job_finalized (gpointer data,
+			 GObject *job)
+{
+  g_atomic_int_add (&readahead_bytes, - (gint) GPOINTER_TO_UINT (data));
+}
+
 static GVfsJob *
 read_channel_readahead (GVfsChannel  *channel,
 			GVfsJob       *job)
@@ -212,6 +244,9 @@ read_channel_readahead (GVfsChannel  *channel,
   GVfsJob *readahead_job;
   GVfsReadChannel *read_channel;
   GVfsJobRead *read_job;
+  GVfsBackendClass *backend_class;
+  guint depth;
+  guint32 size;
 
   readahead_job = NULL;
   if (!job->failed &&
@@ -231,15 +266,30 @@ read_channel_readahead (GVfsChannel  *channel,
 	 reading the readahead data, and after that is done
 	 send a new request but start reading the result of the
 	 previous read request. This way the reading will be
-	 fully pipelined. */
+	 fully pipelined.
+	 Backends with a deeper read pipeline get more readaheads,
+	 one after each other, so they stay that many reads ahead. */
+      backend_class = G_VFS_BACKEND_GET_CLASS (g_vfs_channel_get_backend (channel));
+      depth = MAX (backend_class->read_pipeline_depth, 1);
+
+      size = modify_read_size (read_channel, 8192);
+
       if (read_job->data_count != 0 &&
-	  read_channel->read_count == 2)
+	  read_channel->read_count >= 2 &&
+	  read_channel->readahead_count < depth &&
+	  g_atomic_int_get (&readahead_bytes) + size <= READAHEAD_MAX_BYTES)
 	{
 	  read_channel->read_count++;
+	  read_channel->readahead_count++;
 	  readahead_job = g_vfs_job_read_new (read_channel,
 					      g_vfs_channel_get_backend_handle (channel),
-					      modify_read_size (read_channel, 8192),
+					      size,
 					      g_vfs_channel_get_backend (channel));
+
+	  g_atomic_int_add (&readahead_bytes, size);
+	  g_object_weak_ref (G_OBJECT (readahead_job),
+			     readahead_job_finalized,
+			     GUINT_TO_POINTER (size));
 	}
     }
 
@@ -284,6 +334,39 @@ g_vfs_read_channel_send_closed (GVfsReadChannel *read_channel)
   g_vfs_channel_send_reply (channel, &reply, NULL, 0);
 }
 
+/* Copies a block to the shared memory ring if the client mapped it and
+ * there is room. Replies are sent in the order of the calls, so the
+ * client takes the blocks in the same order.
+ */
+static gboolean
+put_shm_block (GVfsReadChannel *read_channel,
+	       char            *buffer,
+	       gsize            count)
+{
+  GVfsDaemonSocketProtocolShmHeader *header;
+  guint32 start, consumed;
+
+  if (read_channel->shm == NULL ||
+      count > G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_SIZE)
+    return FALSE;
+
+  header = (GVfsDaemonSocketProtocolShmHeader *)read_channel->shm;
+  if (!g_atomic_int_get (&header->client_mapped))
+    return FALSE;
+
+  consumed = (guint32) g_atomic_int_get (&header->consumed);
+  start = _g_vfs_daemon_shm_block_start (read_channel->shm_pos, count);
+  if (start + count - consumed > G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_SIZE)
+    return FALSE;
+
+  memcpy (read_channel->shm + G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE +
+	  start % G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_SIZE,
+	  buffer, count);
+  read_channel->shm_pos = start + count;
+
+  return TRUE;
+}
+
 /* Might be called on an i/o thread
  */
 void
@@ -296,12 +379,66 @@ g_vfs_read_channel_send_data (GVfsReadChannel  *read_channel,
 
   channel = G_VFS_CHANNEL (read_channel);
 
-  reply.type = g_htonl (G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_DATA);
   reply.seq_nr = g_htonl (g_vfs_channel_get_current_seq_nr (channel));
   reply.arg1 = g_htonl (count);
   reply.arg2 = g_htonl (read_channel->seek_generation);
 
-  g_vfs_channel_send_reply (channel, &reply, buffer, count);
+  if (count >= SHM_MIN_BLOCK_SIZE && put_shm_block (read_channel, buffer, count))
+    {
+      reply.type = g_htonl (G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_DATA_SHM);
+      g_vfs_channel_send_reply (channel, &reply, NULL, 0);
+    }
+  else
+    {
+      reply.type = g_htonl (G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_DATA);
+      g_vfs_channel_send_reply (channel, &reply, buffer, count);
+    }
+}
+
+/* Creates the shared memory area of the channel and returns a fd for
+ * the client, or -1 if it can't be created.
+ */
+int
+g_vfs_read_channel_create_shm (GVfsReadChannel *read_channel)
+{
+  char *shm;
+  int fd;
+
+  g_return_val_if_fail (read_channel->shm == NULL, -1);
+
+#ifdef HAVE_MEMFD_CREATE
+  fd = memfd_create ("gvfs-read-channel", MFD_CLOEXEC);
+#else
+  {
+    char *path;
+
+    path = g_build_filename (g_get_user_runtime_dir (), "gvfs-read-channel-XXXXXX", NULL);
+    fd = g_mkstemp (path);
+    if (fd != -1)
+      g_unlink (path);
+    g_free (path);
+  }
+#endif
+  if (fd == -1)
+    return -1;
+
+  if (ftruncate (fd, SHM_MAP_SIZE) == -1)
+    {
+      close (fd);
+      return -1;
+    }
+
+  shm = mmap (NULL, SHM_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (shm == MAP_FAILED)
+    {
+      close (fd);
+      return -1;
+    }
+
+  read_channel->shm = shm;
+  read_channel->shm_pos = 0;
+
+  return fd;
 }
 
 
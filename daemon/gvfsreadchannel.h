@@ -55,6 +55,7 @@ void            g_vfs_read_channel_send_data          (GVfsReadChannel     *read
 void            g_vfs_read_channel_send_closed        (GVfsReadChannel     *read_channel);
 void            g_vfs_read_channel_send_seek_offset   (GVfsReadChannel     *read_channel,
 						      goffset             offset);
+int             g_vfs_read_channel_create_shm         (GVfsReadChannel     *read_channel);
 
 G_END_DECLS
 
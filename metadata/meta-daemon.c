@@ -132,85 +132,126 @@ tree_info_lookup (const char *filename)
   return info;
 }
 
-static gboolean
-handle_set (GVfsMetadata *object,
-            GDBusMethodInvocation *invocation,
-            const gchar *arg_treefile,
-            const gchar *arg_path,
-            GVariant *arg_data,
-            GVfsMetadata *daemon)
+static void
+batch_add_data (MetaBatch *batch,
+                const char *path,
+                GVariant *data)
 {
-  TreeInfo *info;
-  const gchar *str;
   const gchar **strv;
   const gchar *key;
-  GError *error;
   GVariantIter iter;
   GVariant *value;
 
-  info = tree_info_lookup (arg_treefile);
-  if (info == NULL)
-    {
-      g_dbus_method_invocation_return_error (invocation,
-                                             G_IO_ERROR,
-                                             G_IO_ERROR_NOT_FOUND,
-                                             _("Can't find metadata file %s"),
-                                             arg_treefile);
-      return TRUE;
-    }
-
-  error = NULL;
-
-  g_variant_iter_init (&iter, arg_data);
+  g_variant_iter_init (&iter, data);
   while (g_variant_iter_next (&iter, "{&sv}", &key, &value))
     {
       if (g_variant_is_of_type (value, G_VARIANT_TYPE_STRING_ARRAY))
 	{
 	  /* stringv */
           strv = g_variant_get_strv (value, NULL);
-	  if (!meta_tree_set_stringv (info->tree, arg_path, key, (gchar **) strv))
-	    {
-	      g_set_error_literal (&error, G_IO_ERROR,
-                                   G_IO_ERROR_FAILED,
-                                  _("Unable to set metadata key"));
-	    }
+	  meta_batch_set_stringv (batch, path, key, (gchar **) strv);
 	  g_free (strv);
 	}
       else if (g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
 	{
 	  /* string */
-          str = g_variant_get_string (value, NULL);
-	  if (!meta_tree_set_string (info->tree, arg_path, key, str))
-	    {
-              g_set_error_literal (&error, G_IO_ERROR,
-                                   G_IO_ERROR_FAILED,
-                                   _("Unable to set metadata key"));
-	    }
+	  meta_batch_set_string (batch, path, key, g_variant_get_string (value, NULL));
 	}
       else if (g_variant_is_of_type (value, G_VARIANT_TYPE_BYTE))
 	{
 	  /* Unset */
-	  if (!meta_tree_unset (info->tree, arg_path, key))
-	    {
-              g_set_error_literal (&error, G_IO_ERROR,
-                                   G_IO_ERROR_FAILED,
-                                   _("Unable to unset metadata key"));
-	    }
+	  meta_batch_unset (batch, path, key);
 	}
       g_variant_unref (value);
     }
+}
 
-  tree_info_schedule_writeout (info);
+static gboolean
+handle_set (GVfsMetadata *object,
+            GDBusMethodInvocation *invocation,
+            const gchar *arg_treefile,
+            const gchar *arg_path,
+            GVariant *arg_data,
+            GVfsMetadata *daemon)
+{
+  TreeInfo *info;
+  MetaBatch *batch;
+  gboolean res;
 
-  if (error)
+  info = tree_info_lookup (arg_treefile);
+  if (info == NULL)
     {
-      g_dbus_method_invocation_return_gerror (invocation, error);
-      g_error_free (error);
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_NOT_FOUND,
+                                             _("Can't find metadata file %s"),
+                                             arg_treefile);
+      return TRUE;
     }
+
+  /* All keys go to the journal at once */
+  batch = meta_batch_new ();
+  batch_add_data (batch, arg_path, arg_data);
+  res = meta_tree_apply_batch (info->tree, batch);
+  meta_batch_free (batch);
+
+  tree_info_schedule_writeout (info);
+
+  if (!res)
+    g_dbus_method_invocation_return_error_literal (invocation,
+                                                   G_IO_ERROR,
+                                                   G_IO_ERROR_FAILED,
+                                                   _("Unable to set metadata key"));
   else
+    gvfs_metadata_complete_set (object, invocation);
+  
+  return TRUE;
+}
+
+static gboolean
+handle_set_many (GVfsMetadata *object,
+                 GDBusMethodInvocation *invocation,
+                 const gchar *arg_treefile,
+                 GVariant *arg_files,
+                 GVfsMetadata *daemon)
+{
+  TreeInfo *info;
+  MetaBatch *batch;
+  GVariantIter iter;
+  const gchar *path;
+  GVariant *data;
+  gboolean res;
+
+  info = tree_info_lookup (arg_treefile);
+  if (info == NULL)
     {
-      gvfs_metadata_complete_set (object, invocation);
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_NOT_FOUND,
+                                             _("Can't find metadata file %s"),
+                                             arg_treefile);
+      return TRUE;
     }
+
+  batch = meta_batch_new ();
+  g_variant_iter_init (&iter, arg_files);
+  while (g_variant_iter_next (&iter, "(^&ay@a{sv})", &path, &data))
+    {
+      batch_add_data (batch, path, data);
+      g_variant_unref (data);
+    }
+  res = meta_tree_apply_batch (info->tree, batch);
+  meta_batch_free (batch);
+
+  tree_info_schedule_writeout (info);
+
+  if (!res)
+    g_dbus_method_invocation_return_error_literal (invocation,
+                                                   G_IO_ERROR,
+                                                   G_IO_ERROR_FAILED,
+                                                   _("Unable to set metadata key"));
+  else
+    gvfs_metadata_complete_set_many (object, invocation);
   
   return TRUE;
 }
@@ -307,6 +348,81 @@ handle_get (GVfsMetadata *object,
   return TRUE;
 }
 
+static gboolean
+enum_children (const char *entry,
+               guint64 last_changed,
+               gboolean has_children,
+               gboolean has_data,
+               gpointer user_data)
+{
+  GPtrArray *children = user_data;
+
+  if (has_data)
+    g_ptr_array_add (children, g_strdup (entry));
+  return TRUE;
+}
+
+static gboolean
+handle_get_directory (GVfsMetadata *object,
+                      GDBusMethodInvocation *invocation,
+                      const gchar *arg_treefile,
+                      const gchar *arg_path,
+                      const gchar *const *arg_keys,
+                      GVfsMetadata *daemon)
+{
+  TreeInfo *info;
+  GPtrArray *children;
+  GPtrArray *meta_keys;
+  GVariantBuilder builder, data_builder;
+  char *child_path;
+  guint i, j;
+
+  info = tree_info_lookup (arg_treefile);
+  if (info == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_NOT_FOUND,
+                                             _("Can't find metadata file %s"),
+                                             arg_treefile);
+      return TRUE;
+    }
+
+  children = g_ptr_array_new_with_free_func (g_free);
+  meta_tree_enumerate_dir (info->tree, arg_path, enum_children, children);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(aya{sv})"));
+  for (i = 0; i < children->len; i++)
+    {
+      child_path = g_build_filename (arg_path, g_ptr_array_index (children, i), NULL);
+
+      g_variant_builder_init (&data_builder, G_VARIANT_TYPE_VARDICT);
+      if (arg_keys == NULL || arg_keys[0] == NULL)
+        {
+          meta_keys = g_ptr_array_new_with_free_func (g_free);
+          meta_tree_enumerate_keys (info->tree, child_path, enum_keys, meta_keys);
+          for (j = 0; j < meta_keys->len; j++)
+            append_key (&data_builder, info->tree, child_path, g_ptr_array_index (meta_keys, j));
+          g_ptr_array_unref (meta_keys);
+        }
+      else
+        {
+          for (j = 0; arg_keys[j] != NULL; j++)
+            append_key (&data_builder, info->tree, child_path, arg_keys[j]);
+        }
+
+      g_variant_builder_add (&builder, "(^aya{sv})",
+                             g_ptr_array_index (children, i), &data_builder);
+      g_free (child_path);
+    }
+  g_ptr_array_unref (children);
+
+  gvfs_metadata_complete_get_directory (object, invocation,
+                                        g_variant_builder_end (&builder));
+
+  return TRUE;
+}
+
 static gboolean
 handle_unset (GVfsMetadata *object,
               GDBusMethodInvocation *invocation,
@@ -428,8 +544,10 @@ on_name_acquired (GDBusConnection *connection,
   skeleton = gvfs_metadata_skeleton_new ();
   
   g_signal_connect (skeleton, "handle-set", G_CALLBACK (handle_set), skeleton);
+  g_signal_connect (skeleton, "handle-set-many", G_CALLBACK (handle_set_many), skeleton);
   g_signal_connect (skeleton, "handle-unset", G_CALLBACK (handle_unset), skeleton);
   g_signal_connect (skeleton, "handle-get", G_CALLBACK (handle_get), skeleton);
+  g_signal_connect (skeleton, "handle-get-directory", G_CALLBACK (handle_get_directory), skeleton);
   g_signal_connect (skeleton, "handle-remove", G_CALLBACK (handle_remove), skeleton);
   g_signal_connect (skeleton, "handle-move", G_CALLBACK (handle_move), skeleton);
 
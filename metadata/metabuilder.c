@@ -590,7 +590,9 @@ append_string (GString *out,
 				    string, NULL,
 				    (gpointer *)&offsets))
     {
-      offsets = g_list_append (offsets, GUINT_TO_POINTER (offset));
+      /* Order is irrelevant, insert after the head so the
+	 hash value stays valid without walking the list */
+      g_list_insert (offsets, GUINT_TO_POINTER (offset), 1);
     }
   else
     {
@@ -700,15 +702,12 @@ write_children (GString *out,
   GHashTable *strings;
   MetaFile *child, *file;
   GList *l;
-  GList *files;
+  GQueue files = G_QUEUE_INIT;
 
-  files = g_list_prepend (NULL, builder->root);
+  g_queue_push_tail (&files, builder->root);
 
-  while (files != NULL)
+  while ((file = g_queue_pop_head (&files)) != NULL)
     {
-      file = files->data;
-      files = g_list_delete_link (files, files);
-
       if (file->children == NULL)
 	continue; /* No children, skip file */
 
@@ -736,7 +735,7 @@ write_children (GString *out,
 	  append_time_t (out, child->last_changed, builder);
 
 	  if (file->children)
-	    files = g_list_append (files, child);
+	    g_queue_push_tail (&files, child);
 	}
 
       string_block_end (out, strings);
@@ -783,7 +782,7 @@ write_metadata (GString *out,
   GList *stringvs;
   MetaFile *child, *file;
   GList *l;
-  GList *files;
+  GQueue files = G_QUEUE_INIT;
 
   /* Root metadata */
   if (builder->root->data != NULL)
@@ -798,12 +797,9 @@ write_metadata (GString *out,
 
   /* the rest, breadth first with all files in one
      dir sharing string block */
-  files = g_list_prepend (NULL, builder->root);
-  while (files != NULL)
+  g_queue_push_tail (&files, builder->root);
+  while ((file = g_queue_pop_head (&files)) != NULL)
     {
-      file = files->data;
-      files = g_list_delete_link (files, files);
-
       if (file->children == NULL)
 	continue; /* No children, skip file */
 
@@ -819,7 +815,7 @@ write_metadata (GString *out,
 				     &stringvs, strings, key_hash);
 
 	  if (child->children != NULL)
-	    files = g_list_append (files, child);
+	    g_queue_push_tail (&files, child);
 	}
 
       stringv_block_end (out, strings, stringvs);
@@ -1018,10 +1018,12 @@ meta_journal_entry_new_unset (guint64 mtime,
 }
 
 
-/* Call with writer lock held */
+/* Call with writer lock held. Readers see all of the entries at once,
+   when num_entries is updated. */
 static gboolean
-meta_journal_add_entry (MetaJournal *journal,
-			GString *entry)
+meta_journal_add_entries (MetaJournal *journal,
+			  GString *entries,
+			  guint32 n_entries)
 {
   char *ptr;
   guint32 offset;
@@ -1031,19 +1033,27 @@ meta_journal_add_entry (MetaJournal *journal,
   ptr = (char *)journal->last_entry;
   offset =  ptr - journal->data;
 
-  /* Does the entry fit? */
-  if (entry->len > journal->len - offset)
+  /* Do the entries fit? */
+  if (entries->len > journal->len - offset)
     return FALSE;
 
-  memcpy (ptr, entry->str, entry->len);
+  memcpy (ptr, entries->str, entries->len);
 
-  journal->header->num_entries = GUINT_TO_BE (journal->last_entry_num + 1);
+  journal->header->num_entries = GUINT_TO_BE (journal->last_entry_num + n_entries);
   meta_journal_validate_more (journal);
   g_assert (journal->journal_valid);
 
   return TRUE;
 }
 
+/* Call with writer lock held */
+static gboolean
+meta_journal_add_entry (MetaJournal *journal,
+			GString *entry)
+{
+  return meta_journal_add_entries (journal, entry, 1);
+}
+
 static MetaJournal *
 meta_journal_open (MetaTree *tree, const char *filename, gboolean for_write, guint32 tag)
 {
@@ -2513,6 +2523,118 @@ meta_tree_copy (MetaTree                         *tree,
   return res;
 }
 
+struct _MetaBatch {
+  guint64 mtime;
+  GString *entries;
+  guint32 n_entries;
+};
+
+/* A batch collects changes to apply to a tree with a single journal
+   write, e.g. the metadata of all the files of a directory. */
+MetaBatch *
+meta_batch_new (void)
+{
+  MetaBatch *batch;
+
+  batch = g_new0 (MetaBatch, 1);
+  batch->mtime = time (NULL);
+  batch->entries = g_string_new (NULL);
+
+  return batch;
+}
+
+void
+meta_batch_free (MetaBatch *batch)
+{
+  g_string_free (batch->entries, TRUE);
+  g_free (batch);
+}
+
+static void
+meta_batch_add (MetaBatch *batch,
+		GString   *entry)
+{
+  g_string_append_len (batch->entries, entry->str, entry->len);
+  batch->n_entries++;
+  g_string_free (entry, TRUE);
+}
+
+void
+meta_batch_set_string (MetaBatch  *batch,
+		       const char *path,
+		       const char *key,
+		       const char *value)
+{
+  meta_batch_add (batch, meta_journal_entry_new_set (batch->mtime, path, key, value));
+}
+
+void
+meta_batch_set_stringv (MetaBatch  *batch,
+			const char *path,
+			const char *key,
+			char      **value)
+{
+  meta_batch_add (batch, meta_journal_entry_new_setv (batch->mtime, path, key, value));
+}
+
+void
+meta_batch_unset (MetaBatch  *batch,
+		  const char *path,
+		  const char *key)
+{
+  meta_batch_add (batch, meta_journal_entry_new_unset (batch->mtime, path, key));
+}
+
+gboolean
+meta_tree_apply_batch (MetaTree  *tree,
+		       MetaBatch *batch)
+{
+  GString entry;
+  gsize offset;
+  gboolean res;
+
+  if (batch->n_entries == 0)
+    return TRUE;
+
+  g_rw_lock_writer_lock (&metatree_lock);
+
+  if (tree->journal == NULL ||
+      !tree->journal->journal_valid)
+    {
+      res = FALSE;
+      goto out;
+    }
+
+  res = TRUE;
+  if (meta_journal_add_entries (tree->journal, batch->entries, batch->n_entries))
+    goto out;
+
+  if (meta_tree_flush_locked (tree) &&
+      meta_journal_add_entries (tree->journal, batch->entries, batch->n_entries))
+    goto out;
+
+  /* Larger than the journal, add the entries one at a time, flushing
+     whenever it is full */
+  for (offset = 0; res && offset < batch->entries->len; offset += entry.len)
+    {
+      entry.str = batch->entries->str + offset;
+      entry.len = GUINT32_FROM_BE (*(guint32 *)entry.str);
+
+    retry:
+      if (!meta_journal_add_entry (tree->journal, &entry))
+	{
+	  if (meta_tree_flush_locked (tree))
+	    goto retry;
+
+	  res = FALSE;
+	}
+    }
+
+ out:
+  g_rw_lock_writer_unlock (&metatree_lock);
+  return res;
+}
+
 static char *
 canonicalize_filename (const char *filename)
 {
@@ -26,6 +26,7 @@
 #include <glib.h>
 
 typedef struct _MetaTree MetaTree;
+typedef struct _MetaBatch MetaBatch;
 typedef struct _MetaLookupCache MetaLookupCache;
 
 typedef enum {
@@ -104,4 +105,20 @@ gboolean    meta_tree_remove           (MetaTree                         *tree,
 gboolean    meta_tree_copy             (MetaTree                         *tree,
 					const char                       *src,
 					const char                       *dest);
+gboolean    meta_tree_apply_batch      (MetaTree                         *tree,
+					MetaBatch                        *batch);
+
+MetaBatch * meta_batch_new             (void);
+void        meta_batch_free            (MetaBatch                        *batch);
+void        meta_batch_set_string      (MetaBatch                        *batch,
+					const char                       *path,
+					const char                       *key,
+					const char                       *value);
+void        meta_batch_set_stringv     (MetaBatch                        *batch,
+					const char                       *path,
+					const char                       *key,
+					char                            **value);
+void        meta_batch_unset           (MetaBatch                        *batch,
+					const char                       *path,
+					const char                       *key);
 #endif /* __META_TREE_H__ */